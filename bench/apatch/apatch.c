@@ -0,0 +1,56 @@
+/* INFO: Root and unmount lookups against a package_config, as made for every
+           app launch, and for isolated services, which fall back to a
+           process prefix search. */
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+#include <sys/types.h>
+
+#define PACKAGES 500
+#define ROUNDS 20
+
+bool apatch_uid_granted_root(uid_t uid);
+
+bool apatch_uid_should_umount(uid_t uid, const char *const process);
+
+/* INFO: Only used to detect APatch, which is not done here */
+bool exec_command(char *restrict buf, size_t len, const char *restrict file, char *const argv[]) {
+  (void)buf;
+  (void)len;
+  (void)file;
+  (void)argv;
+
+  return false;
+}
+
+int main(void) {
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  unsigned long granted = 0, umount = 0, lookups = 0;
+  for (int round = 0; round < ROUNDS; round++) {
+    for (int i = 0; i < PACKAGES; i++) {
+      char process[64];
+      snprintf(process, sizeof(process), "com.example.app%d", i);
+
+      granted += apatch_uid_granted_root((uid_t)(10000 + i));
+      umount += apatch_uid_should_umount((uid_t)(10000 + i), process);
+      lookups += 2;
+
+      if (i % 10 == 0) {
+        snprintf(process, sizeof(process), "com.example.app%d:isolated", i);
+
+        umount += apatch_uid_should_umount((uid_t)(90000 + i), process);
+        lookups++;
+      }
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  double us = (double)(end.tv_sec - start.tv_sec) * 1e6 + (double)(end.tv_nsec - start.tv_nsec) / 1e3;
+  printf("%.2f us per lookup, %lu granted, %lu unmounted\n", us / (double)lookups, granted / ROUNDS, umount / ROUNDS);
+
+  return 0;
+}
@@ -0,0 +1,35 @@
+#!/bin/sh
+# Root and unmount lookups against a generated 500-package package_config,
+#   before and after it was indexed and cached.
+
+set -e
+
+. "$(dirname "$0")/../common.sh"
+
+BASELINE=$(resolve_baseline user-009)
+
+mkdir -p "$work/ap"
+python3 - "$work/ap/package_config" <<'PY'
+import sys
+
+with open(sys.argv[1], "w") as out:
+    out.write("pkg,exclude,allow,uid,to_uid,sctx\n")
+    for i in range(500):
+        out.write(f"com.example.app{i},{i % 2},{int(i % 7 == 0)},{10000 + i},0,u:r:untrusted_app:s0\n")
+PY
+
+checkout "$work/new" zygiskd/src
+checkout "$work/old" zygiskd/src "$BASELINE"
+
+for tree in old new; do
+  src="$work/$tree/zygiskd/src"
+
+  # INFO: Points the daemon at the generated package_config
+  sed -i "s|\"/data/adb/ap|\"$work/ap|g" "$src/root_impl/apatch.c"
+
+  $CC $CFLAGS -DMIN_APATCH_VERSION=1 -I"$src" "$bench/apatch/apatch.c" "$src/root_impl/apatch.c" "$bench/log.c" \
+    -lpthread -o "$work/$tree/apatch"
+
+  printf '%s: ' "$tree"
+  "$work/$tree/apatch"
+done
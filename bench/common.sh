@@ -0,0 +1,53 @@
+# Sourced by the benchmark scripts. Each one builds a driver against the
+#   sources of the working tree and against those of a baseline revision,
+#   and runs both.
+
+root=$(git -C "$(dirname "$0")" rev-parse --show-toplevel)
+bench="$root/bench"
+
+CC=${CC:-cc}
+CXX=${CXX:-c++}
+CFLAGS="-O2 -D_GNU_SOURCE -I$bench/include"
+
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+# INFO: Copies path, from the working tree or from rev, under dir
+checkout() {
+  dir=$1
+  path=$2
+  rev=$3
+
+  mkdir -p "$dir"
+  if [ -z "$rev" ]; then
+    (cd "$root" && tar -cf - "$path") | tar -xf - -C "$dir"
+  else
+    git -C "$root" archive "$rev" "$path" | tar -xf - -C "$dir"
+  fi
+
+  # INFO: Before the process flags became macros, constants.h only built
+  #   with clang. Its constants did not change, so the one of the working
+  #   tree is used instead, letting both sides build with any compiler.
+  if [ -n "$rev" ] && [ -f "$dir/zygiskd/src/constants.h" ]; then
+    cp "$root/zygiskd/src/constants.h" "$dir/zygiskd/src/constants.h"
+  fi
+}
+
+# INFO: The revision the change of request_id was made on, BASELINE if set,
+#   or the parent of the commit whose subject starts with [request_id]
+resolve_baseline() {
+  if [ -n "$BASELINE" ]; then
+    echo "$BASELINE"
+
+    return
+  fi
+
+  commit=$(git -C "$root" log --format='%H %s' | grep -F " [$1] " | grep -vF " [$1] fix: " | tail -n 1 | cut -d ' ' -f 1)
+  if [ -z "$commit" ]; then
+    echo "No commit found for $1, set BASELINE=<rev>" >&2
+
+    return 1
+  fi
+
+  echo "$commit^"
+}
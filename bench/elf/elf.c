@@ -0,0 +1,78 @@
+/* INFO: ElfImg on a library with a .symtab. "time" creates the image and
+           makes a handful of lookups, as solist does, keeping the best of 5
+           runs. "check" prints the exact and prefix lookups of every name
+           read from stdin, so that both versions can be compared. */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "elf_util.h"
+
+/* INFO: Never dereferenced, the addresses are only compared */
+#define FAKE_BASE ((void *)0x1000)
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static int time_lookups(const char *lib, const char *name1, const char *name2, const char *prefix) {
+  const char *names[] = { name1, name2, "__definitely_missing_symbol" };
+  const char *prefixes[] = { prefix, "__definitely_missing_prefix" };
+
+  double best = 1e9;
+  ElfW(Addr) found[5] = { 0 };
+  for (int run = 0; run < 5; run++) {
+    double start = now_ms();
+
+    ElfImg *img = ElfImg_create(lib, FAKE_BASE);
+    if (img == NULL) return 1;
+
+    for (int i = 0; i < 3; i++) found[i] = LinearLookup(img, names[i]);
+    for (int i = 0; i < 2; i++) found[3 + i] = LinearLookupByPrefix(img, prefixes[i]);
+
+    ElfImg_destroy(img);
+
+    double elapsed = now_ms() - start;
+    if (elapsed < best) best = elapsed;
+  }
+
+  printf("%.2f ms, found %d of 3 names and %d of 2 prefixes\n", best,
+         (found[0] != 0) + (found[1] != 0) + (found[2] != 0), (found[3] != 0) + (found[4] != 0));
+
+  return 0;
+}
+
+static int check_lookups(const char *lib) {
+  ElfImg *img = ElfImg_create(lib, FAKE_BASE);
+  if (img == NULL) return 1;
+
+  char line[4096];
+  while (fgets(line, sizeof(line), stdin)) {
+    line[strcspn(line, "\n")] = '\0';
+
+    printf("%s %lx %lx", line, (unsigned long)LinearLookup(img, line), (unsigned long)LinearLookupByPrefix(img, line));
+
+    size_t len = strlen(line);
+    if (len > 6) {
+      line[len / 2] = '\0';
+
+      printf(" %lx", (unsigned long)LinearLookupByPrefix(img, line));
+    }
+
+    printf("\n");
+  }
+
+  ElfImg_destroy(img);
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc == 6 && strcmp(argv[1], "time") == 0) return time_lookups(argv[2], argv[3], argv[4], argv[5]);
+  if (argc == 3 && strcmp(argv[1], "check") == 0) return check_lookups(argv[2]);
+
+  return 1;
+}
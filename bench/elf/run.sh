@@ -0,0 +1,53 @@
+#!/bin/sh
+# ElfImg creation and lookups on LIB, before and after indexing .symtab,
+#   and a check that 3000 of its names, and their prefixes, resolve the
+#   same. LIB must have a .symtab, by default the libpython of python3.
+
+set -e
+
+. "$(dirname "$0")/../common.sh"
+
+BASELINE=$(resolve_baseline user-025)
+
+if [ -z "$LIB" ]; then
+  LIB=$(python3 -c 'import os, sysconfig; print(os.path.join(sysconfig.get_config_var("LIBDIR") or "", sysconfig.get_config_var("LDLIBRARY") or ""))')
+fi
+
+nm --defined-only "$LIB" 2>/dev/null | awk 'NF == 3 { print $3 }' > "$work/all_names"
+if [ ! -s "$work/all_names" ]; then
+  echo "$LIB has no .symtab, set LIB to a library that has one" >&2
+
+  exit 1
+fi
+
+awk -v total="$(wc -l < "$work/all_names")" 'NR % int(total / 3000 + 1) == 0' "$work/all_names" > "$work/names"
+echo "__definitely_missing_symbol" >> "$work/names"
+
+# INFO: The last names, which the old linear scans reach last
+name1=$(tail -n 1 "$work/all_names")
+name2=$(tail -n 2 "$work/all_names" | head -n 1)
+prefix=$(printf '%s' "$name1" | cut -c 1-$(( (${#name1} + 1) / 2 )))
+
+checkout "$work/new" loader/src
+checkout "$work/old" loader/src "$BASELINE"
+
+echo "$LIB, $(wc -l < "$work/all_names") symbols"
+
+for tree in old new; do
+  src="$work/$tree/loader/src"
+
+  $CC $CFLAGS -I"$src/include" "$bench/elf/elf.c" "$src/common/elf_util.c" "$bench/log.c" -o "$work/$tree/elf"
+
+  printf '%s: ' "$tree"
+  "$work/$tree/elf" time "$LIB" "$name1" "$name2" "$prefix"
+
+  "$work/$tree/elf" check "$LIB" < "$work/names" > "$work/$tree/lookups"
+done
+
+if cmp -s "$work/old/lookups" "$work/new/lookups"; then
+  echo "Same lookups for $(wc -l < "$work/names") names and their prefixes"
+else
+  echo "Lookups differ" >&2
+
+  exit 1
+fi
@@ -0,0 +1,156 @@
+/* INFO: The fd scans zygote's fork makes in every app: recording the open
+           fds in fork_pre, then closing whatever leaked in sanitize_fds.
+           hook.cpp only builds against the NDK, so both are modeled here
+           after it, with OLD the opendir based scans, and otherwise
+           for_each_open_fd and close_range. The helpers come from misc.c
+           of the same revision. */
+#include <bitset>
+#include <vector>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "misc.h"
+
+using namespace std;
+
+#define FORKS 300
+
+static double now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return static_cast<double>(ts.tv_sec) * 1e6 + static_cast<double>(ts.tv_nsec) / 1e3;
+}
+
+/* INFO: Leaked by "third party code" between both scans */
+static void leak_fds() {
+    open("/dev/null", O_RDONLY);
+    open("/dev/null", O_RDONLY);
+}
+
+#ifdef OLD
+#define MAX_FD_SIZE 1024
+
+static bitset<MAX_FD_SIZE> allowed_fds;
+
+static void fork_pre() {
+    DIR *dir = opendir("/proc/self/fd");
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        int fd = parse_int(entry->d_name);
+        if (fd < 0 || fd >= MAX_FD_SIZE) {
+            close(fd);
+
+            continue;
+        }
+
+        allowed_fds[fd] = true;
+    }
+
+    allowed_fds[dirfd(dir)] = false;
+
+    closedir(dir);
+}
+
+static void sanitize_fds() {
+    DIR *dir = opendir("/proc/self/fd");
+    int dfd = dirfd(dir);
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        int fd = parse_int(entry->d_name);
+        if (fd < 0 || fd > MAX_FD_SIZE || fd == dfd || allowed_fds[fd]) continue;
+
+        close(fd);
+    }
+
+    closedir(dir);
+}
+#else
+static vector<bool> allowed_fds;
+
+static void fork_pre() {
+    allowed_fds.reserve(1024);
+
+    for_each_open_fd([](int fd, void *) {
+        if (static_cast<size_t>(fd) >= allowed_fds.size())
+            allowed_fds.resize(static_cast<size_t>(fd) + 1, false);
+
+        allowed_fds[static_cast<size_t>(fd)] = true;
+    }, nullptr);
+}
+
+static void sanitize_fds() {
+    size_t size = allowed_fds.size();
+    size_t first = 0;
+    for (size_t fd = 0; fd <= size; fd++) {
+        if (fd < size && !allowed_fds[fd]) continue;
+
+        long res = 0;
+        if (fd == size) res = syscall(436, static_cast<unsigned int>(first), ~0U, 0);
+        else if (fd > first) res = syscall(436, static_cast<unsigned int>(first), static_cast<unsigned int>(fd - 1), 0);
+
+        if (res == -1) {
+            fprintf(stderr, "close_range: %d\n", errno);
+
+            _exit(1);
+        }
+
+        first = fd + 1;
+    }
+}
+#endif
+
+int main(int argc, char **argv) {
+    int open_fds = argc > 1 ? atoi(argv[1]) : 300;
+
+    /* INFO: Holes, as zygote's fds are not contiguous */
+    for (int i = 0; i < open_fds * 3 / 2; i++) {
+        int fd = open("/dev/null", O_RDONLY);
+        if (i % 3 == 0) close(fd);
+    }
+
+    double total = 0, sanitize = 0;
+    for (int i = 0; i < FORKS; i++) {
+        int link[2];
+        if (pipe(link) == -1) return 1;
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            double start = now_us();
+            fork_pre();
+
+            leak_fds();
+
+            double sanitize_start = now_us();
+            sanitize_fds();
+
+            double times[2] = { now_us() - start, now_us() - sanitize_start };
+            if (write(link[1], times, sizeof(times)) != sizeof(times)) _exit(1);
+
+            _exit(0);
+        }
+
+        close(link[1]);
+
+        double times[2];
+        if (read(link[0], times, sizeof(times)) != sizeof(times)) return 1;
+        waitpid(pid, nullptr, 0);
+
+        close(link[0]);
+
+        total += times[0];
+        sanitize += times[1];
+    }
+
+    printf("%.1f us per fork for both scans, %.1f us of it to sanitize\n", total / FORKS, sanitize / FORKS);
+
+    return 0;
+}
@@ -0,0 +1,24 @@
+#!/bin/sh
+# The fd scans of every app fork, with OPEN_FDS fds open, before and after
+#   moving them to getdents64 and close_range.
+
+set -e
+
+. "$(dirname "$0")/../common.sh"
+
+BASELINE=$(resolve_baseline user-018)
+OPEN_FDS=${OPEN_FDS:-300}
+
+checkout "$work/new" loader/src
+checkout "$work/old" loader/src "$BASELINE"
+
+for tree in old new; do
+  src="$work/$tree/loader/src"
+  define=$( [ "$tree" = old ] && echo -DOLD || true )
+
+  $CC $CFLAGS -I"$src/include" -c "$src/common/misc.c" -o "$work/$tree/misc.o"
+  $CXX $CFLAGS -std=c++20 $define -I"$src/include" "$bench/fds/fds.cpp" "$work/$tree/misc.o" -o "$work/$tree/fds"
+
+  printf '%s: ' "$tree"
+  "$work/$tree/fds" "$OPEN_FDS"
+done
@@ -0,0 +1,20 @@
+#ifndef ANDROID_LOG_H
+#define ANDROID_LOG_H
+
+/* INFO: Stand-in for the NDK header, so that the sources build on the host,
+           for the benchmarks and the host tests. Logs are dropped by
+           log.c, or printed by the tests. */
+#include <stdio.h>
+
+enum {
+  ANDROID_LOG_VERBOSE = 2,
+  ANDROID_LOG_DEBUG,
+  ANDROID_LOG_INFO,
+  ANDROID_LOG_WARN,
+  ANDROID_LOG_ERROR,
+  ANDROID_LOG_FATAL
+};
+
+int __android_log_print(int prio, const char *tag, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+
+#endif /* ANDROID_LOG_H */
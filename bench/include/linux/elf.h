@@ -0,0 +1,8 @@
+#ifndef LINUX_ELF_H
+#define LINUX_ELF_H
+
+/* INFO: Bionic's elf.h and linux/elf.h can be included together, glibc's
+           cannot, and the host elf.h already has everything but this. */
+#define ELF_ST_TYPE(x) (((unsigned int)(x)) & 0xf)
+
+#endif /* LINUX_ELF_H */
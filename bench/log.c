@@ -0,0 +1,9 @@
+#include <android/log.h>
+
+int __android_log_print(int prio, const char *tag, const char *fmt, ...) {
+  (void)prio;
+  (void)tag;
+  (void)fmt;
+
+  return 0;
+}
@@ -0,0 +1,132 @@
+/* INFO: Round trips of a GetProcessFlags request, the one made for every app,
+           through the socket helpers of the loader. OLD builds against the
+           per-field helpers, otherwise against the framed messages. The
+           syscalls each side makes are counted by wrapping them at link
+           time. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "socket_utils.h"
+
+#define ROUNDS 100000
+
+static __thread unsigned long syscalls = 0;
+
+ssize_t __real_read(int fd, void *buf, size_t len);
+ssize_t __real_write(int fd, const void *buf, size_t len);
+ssize_t __real_recvmsg(int fd, struct msghdr *msg, int flags);
+ssize_t __real_sendmsg(int fd, const struct msghdr *msg, int flags);
+
+ssize_t __wrap_read(int fd, void *buf, size_t len) {
+  syscalls++;
+
+  return __real_read(fd, buf, len);
+}
+
+ssize_t __wrap_write(int fd, const void *buf, size_t len) {
+  syscalls++;
+
+  return __real_write(fd, buf, len);
+}
+
+ssize_t __wrap_recvmsg(int fd, struct msghdr *msg, int flags) {
+  syscalls++;
+
+  return __real_recvmsg(fd, msg, flags);
+}
+
+ssize_t __wrap_sendmsg(int fd, const struct msghdr *msg, int flags) {
+  syscalls++;
+
+  return __real_sendmsg(fd, msg, flags);
+}
+
+static unsigned long server_syscalls = 0;
+
+static void *serve(void *arg) {
+  int fd = *(int *)arg;
+
+  for (int i = 0; i < ROUNDS; i++) {
+#ifdef OLD
+    uint8_t action = 0;
+    uint32_t uid = 0;
+    read_uint8_t(fd, &action);
+    read_uint32_t(fd, &uid);
+    free(read_string(fd));
+
+    write_uint32_t(fd, uid);
+#else
+    struct message request;
+    if (!message_recv(fd, &request)) exit(1);
+
+    uint8_t action = 0;
+    uint32_t uid = 0;
+    message_get_uint8_t(&request, &action);
+    message_get_uint32_t(&request, &uid);
+    free(message_get_string(&request));
+    message_free(&request);
+
+    struct message response;
+    message_init(&response);
+    message_put_uint32_t(&response, uid);
+    message_send(fd, &response);
+    message_free(&response);
+#endif
+  }
+
+  server_syscalls = syscalls;
+
+  return NULL;
+}
+
+int main(void) {
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) return 1;
+
+  pthread_t server;
+  pthread_create(&server, NULL, serve, &fds[1]);
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  for (uint32_t uid = 0; uid < ROUNDS; uid++) {
+    uint32_t flags = 0;
+#ifdef OLD
+    write_uint8_t(fds[0], 7);
+    write_uint32_t(fds[0], uid);
+    write_string(fds[0], "com.example.app:remote");
+
+    read_uint32_t(fds[0], &flags);
+#else
+    struct message request;
+    message_init(&request);
+    message_put_uint8_t(&request, 7);
+    message_put_uint32_t(&request, uid);
+    message_put_string(&request, "com.example.app:remote");
+    message_send(fds[0], &request);
+    message_free(&request);
+
+    struct message response;
+    if (!message_recv(fds[0], &response)) return 1;
+
+    message_get_uint32_t(&response, &flags);
+    message_free(&response);
+#endif
+    if (flags != uid) return 1;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  pthread_join(server, NULL);
+
+  double us = (double)(end.tv_sec - start.tv_sec) * 1e6 + (double)(end.tv_nsec - start.tv_nsec) / 1e3;
+  printf("%.2f us per round trip, %.1f syscalls by the client and %.1f by the server per request\n",
+         us / ROUNDS, (double)syscalls / ROUNDS, (double)server_syscalls / ROUNDS);
+
+  return 0;
+}
@@ -0,0 +1,23 @@
+#!/bin/sh
+# Round trips of a GetProcessFlags request through the loader's socket
+#   helpers, and the syscalls they take, before and after framing.
+
+set -e
+
+. "$(dirname "$0")/../common.sh"
+
+BASELINE=$(resolve_baseline user-004)
+
+checkout "$work/new" loader/src
+checkout "$work/old" loader/src "$BASELINE"
+
+for tree in old new; do
+  src="$work/$tree/loader/src"
+  define=$( [ "$tree" = old ] && echo -DOLD || true )
+
+  $CC $CFLAGS $define -I"$src/include" "$bench/message/message.c" "$src/common/socket_utils.c" "$bench/log.c" \
+    -Wl,--wrap=read,--wrap=write,--wrap=recvmsg,--wrap=sendmsg -lpthread -o "$work/$tree/message"
+
+  printf '%s: ' "$tree"
+  "$work/$tree/message"
+done
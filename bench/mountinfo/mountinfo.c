@@ -0,0 +1,70 @@
+/* INFO: Time taken by parse_mountinfo, and a digest of what it parsed, so
+           that both versions can be checked to agree. utils.c is included,
+           as the mount structures are private to it. */
+#include "utils.c"
+
+#include <time.h>
+
+#define ROUNDS 500
+
+/* INFO: Neither is reached by the parser */
+int __system_property_get(const char *name, char *value) {
+  (void)name;
+  value[0] = '\0';
+
+  return 0;
+}
+
+__attribute__((weak)) void policy_table_set_mounts_generation(uint32_t generation) {
+  (void)generation;
+}
+
+__attribute__((weak)) void policy_table_set_mount_changes(uint32_t changes) {
+  (void)changes;
+}
+
+static unsigned long _digest_string(unsigned long digest, const char *str) {
+  for (; *str; str++) digest = digest * 31 + (unsigned char)*str;
+
+  return digest * 31;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) return 1;
+
+  struct mountinfos mounts;
+  if (!parse_mountinfo(argv[1], &mounts)) return 1;
+
+  unsigned long digest = 0;
+  for (size_t i = 0; i < mounts.length; i++) {
+    struct mountinfo *mount = &mounts.mounts[i];
+
+    digest = digest * 31 + mount->id + mount->parent * 7 + (unsigned long)mount->device * 13;
+    digest = digest * 31 + mount->optional.shared + mount->optional.master * 7 + mount->optional.propagate_from * 13;
+    digest = _digest_string(digest, mount->root);
+    digest = _digest_string(digest, mount->target);
+    digest = _digest_string(digest, mount->vfs_option);
+    digest = _digest_string(digest, mount->type);
+    digest = _digest_string(digest, mount->source);
+    digest = _digest_string(digest, mount->fs_option);
+  }
+
+  size_t length = mounts.length;
+  free_mounts(&mounts);
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  for (int i = 0; i < ROUNDS; i++) {
+    if (!parse_mountinfo(argv[1], &mounts)) return 1;
+
+    free_mounts(&mounts);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  double us = (double)(end.tv_sec - start.tv_sec) * 1e6 + (double)(end.tv_nsec - start.tv_nsec) / 1e3;
+  printf("%.1f us per parse of %zu mounts, digest %016lx\n", us / ROUNDS, length, digest);
+
+  return 0;
+}
@@ -0,0 +1,39 @@
+#!/bin/sh
+# parse_mountinfo on the mountinfo of the host and on a synthetic one with
+#   2000 mounts, before and after parsing it in place.
+
+set -e
+
+. "$(dirname "$0")/../common.sh"
+
+BASELINE=$(resolve_baseline user-014)
+
+# INFO: parse_mountinfo reads /proc/<pid>/mountinfo, so the synthetic file
+#   is reached through /proc/..
+mkdir -p "$work/synthetic"
+python3 - "$work/synthetic/mountinfo" <<'PY'
+import sys
+
+with open(sys.argv[1], "w") as out:
+    for i in range(2000):
+        optional = f"shared:{i} master:{i // 2}" if i % 3 == 0 else (f"master:{i}" if i % 3 == 1 else "")
+        out.write(f"{100 + i} {99 + i} 253:{i % 16} /data/adb/modules/module{i // 20}/system/lib{i} "
+                  f"/system/lib{i} ro,relatime {optional} - ext4 /dev/block/dm-{i % 8} "
+                  f"ro,seclabel,errors=remount-ro\n".replace("  ", " "))
+PY
+
+checkout "$work/new" zygiskd/src
+checkout "$work/old" zygiskd/src "$BASELINE"
+
+for tree in old new; do
+  src="$work/$tree/zygiskd/src"
+
+  $CC $CFLAGS -I"$src" "$bench/mountinfo/mountinfo.c" "$bench/log.c" -lpthread -o "$work/$tree/mountinfo"
+done
+
+for file in self "../$work/synthetic"; do
+  for tree in old new; do
+    printf '%s, %s: ' "$tree" "$( [ "$file" = self ] && echo host || echo synthetic )"
+    "$work/$tree/mountinfo" "$file"
+  done
+done
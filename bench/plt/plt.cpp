@@ -0,0 +1,234 @@
+/* INFO: plt_hook_process_regex() for three modules, each registering 12
+           regex hooks and 3 exclusions, against a maps file. hook.cpp only
+           builds against the NDK, so both versions are modeled here after
+           it: OLD compiles and runs every regex per module, on every
+           mapping, otherwise patterns are shared and cache their matches
+           per path, and objects are visited once. Both must register the
+           same hooks. */
+#include <map>
+#include <set>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include <regex.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+
+using namespace std;
+
+#define ROUNDS 200
+
+struct MapEntry {
+    dev_t dev;
+    ino_t inode;
+    unsigned long offset;
+    bool is_private;
+    int perms;
+    string path;
+};
+
+struct Hook {
+    string regex;
+    string symbol;
+};
+
+static vector<MapEntry> maps;
+static vector<vector<Hook>> registers;
+static vector<vector<Hook>> excludes;
+static set<tuple<dev_t, ino_t, string>> registered;
+
+static void register_hook(const MapEntry &map, const string &symbol) {
+    registered.emplace(map.dev, map.inode, symbol);
+}
+
+static bool skip(const MapEntry &map) {
+    return map.offset != 0 || !map.is_private || !(map.perms & PROT_READ);
+}
+
+#ifdef OLD
+static void reset() {}
+
+static void process_module(size_t module) {
+    struct Compiled {
+        regex_t regex;
+        string symbol;
+    };
+
+    vector<Compiled> reg, ign;
+    for (auto &hook : registers[module]) {
+        reg.push_back({ {}, hook.symbol });
+        regcomp(&reg.back().regex, hook.regex.c_str(), REG_NOSUB);
+    }
+    for (auto &hook : excludes[module]) {
+        ign.push_back({ {}, hook.symbol });
+        regcomp(&ign.back().regex, hook.regex.c_str(), REG_NOSUB);
+    }
+
+    for (auto &map : maps) {
+        if (skip(map)) continue;
+
+        for (auto &r : reg) {
+            if (regexec(&r.regex, map.path.c_str(), 0, nullptr, 0) != 0) continue;
+
+            bool ignored = false;
+            for (auto &i : ign) {
+                if (regexec(&i.regex, map.path.c_str(), 0, nullptr, 0) != 0) continue;
+                if (i.symbol.empty() || i.symbol == r.symbol) {
+                    ignored = true;
+                    break;
+                }
+            }
+            if (!ignored) register_hook(map, r.symbol);
+        }
+    }
+
+    /* INFO: The old code never freed them, which is not modeled */
+    for (auto &r : reg) regfree(&r.regex);
+    for (auto &i : ign) regfree(&i.regex);
+}
+#else
+struct PathHash {
+    using is_transparent = void;
+
+    size_t operator()(string_view path) const { return hash<string_view>{}(path); }
+};
+
+struct PltPattern {
+    regex_t regex;
+    unordered_map<string, bool, PathHash, equal_to<>> matches;
+};
+
+/* INFO: Kept for the whole process, as in ZygiskContext */
+static map<string, PltPattern> plt_patterns;
+
+/* INFO: Each app is a new process, so nothing is kept between rounds */
+static void reset() {
+    for (auto &[regex, pattern] : plt_patterns)
+        regfree(&pattern.regex);
+
+    plt_patterns.clear();
+}
+
+static PltPattern *plt_hook_pattern(const string &regex) {
+    auto it = plt_patterns.find(regex);
+    if (it != plt_patterns.end())
+        return &it->second;
+
+    regex_t re;
+    if (regcomp(&re, regex.c_str(), REG_NOSUB) != 0)
+        return nullptr;
+
+    return &plt_patterns.emplace(regex, PltPattern{re, {}}).first->second;
+}
+
+static bool plt_pattern_matches(PltPattern *pattern, const char *path) {
+    auto it = pattern->matches.find(string_view(path));
+    if (it != pattern->matches.end())
+        return it->second;
+
+    bool matched = regexec(&pattern->regex, path, 0, nullptr, 0) == 0;
+    pattern->matches.emplace(path, matched);
+
+    return matched;
+}
+
+static void process_module(size_t module) {
+    struct Info {
+        PltPattern *pattern;
+        string symbol;
+    };
+
+    vector<Info> reg, ign;
+    for (auto &hook : registers[module]) reg.push_back({ plt_hook_pattern(hook.regex), hook.symbol });
+    for (auto &hook : excludes[module]) ign.push_back({ plt_hook_pattern(hook.regex), hook.symbol });
+
+    set<pair<dev_t, ino_t>> objects;
+    for (auto &map : maps) {
+        if (skip(map)) continue;
+        if (map.inode != 0 && !objects.emplace(map.dev, map.inode).second) continue;
+
+        for (auto &r : reg) {
+            if (!plt_pattern_matches(r.pattern, map.path.c_str())) continue;
+
+            bool ignored = false;
+            for (auto &i : ign) {
+                if (!i.symbol.empty() && i.symbol != r.symbol) continue;
+                if (plt_pattern_matches(i.pattern, map.path.c_str())) {
+                    ignored = true;
+                    break;
+                }
+            }
+            if (!ignored) register_hook(map, r.symbol);
+        }
+    }
+}
+#endif
+
+static bool load_maps(const char *file) {
+    FILE *fp = fopen(file, "r");
+    if (fp == nullptr) return false;
+
+    char line[4096];
+    while (fgets(line, sizeof(line), fp)) {
+        unsigned long start, end, offset, inode;
+        unsigned int major, minor;
+        char perms[8];
+        int path_off = 0;
+        if (sscanf(line, "%lx-%lx %7s %lx %x:%x %lu %n", &start, &end, perms, &offset, &major, &minor, &inode, &path_off) < 7) continue;
+
+        string path = line + path_off;
+        while (!path.empty() && (path.back() == '\n' || path.back() == ' ')) path.pop_back();
+
+        maps.push_back({ makedev(major, minor), static_cast<ino_t>(inode), offset, perms[3] == 'p', perms[0] == 'r' ? PROT_READ : 0, path });
+    }
+
+    fclose(fp);
+
+    return true;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2 || !load_maps(argv[1])) return 1;
+
+    const char *symbols[] = {
+        "open", "openat", "read", "stat", "fopen", "__system_property_get",
+        "dlopen", "android_dlopen_ext", "readlink", "access", "fstat", "lstat"
+    };
+
+    for (int module = 0; module < 3; module++) {
+        vector<Hook> reg;
+        for (int i = 0; i < 12; i++)
+            reg.push_back({ i % 2 ? ".*\\.so$" : ".*/lib(c|ssl|crypto|python[0-9.]*)\\.so.*", symbols[i] });
+
+        registers.push_back(reg);
+        excludes.push_back({ { ".*libz.*\\.so.*", "" }, { ".*ld-linux.*", "" }, { ".*/_ssl.*", symbols[0] } });
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int round = 0; round < ROUNDS; round++) {
+        registered.clear();
+        reset();
+
+        for (size_t module = 0; module < registers.size(); module++)
+            process_module(module);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    unsigned long digest = 0;
+    for (auto &[dev, inode, symbol] : registered)
+        digest = digest * 31 + dev * 7 + inode * 13 + hash<string>{}(symbol);
+
+    double us = static_cast<double>(end.tv_sec - start.tv_sec) * 1e6 + static_cast<double>(end.tv_nsec - start.tv_nsec) / 1e3;
+    printf("%.1f us per specialization, %zu maps, %zu hooks, digest %016lx\n", us / ROUNDS, maps.size(), registered.size(), digest);
+
+    return 0;
+}
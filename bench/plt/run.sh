@@ -0,0 +1,32 @@
+#!/bin/sh
+# Matching pltHookRegister regexes against the maps of a process, before
+#   and after patterns were shared and cached. MAPS selects a maps file,
+#   such as one captured from an app, by default python3 is made to load
+#   a few dozen libraries and its maps are used.
+
+set -e
+
+. "$(dirname "$0")/../common.sh"
+
+if [ -z "$MAPS" ]; then
+  MAPS="$work/maps"
+
+  python3 -c '
+import sys
+for module in ("ssl", "sqlite3", "ctypes", "decimal", "json", "hashlib", "lzma", "bz2", "zlib", "curses", "readline", "uuid", "multiprocessing", "xml.parsers.expat"):
+    try:
+        __import__(module)
+    except ImportError:
+        pass
+sys.stdout.write(open("/proc/self/maps").read())
+' > "$MAPS"
+fi
+
+for tree in old new; do
+  define=$( [ "$tree" = old ] && echo -DOLD || true )
+
+  $CXX $CFLAGS -std=c++20 $define "$bench/plt/plt.cpp" -o "$work/plt-$tree"
+
+  printf '%s: ' "$tree"
+  "$work/plt-$tree" "$MAPS"
+done
@@ -0,0 +1,91 @@
+/* INFO: Fork to specialize latency of a module loaded in every fork, as
+           load_modules_only() does, against one preloaded in zygote. The
+           loader itself only builds against bionic, so this models it: the
+           parent stands for zygote, and each child loads the module from
+           its fd, unless preloaded, and calls its entry, as onLoad. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define FORKS 200
+
+static double now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec / 1e3;
+}
+
+static void (*load(int fd))(void) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+
+  void *handle = dlopen(path, RTLD_NOW);
+  if (handle == NULL) {
+    fprintf(stderr, "dlopen: %s\n", dlerror());
+
+    exit(1);
+  }
+
+  void (*entry)(void) = (void (*)(void))dlsym(handle, "zygisk_module_entry");
+  if (entry == NULL) {
+    fprintf(stderr, "dlsym: %s\n", dlerror());
+
+    exit(1);
+  }
+
+  return entry;
+}
+
+static double run(int fd, int preload) {
+  void (*entry)(void) = preload ? load(fd) : NULL;
+
+  double total = 0;
+  for (int i = 0; i < FORKS; i++) {
+    int link[2];
+    if (pipe(link) == -1) exit(1);
+
+    double start = now_us();
+
+    pid_t pid = fork();
+    if (pid == 0) {
+      void (*child_entry)(void) = preload ? entry : load(fd);
+      child_entry();
+
+      double elapsed = now_us() - start;
+      if (write(link[1], &elapsed, sizeof(elapsed)) != sizeof(elapsed)) _exit(1);
+
+      _exit(0);
+    }
+
+    close(link[1]);
+
+    double elapsed = 0;
+    if (read(link[0], &elapsed, sizeof(elapsed)) != sizeof(elapsed)) exit(1);
+    waitpid(pid, NULL, 0);
+
+    close(link[0]);
+
+    total += elapsed;
+  }
+
+  return total / FORKS;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) return 1;
+
+  int fd = open(argv[1], O_RDONLY);
+  if (fd == -1) return 1;
+
+  double per_fork = run(fd, 0);
+  double preloaded = run(fd, 1);
+
+  printf("per fork: %.1f us, preloaded: %.1f us, from fork to the module entry\n", per_fork, preloaded);
+
+  return 0;
+}
@@ -0,0 +1,31 @@
+#!/bin/sh
+# Fork to module entry latency, with the module loaded in every fork and
+#   preloaded once in the parent. MODULE selects the library, by default a
+#   generated one with as many relocations as a mid-sized module.
+
+set -e
+
+. "$(dirname "$0")/../common.sh"
+
+if [ -z "$MODULE" ]; then
+  MODULE="$work/libmodule.so"
+
+  python3 - "$work/module.cpp" <<'PY'
+import sys
+
+with open(sys.argv[1], "w") as out:
+    out.write("#include <string>\n#include <vector>\n")
+    for i in range(2000):
+        out.write(f"int f{i}(int x) {{ return x * {i + 1}; }}\n")
+    out.write("int (*table[])(int) = {" + ", ".join(f"f{i}" for i in range(2000)) + "};\n")
+    out.write("static std::vector<std::string> names;\n")
+    out.write("__attribute__((constructor)) static void init() { for (int i = 0; i < 64; i++) names.push_back(std::to_string(table[i](i))); }\n")
+    out.write('extern "C" void zygisk_module_entry() {}\n')
+PY
+
+  $CXX -O2 -shared -fPIC "$work/module.cpp" -o "$MODULE"
+fi
+
+# INFO: The C++ runtime is linked in, as zygote already has it loaded
+$CC $CFLAGS "$bench/preload/preload.c" -Wl,--no-as-needed -lstdc++ -ldl -o "$work/preload"
+"$work/preload" "$MODULE"
@@ -0,0 +1,21 @@
+#!/bin/sh
+# Latency of exec_command, spawning with fork before the change and vfork
+#   after it, with the daemon holding RSS_MB of memory.
+
+set -e
+
+. "$(dirname "$0")/../common.sh"
+
+BASELINE=$(resolve_baseline user-013)
+RSS_MB=${RSS_MB:-256}
+
+checkout "$work/new" zygiskd/src
+checkout "$work/old" zygiskd/src "$BASELINE"
+
+$CC $CFLAGS -I"$work/old/zygiskd/src" "$bench/spawn/spawn.c" "$work/old/zygiskd/src/utils.c" "$bench/log.c" -lpthread -o "$work/old/spawn"
+$CC $CFLAGS -I"$work/new/zygiskd/src" "$bench/spawn/spawn.c" "$work/new/zygiskd/src/spawn.c" "$bench/log.c" -lpthread -o "$work/new/spawn"
+
+for tree in old new; do
+  printf '%s: ' "$tree"
+  "$work/$tree/spawn" "$RSS_MB"
+done
@@ -0,0 +1,52 @@
+/* INFO: Latency of exec_command, which every version check and policy query
+           of the daemon goes through, with the daemon grown to RSS_MB of
+           touched memory, as forking copies its page tables. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#define COMMANDS 200
+
+bool exec_command(char *restrict buf, size_t len, const char *restrict file, char *const argv[]);
+
+/* INFO: Only used by the property helpers, which are not called here */
+int __system_property_get(const char *name, char *value) {
+  (void)name;
+  value[0] = '\0';
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  size_t rss = (size_t)atoi(argc > 1 ? argv[1] : "256") * 1024 * 1024;
+
+  char *memory = malloc(rss);
+  if (memory == NULL) return 1;
+
+  memset(memory, 1, rss);
+
+  char *const command[] = { "echo", "27000", NULL };
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  for (int i = 0; i < COMMANDS; i++) {
+    char output[32];
+    if (!exec_command(output, sizeof(output), "/bin/echo", command) || strcmp(output, "27000") != 0) {
+      fprintf(stderr, "Unexpected output\n");
+
+      return 1;
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  double us = (double)(end.tv_sec - start.tv_sec) * 1e6 + (double)(end.tv_nsec - start.tv_nsec) / 1e3;
+  printf("%.1f us per command with %zu MiB resident\n", us / COMMANDS, rss / 1024 / 1024);
+
+  free(memory);
+
+  return 0;
+}
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <sys/socket.h>
+#include <sys/mman.h>
 
 #include <linux/un.h>
 
@@ -49,6 +50,20 @@ int rezygiskd_connect(uint8_t retry) {
   return -1;
 }
 
+/* INFO: Sends the whole request at once, and then receives the response,
+           if any is expected. The request is freed in both cases. */
+static bool _rezygiskd_request(int fd, struct message *request, struct message *response) {
+  if (response != NULL) message_init(response);
+
+  bool sent = message_send(fd, request);
+  message_free(request);
+
+  if (!sent) return false;
+  if (response == NULL) return true;
+
+  return message_recv(fd, response);
+}
+
 bool rezygiskd_ping() {
   int fd = rezygiskd_connect(5);
   if (fd == -1) {
@@ -57,11 +72,15 @@ bool rezygiskd_ping() {
     return false;
   }
 
-  write_uint8_t(fd, (uint8_t)PingHeartbeat);
+  struct message request;
+  message_init(&request);
+  message_put_uint8_t(&request, (uint8_t)PingHeartbeat);
+
+  bool res = _rezygiskd_request(fd, &request, NULL);
 
   close(fd);
 
-  return true;
+  return res;
 }
 
 uint32_t rezygiskd_get_process_flags(uid_t uid, const char *const process) {
@@ -72,12 +91,19 @@ uint32_t rezygiskd_get_process_flags(uid_t uid, const char *const process) {
     return 0;
   }
 
-  write_uint8_t(fd, (uint8_t)GetProcessFlags);
-  write_uint32_t(fd, (uint32_t)uid);
-  write_string(fd, process);
+  struct message request;
+  message_init(&request);
+  message_put_uint8_t(&request, (uint8_t)GetProcessFlags);
+  message_put_uint32_t(&request, (uint32_t)uid);
+  message_put_string(&request, process);
 
   uint32_t res = 0;
-  read_uint32_t(fd, &res);
+
+  struct message response;
+  if (_rezygiskd_request(fd, &request, &response))
+    message_get_uint32_t(&response, &res);
+
+  message_free(&response);
 
   close(fd);
 
@@ -96,23 +122,43 @@ void rezygiskd_get_info(struct rezygisk_info *info) {
 
   info->running = true;
 
-  write_uint8_t(fd, (uint8_t)GetInfo);
+  struct message request;
+  message_init(&request);
+  message_put_uint8_t(&request, (uint8_t)GetInfo);
+
+  struct message response;
+  if (!_rezygiskd_request(fd, &request, &response)) {
+    PLOGE("Failed to get info from ReZygiskd");
+
+    message_free(&response);
+
+    info->running = false;
+    info->modules->modules_count = 0;
+    info->modules->modules = NULL;
+
+    close(fd);
+
+    return;
+  }
+
+  close(fd);
 
   uint32_t flags = 0;
-  read_uint32_t(fd, &flags);
+  message_get_uint32_t(&response, &flags);
 
   if (flags & (1 << 27)) info->root_impl = ROOT_IMPL_APATCH;
   else if (flags & (1 << 29)) info->root_impl = ROOT_IMPL_KERNELSU;
   else if (flags & (1 << 30)) info->root_impl = ROOT_IMPL_MAGISK;
   else info->root_impl = ROOT_IMPL_NONE;
 
-  read_uint32_t(fd, (uint32_t *)&info->pid);
+  message_get_uint32_t(&response, (uint32_t *)&info->pid);
 
-  read_size_t(fd, &info->modules->modules_count);
+  info->modules->modules_count = 0;
+  message_get_size_t(&response, &info->modules->modules_count);
   if (info->modules->modules_count == 0) {
     info->modules->modules = NULL;
 
-    close(fd);
+    message_free(&response);
 
     return;
   }
@@ -125,13 +171,13 @@ void rezygiskd_get_info(struct rezygisk_info *info) {
     info->modules = NULL;
     info->modules->modules_count = 0;
 
-    close(fd);
+    message_free(&response);
 
     return;
   }
 
   for (size_t i = 0; i < info->modules->modules_count; i++) {
-    char *module_name = read_string(fd);
+    char *module_name = message_get_string(&response);
     if (module_name == NULL) {
       PLOGE("reading module name");
 
@@ -142,7 +188,7 @@ void rezygiskd_get_info(struct rezygisk_info *info) {
       info->modules = NULL;
       info->modules->modules_count = 0;
 
-      close(fd);
+      message_free(&response);
 
       return;
     }
@@ -163,7 +209,7 @@ void rezygiskd_get_info(struct rezygisk_info *info) {
       info->modules = NULL;
       info->modules->modules_count = 0;
 
-      close(fd);
+      message_free(&response);
 
       return;
     }
@@ -180,7 +226,7 @@ void rezygiskd_get_info(struct rezygisk_info *info) {
     fclose(module_prop);
   }
 
-  close(fd);
+  message_free(&response);
 }
 
 void free_rezygisk_info(struct rezygisk_info *info) {
@@ -195,45 +241,84 @@ void free_rezygisk_info(struct rezygisk_info *info) {
   free(info->modules);
 }
 
-bool rezygiskd_read_modules(struct zygisk_modules *modules) {
-  int fd = rezygiskd_connect(1);
-  if (fd == -1) {
-    PLOGE("connection to ReZygiskd");
+static bool _read_modules(struct message *response, struct zygisk_modules *modules) {
+  size_t len = 0;
+  if (!message_get_size_t(response, &len)) {
+    PLOGE("reading modules count");
 
     return false;
   }
 
-  write_uint8_t(fd, (uint8_t)ReadModules);
+  modules->modules_count = 0;
+  modules->modules = NULL;
+  modules->lib_fds = NULL;
+  modules->preload = NULL;
 
-  size_t len = 0;
-  read_size_t(fd, &len);
+  if (len == 0) return true;
+
+  if (response->fds_len - response->fds_pos < len) {
+    LOGE("Missing module library fds: %zu < %zu", response->fds_len - response->fds_pos, len);
+
+    return false;
+  }
 
   modules->modules = malloc(len * sizeof(char *));
-  if (!modules->modules) {
+  modules->lib_fds = malloc(len * sizeof(int));
+  modules->preload = malloc(len * sizeof(bool));
+  if (!modules->modules || !modules->lib_fds || !modules->preload) {
     PLOGE("allocating modules name memory");
 
-    close(fd);
+    free(modules->modules);
+    free(modules->lib_fds);
+    free(modules->preload);
+    modules->modules = NULL;
+    modules->lib_fds = NULL;
+    modules->preload = NULL;
 
     return false;
   }
-  modules->modules_count = len;
 
   for (size_t i = 0; i < len; i++) {
-    char *lib_path = read_string(fd);
-    if (!lib_path) {
+    char *lib_path = message_get_string(response);
+    uint8_t preload = 0;
+    if (!lib_path || !message_get_uint8_t(response, &preload)) {
       PLOGE("reading module lib_path");
 
-      close(fd);
+      free(lib_path);
+      free_modules(modules);
 
       return false;
     }
 
     modules->modules[i] = lib_path;
+    modules->preload[i] = preload != 0;
+    modules->lib_fds[i] = message_take_fd(response);
+    modules->modules_count++;
+  }
+
+  return true;
+}
+
+bool rezygiskd_read_modules(struct zygisk_modules *modules) {
+  int fd = rezygiskd_connect(1);
+  if (fd == -1) {
+    PLOGE("connection to ReZygiskd");
+
+    return false;
   }
 
+  struct message request;
+  message_init(&request);
+  message_put_uint8_t(&request, (uint8_t)ReadModules);
+
+  struct message response;
+  bool res = _rezygiskd_request(fd, &request, &response) && _read_modules(&response, modules);
+
+  message_free(&response);
+
   close(fd);
 
-  return true;
+  return res;
 }
 
 void free_modules(struct zygisk_modules *modules) {
@@ -244,6 +329,16 @@ void free_modules(struct zygisk_modules *modules) {
 
     free(modules->modules);
   }
+
+  if (modules->lib_fds) {
+    for (size_t i = 0; i < modules->modules_count; i++) {
+      close(modules->lib_fds[i]);
+    }
+
+    free(modules->lib_fds);
+  }
+
+  free(modules->preload);
 }
 
 int rezygiskd_connect_companion(size_t index) {
@@ -254,11 +349,20 @@ int rezygiskd_connect_companion(size_t index) {
     return -1;
   }
 
-  write_uint8_t(fd, (uint8_t)RequestCompanionSocket);
-  write_size_t(fd, index);
+  struct message request;
+  message_init(&request);
+  message_put_uint8_t(&request, (uint8_t)RequestCompanionSocket);
+  message_put_size_t(&request, index);
 
+  /* INFO: The response is read exactly, as the socket is handed to the
+             module right after. */
   uint8_t res = 0;
-  read_uint8_t(fd, &res);
+
+  struct message response;
+  if (_rezygiskd_request(fd, &request, &response))
+    message_get_uint8_t(&response, &res);
+
+  message_free(&response);
 
   if (res == 1) return fd;
   else {
@@ -276,10 +380,18 @@ int rezygiskd_get_module_dir(size_t index) {
     return -1;
   }
 
-  write_uint8_t(fd, (uint8_t)GetModuleDir);
-  write_size_t(fd, index);
+  struct message request;
+  message_init(&request);
+  message_put_uint8_t(&request, (uint8_t)GetModuleDir);
+  message_put_size_t(&request, index);
+
+  int dirfd = -1;
 
-  int dirfd = read_fd(fd);
+  struct message response;
+  if (_rezygiskd_request(fd, &request, &response))
+    dirfd = message_take_fd(&response);
+
+  message_free(&response);
 
   close(fd);
 
@@ -295,7 +407,11 @@ void rezygiskd_zygote_restart() {
     return;
   }
 
-  if (!write_uint8_t(fd, (uint8_t)ZygoteRestart))
+  struct message request;
+  message_init(&request);
+  message_put_uint8_t(&request, (uint8_t)ZygoteRestart);
+
+  if (!_rezygiskd_request(fd, &request, NULL))
     PLOGE("Failed to request ZygoteRestart");
 
   close(fd);
@@ -309,53 +425,250 @@ void rezygiskd_system_server_started() {
     return;
   }
 
-  if (!write_uint8_t(fd, (uint8_t)SystemServerStarted))
+  struct message request;
+  message_init(&request);
+  message_put_uint8_t(&request, (uint8_t)SystemServerStarted);
+
+  if (!_rezygiskd_request(fd, &request, NULL))
     PLOGE("Failed to request SystemServerStarted");
 
   close(fd);
 }
 
-bool rezygiskd_update_mns(enum mount_namespace_state nms_state, char *buf, size_t buf_size) {
+int rezygiskd_update_mns(enum mount_namespace_state nms_state) {
   int fd = rezygiskd_connect(1);
   if (fd == -1) {
     PLOGE("connection to ReZygiskd");
 
-    return false;
+    return -1;
   }
 
-  write_uint8_t(fd, (uint8_t)UpdateMountNamespace);
-  write_uint32_t(fd, (uint32_t)getpid());
-  write_uint8_t(fd, (uint8_t)nms_state);
+  struct message request;
+  message_init(&request);
+  message_put_uint8_t(&request, (uint8_t)UpdateMountNamespace);
+  message_put_uint32_t(&request, (uint32_t)getpid());
+  message_put_uint8_t(&request, (uint8_t)nms_state);
+
+  struct message response;
+  if (!_rezygiskd_request(fd, &request, &response)) {
+    PLOGE("Failed to update mount namespace");
 
-  uint32_t target_pid = 0;
-  if (read_uint32_t(fd, &target_pid) < 0) {
-    PLOGE("Failed to read target pid");
+    message_free(&response);
 
     close(fd);
 
+    return -1;
+  }
+
+  close(fd);
+
+  /* INFO: The namespace fd goes along with an empty message */
+  int ns_fd = message_take_fd(&response);
+  message_free(&response);
+
+  return ns_fd;
+}
+
+bool rezygiskd_get_specialize_bundle(uid_t uid, const char *const process, bool system_server, struct specialize_bundle *bundle) {
+  int fd = rezygiskd_connect(1);
+  if (fd == -1) {
+    PLOGE("connection to ReZygiskd");
+
     return false;
   }
 
-  uint32_t target_fd = 0;
-  if (read_uint32_t(fd, &target_fd) < 0) {
-    PLOGE("Failed to read target fd");
+  struct message request;
+  message_init(&request);
+  message_put_uint8_t(&request, (uint8_t)GetSpecializeBundle);
+  message_put_uint32_t(&request, (uint32_t)uid);
+  message_put_string(&request, process);
+  message_put_uint32_t(&request, (uint32_t)getpid());
+  message_put_uint8_t(&request, (uint8_t)system_server);
+
+  struct message response;
+  if (!_rezygiskd_request(fd, &request, &response)) {
+    PLOGE("Failed to get specialize bundle");
+
+    message_free(&response);
 
     close(fd);
 
     return false;
   }
 
-  if (target_fd == 0) {
-    LOGE("Failed to get target fd");
+  close(fd);
 
-    close(fd);
+  bundle->flags = 0;
+  bundle->mns_fd = -1;
+
+  if (!message_get_uint32_t(&response, &bundle->flags)) {
+    LOGE("Failed to read process flags");
+
+    message_free(&response);
 
     return false;
   }
 
-  snprintf(buf, buf_size, "/proc/%u/fd/%u", target_pid, target_fd);
+  if (!_read_modules(&response, &bundle->modules)) {
+    message_free(&response);
+
+    return false;
+  }
+
+  /* INFO: The namespace fd, if any, comes after the fds of the modules */
+  uint8_t has_mns_fd = 0;
+  if (!message_get_uint8_t(&response, &has_mns_fd)) {
+    LOGE("Failed to read mount namespace");
+
+    message_free(&response);
+
+    free_modules(&bundle->modules);
+
+    return false;
+  }
+
+  if (has_mns_fd) bundle->mns_fd = message_take_fd(&response);
+
+  message_free(&response);
+
+  return true;
+}
+
+void free_specialize_bundle(struct specialize_bundle *bundle) {
+  free_modules(&bundle->modules);
+
+  if (bundle->mns_fd != -1) {
+    close(bundle->mns_fd);
+
+    bundle->mns_fd = -1;
+  }
+}
+
+const struct policy_table *rezygiskd_map_policy_table() {
+  int fd = rezygiskd_connect(1);
+  if (fd == -1) {
+    PLOGE("connection to ReZygiskd");
+
+    return NULL;
+  }
+
+  struct message request;
+  message_init(&request);
+  message_put_uint8_t(&request, (uint8_t)GetPolicyTable);
+
+  int table_fd = -1;
+
+  struct message response;
+  if (_rezygiskd_request(fd, &request, &response))
+    table_fd = message_take_fd(&response);
+
+  message_free(&response);
 
   close(fd);
 
+  if (table_fd == -1) {
+    LOGD("ReZygiskd does not share its policy table");
+
+    return NULL;
+  }
+
+  void *table = mmap(NULL, sizeof(struct policy_table), PROT_READ, MAP_SHARED, table_fd, 0);
+  close(table_fd);
+
+  if (table == MAP_FAILED) {
+    PLOGE("map policy table");
+
+    return NULL;
+  }
+
+  return (const struct policy_table *)table;
+}
+
+/* INFO: FNV-1a, the same as ReZygiskd uses to fill the table */
+static uint64_t _hash_process(const char *process) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (const char *ptr = process; *ptr != '\0'; ptr++) {
+    hash ^= (uint8_t)*ptr;
+    hash *= 1099511628211ULL;
+  }
+
+  return hash;
+}
+
+/* INFO: Reads the flags ReZygiskd already computed for this process, if any.
+           As ReZygiskd may write the table at the same time, it is only
+           trusted when the sequence number did not change while reading. */
+bool policy_table_lookup(const struct policy_table *table, uid_t uid, const char *const process, uint32_t *flags) {
+  uint64_t process_hash = _hash_process(process);
+  size_t slot = (size_t)(process_hash ^ ((uint32_t)uid * 2654435769U)) & (POLICY_TABLE_SIZE - 1);
+
+  uint32_t seq = __atomic_load_n(&table->seq, __ATOMIC_ACQUIRE);
+  if (seq & 1) return false;
+
+  bool found = false;
+  uint32_t entry_flags = 0;
+
+  for (size_t i = 0; i < POLICY_TABLE_SIZE; i++) {
+    const struct policy_entry *entry = &table->entries[(slot + i) & (POLICY_TABLE_SIZE - 1)];
+    if (!__atomic_load_n(&entry->used, __ATOMIC_RELAXED)) break;
+
+    if (__atomic_load_n(&entry->uid, __ATOMIC_RELAXED) != (uint32_t)uid) continue;
+    if (__atomic_load_n(&entry->process_hash, __ATOMIC_RELAXED) != process_hash) continue;
+
+    entry_flags = __atomic_load_n(&entry->flags, __ATOMIC_RELAXED);
+    found = true;
+
+    break;
+  }
+
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  if (__atomic_load_n(&table->seq, __ATOMIC_RELAXED) != seq) return false;
+
+  if (!found) return false;
+
+  *flags = entry_flags | table->impl_flags;
+
   return true;
 }
+
+bool rezygiskd_get_linker_cache(void *cache, size_t len) {
+  int fd = rezygiskd_connect(1);
+  if (fd == -1) {
+    PLOGE("connection to ReZygiskd");
+
+    return false;
+  }
+
+  struct message request;
+  message_init(&request);
+  message_put_uint8_t(&request, (uint8_t)GetLinkerCache);
+
+  /* INFO: The response is empty when there is no cache */
+  struct message response;
+  bool res = _rezygiskd_request(fd, &request, &response) && response.len == len && message_get(&response, cache, len);
+
+  message_free(&response);
+
+  close(fd);
+
+  return res;
+}
+
+void rezygiskd_put_linker_cache(const void *cache, size_t len) {
+  int fd = rezygiskd_connect(1);
+  if (fd == -1) {
+    PLOGE("connection to ReZygiskd");
+
+    return;
+  }
+
+  struct message request;
+  message_init(&request);
+  message_put_uint8_t(&request, (uint8_t)PutLinkerCache);
+  message_put(&request, cache, len);
+
+  if (!_rezygiskd_request(fd, &request, NULL))
+    PLOGE("Failed to request PutLinkerCache");
+
+  close(fd);
+}
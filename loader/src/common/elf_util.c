@@ -86,47 +86,19 @@ bool _find_module_base(ElfImg *img) {
   return img->base != NULL;
 }
 
-size_t calculate_valid_symtabs_amount(ElfImg *img) {
-  size_t count = 0;
-
-  if (img->symtab_start == NULL || img->symstr_offset_for_symtab == 0) {
-    LOGE("Invalid symtab_start or symstr_offset_for_symtab, cannot count valid symbols");
-
-    return 0;
-  }
-
-  char *symtab_strings = offsetOf_char(img->header, img->symstr_offset_for_symtab);
-
-  for (ElfW(Off) i = 0; i < img->symtab_count; i++) {
-    const char *sym_name = symtab_strings + img->symtab_start[i].st_name;
-    if (!sym_name)
-      continue;
-
-    unsigned int st_type = ELF_ST_TYPE(img->symtab_start[i].st_info);
-
-    if ((st_type == STT_FUNC || st_type == STT_OBJECT) && img->symtab_start[i].st_size > 0 && img->symtab_start[i].st_name != 0)
-      count++;
-  }
-
-  return count;
-}
-
-
 void ElfImg_destroy(ElfImg *img) {
   if (!img) return;
 
   if (img->symtabs_) {
-    size_t valid_symtabs_amount = calculate_valid_symtabs_amount(img);
-    if (valid_symtabs_amount > 0) {
-      for (size_t i = 0; i < valid_symtabs_amount; i++) {
-        free(img->symtabs_[i].name);
-      }
-    }
-
     free(img->symtabs_);
     img->symtabs_ = NULL;
   }
 
+  if (img->symtabs_hash_) {
+    free(img->symtabs_hash_);
+    img->symtabs_hash_ = NULL;
+  }
+
   if (img->elf) {
     free(img->elf);
     img->elf = NULL;
@@ -457,6 +429,25 @@ ElfImg *ElfImg_create(const char *elf, void *base) {
   return img;
 }
 
+/* INFO: The slot holding that name, or the empty one where it would go */
+static struct symtabs_slot *_find_symtabs_slot(ElfImg *img, const char *name, uint32_t hash) {
+  /* INFO: GnuHash alone barely changes the low bits between similar names */
+  size_t slot = (hash ^ (hash >> 15)) * 2654435761U & img->symtabs_hash_mask;
+
+  while (img->symtabs_hash_[slot].index != 0) {
+    struct symtabs_slot *current = &img->symtabs_hash_[slot];
+    if (current->hash == hash && strcmp(img->symtabs_[current->index - 1].name, name) == 0)
+      return current;
+
+    slot = (slot + 1) & img->symtabs_hash_mask;
+  }
+
+  return &img->symtabs_hash_[slot];
+}
+
+/* INFO: Indexes the defined FUNC/OBJECT symbols of .symtab once, in table
+           order, and hashes them for exact lookups. Names are not copied,
+           they point into the mapped file. */
 bool _load_symtabs(ElfImg *img) {
   if (img->symtabs_) return true;
 
@@ -466,14 +457,7 @@ bool _load_symtabs(ElfImg *img) {
     return false;
   }
 
-  size_t valid_symtabs_amount = calculate_valid_symtabs_amount(img);
-  if (valid_symtabs_amount == 0) {
-    LOGW("No valid symbols (FUNC/OBJECT with size > 0) found in .symtab for %s", img->elf);
-
-    return false;
-  }
-
-  img->symtabs_ = (struct symtabs *)calloc(valid_symtabs_amount, sizeof(struct symtabs));
+  img->symtabs_ = (struct symtabs *)malloc(img->symtab_count * sizeof(struct symtabs));
   if (!img->symtabs_) {
     LOGE("Failed to allocate memory for symtabs array");
 
@@ -481,43 +465,66 @@ bool _load_symtabs(ElfImg *img) {
   }
 
   char *symtab_strings = offsetOf_char(img->header, img->symstr_offset_for_symtab);
-  size_t current_valid_index = 0;
+  ElfW(Shdr) *symtab_str_shdr = img->section_header + img->symtab->sh_link;
+  size_t count = 0;
 
   for (ElfW(Off) pos = 0; pos < img->symtab_count; pos++) {
     ElfW(Sym) *current_sym = &img->symtab_start[pos];
     unsigned int st_type = ELF_ST_TYPE(current_sym->st_info);
 
-    if ((st_type == STT_FUNC || st_type == STT_OBJECT) && current_sym->st_size > 0 && current_sym->st_name != 0) {
-      const char *st_name = symtab_strings + current_sym->st_name;
-      if (!st_name)
-        continue;
+    if ((st_type != STT_FUNC && st_type != STT_OBJECT) || current_sym->st_size == 0 || current_sym->st_name == 0)
+      continue;
 
-      ElfW(Shdr) *symtab_str_shdr = img->section_header + img->symtab->sh_link;
-      if (current_sym->st_name >= symtab_str_shdr->sh_size) {
-        LOGE("Symbol name offset out of bounds");
+    /* INFO: Never returned by the lookups */
+    if (current_sym->st_shndx == SHN_UNDEF)
+      continue;
 
-        continue;
-      }
+    if (current_sym->st_name >= symtab_str_shdr->sh_size) {
+      LOGE("Symbol name offset out of bounds");
 
-      img->symtabs_[current_valid_index].name = strdup(st_name);
-      if (!img->symtabs_[current_valid_index].name) {
-        LOGE("Failed to duplicate symbol name: %s", st_name);
+      continue;
+    }
 
-        for(size_t k = 0; k < current_valid_index; ++k) {
-          free(img->symtabs_[k].name);
-        }
+    img->symtabs_[count].name = symtab_strings + current_sym->st_name;
+    img->symtabs_[count].sym = current_sym;
+    count++;
+  }
 
-        free(img->symtabs_);
-        img->symtabs_ = NULL;
+  if (count == 0) {
+    LOGW("No valid symbols (FUNC/OBJECT with size > 0) found in .symtab for %s", img->elf);
 
-        return false;
-      }
+    free(img->symtabs_);
+    img->symtabs_ = NULL;
+
+    return false;
+  }
 
-      img->symtabs_[current_valid_index].sym = current_sym;
+  size_t hash_size = 16;
+  while (hash_size < count * 2) hash_size *= 2;
 
-      current_valid_index++;
-      if (current_valid_index == valid_symtabs_amount) break;
-    }
+  img->symtabs_hash_ = (struct symtabs_slot *)calloc(hash_size, sizeof(struct symtabs_slot));
+  if (!img->symtabs_hash_) {
+    LOGE("Failed to allocate memory for symtabs hash");
+
+    free(img->symtabs_);
+    img->symtabs_ = NULL;
+
+    return false;
+  }
+
+  img->symtabs_count = count;
+  img->symtabs_hash_mask = hash_size - 1;
+
+  /* INFO: Inserted in table order, and only the first of equal names, which
+             is the one lookups return. */
+  for (size_t i = 0; i < count; i++) {
+    uint32_t hash = GnuHash(img->symtabs_[i].name);
+
+    struct symtabs_slot *slot = _find_symtabs_slot(img, img->symtabs_[i].name, hash);
+    if (slot->index != 0) continue;
+
+    slot->hash = hash;
+    slot->index = (uint32_t)(i + 1);
   }
 
   return true;
@@ -619,24 +626,10 @@ ElfW(Addr) LinearLookup(ElfImg *img, const char *restrict name) {
     return 0;
   }
 
-  size_t valid_symtabs_amount = calculate_valid_symtabs_amount(img);
-  if (valid_symtabs_amount == 0) {
-    LOGW("No valid symbols (FUNC/OBJECT with size > 0) found in .symtab for %s", img->elf);
-
-    return false;
-  }
-
-  for (size_t i = 0; i < valid_symtabs_amount; i++) {
-    if (!img->symtabs_[i].name || strcmp(name, img->symtabs_[i].name) != 0)
-      continue;
-
-    if (img->symtabs_[i].sym->st_shndx == SHN_UNDEF)
-      continue;
-
-    return img->symtabs_[i].sym->st_value;
-  }
+  struct symtabs_slot *slot = _find_symtabs_slot(img, name, GnuHash(name));
+  if (slot->index == 0) return 0;
 
-  return 0;
+  return img->symtabs_[slot->index - 1].sym->st_value;
 }
 
 ElfW(Addr) LinearLookupByPrefix(ElfImg *img, const char *prefix) {
@@ -646,27 +639,12 @@ ElfW(Addr) LinearLookupByPrefix(ElfImg *img, const char *prefix) {
     return 0;
   }
 
-  size_t valid_symtabs_amount = calculate_valid_symtabs_amount(img);
-  if (valid_symtabs_amount == 0) {
-    LOGW("No valid symbols (FUNC/OBJECT with size > 0) found in .symtab for %s", img->elf);
-
-    return false;
-  }
-
   size_t prefix_len = strlen(prefix);
   if (prefix_len == 0) return 0;
 
-  for (size_t i = 0; i < valid_symtabs_amount; i++) {
-    if (!img->symtabs_[i].name || strlen(img->symtabs_[i].name) < prefix_len)
-      continue;
-
-    if (strncmp(img->symtabs_[i].name, prefix, prefix_len) != 0)
-      continue;
-
-    if (img->symtabs_[i].sym->st_shndx == SHN_UNDEF)
-      continue;
-
-    return img->symtabs_[i].sym->st_value;
+  for (size_t i = 0; i < img->symtabs_count; i++) {
+    if (strncmp(img->symtabs_[i].name, prefix, prefix_len) == 0)
+      return img->symtabs_[i].sym->st_value;
   }
 
   return 0;
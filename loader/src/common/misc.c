@@ -1,3 +1,12 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "misc.h"
+
 int parse_int(const char *str) {
   int val = 0;
 
@@ -12,3 +21,43 @@ int parse_int(const char *str) {
 
   return val;
 }
+
+struct linux_dirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+bool for_each_open_fd(void (*callback)(int fd, void *data), void *data) {
+  int dir_fd = open("/proc/self/fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd == -1) return false;
+
+  char buf[4096] __attribute__((aligned(8)));
+
+  while (1) {
+    long nread = syscall(SYS_getdents64, dir_fd, buf, sizeof(buf));
+    if (nread == -1) {
+      close(dir_fd);
+
+      return false;
+    }
+
+    if (nread == 0) break;
+
+    for (long pos = 0; pos < nread;) {
+      struct linux_dirent64 *entry = (struct linux_dirent64 *)(buf + pos);
+      pos += entry->d_reclen;
+
+      int fd = parse_int(entry->d_name);
+      if (fd < 0 || fd == dir_fd) continue;
+
+      callback(fd, data);
+    }
+  }
+
+  close(dir_fd);
+
+  return true;
+}
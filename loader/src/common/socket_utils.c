@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include <sys/socket.h>
 
@@ -8,67 +9,98 @@
 
 #include "socket_utils.h"
 
-/* TODO: Standardize how to log errors */
-int read_fd(int fd) {
-  char cmsgbuf[CMSG_SPACE(sizeof(int))];
+void message_init(struct message *msg) {
+  msg->data = NULL;
+  msg->len = 0;
+  msg->capacity = 0;
+  msg->pos = 0;
+  msg->fds_len = 0;
+  msg->fds_pos = 0;
+}
 
-  int cnt = 1;
-  struct iovec iov = {
-    .iov_base = &cnt,
-    .iov_len = sizeof(cnt)
-  };
+void message_free(struct message *msg) {
+  /* INFO: Received fds which were not taken would otherwise leak */
+  for (size_t i = msg->fds_pos; i < msg->fds_len; i++) {
+    close(msg->fds[i]);
+  }
 
-  struct msghdr msg = {
-    .msg_iov = &iov,
-    .msg_iovlen = 1,
-    .msg_control = cmsgbuf,
-    .msg_controllen = sizeof(cmsgbuf)
-  };
+  free(msg->data);
 
-  ssize_t ret = recvmsg(fd, &msg, MSG_WAITALL);
-  if (ret == -1) {
-    PLOGE("recvmsg");
+  message_init(msg);
+}
 
-    return -1;
+bool message_put(struct message *msg, const void *data, size_t len) {
+  if (msg->len + len > MESSAGE_MAX_LEN) {
+    LOGE("Failed to put data in message: Message is too big (%zu > %d).\n", msg->len + len, MESSAGE_MAX_LEN);
+
+    return false;
   }
 
-  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
-  if (cmsg == NULL) {
-    PLOGE("CMSG_FIRSTHDR");
+  if (msg->len + len > msg->capacity) {
+    size_t new_capacity = msg->capacity == 0 ? 64 : msg->capacity;
+    while (new_capacity < msg->len + len) new_capacity *= 2;
 
-    return -1;
+    uint8_t *new_data = realloc(msg->data, new_capacity);
+    if (new_data == NULL) {
+      PLOGE("allocate memory for message");
+
+      return false;
+    }
+
+    msg->data = new_data;
+    msg->capacity = new_capacity;
   }
 
-  int sendfd;
-  memcpy(&sendfd, CMSG_DATA(cmsg), sizeof(int));
+  memcpy(msg->data + msg->len, data, len);
+  msg->len += len;
 
-  return sendfd;
+  return true;
 }
 
-ssize_t write_string(int fd, const char *str) {
-  size_t str_len = strlen(str);
-  ssize_t write_bytes = write(fd, &str_len, sizeof(size_t));
-  if (write_bytes != (ssize_t)sizeof(size_t)) {
-    LOGE("Failed to write string length: Not all bytes were written (%zd != %zu).\n", write_bytes, sizeof(size_t));
+bool message_get(struct message *msg, void *out, size_t len) {
+  if (msg->len - msg->pos < len) {
+    LOGE("Failed to get data from message: Not enough bytes left (%zu < %zu).\n", msg->len - msg->pos, len);
 
-    return -1;
+    return false;
   }
 
-  write_bytes = write(fd, str, str_len);
-  if (write_bytes != (ssize_t)str_len) {
-    LOGE("Failed to write string: Promised bytes doesn't exist (%zd != %zu).\n", write_bytes, str_len);
+  memcpy(out, msg->data + msg->pos, len);
+  msg->pos += len;
 
-    return -1;
+  return true;
+}
+
+#define message_put_func(type)                              \
+  bool message_put_## type(struct message *msg, type val) { \
+    return message_put(msg, &val, sizeof(type));            \
   }
 
-  return write_bytes;
+#define message_get_func(type)                               \
+  bool message_get_## type(struct message *msg, type *val) { \
+    return message_get(msg, val, sizeof(type));              \
+  }
+
+message_put_func(uint8_t)
+message_get_func(uint8_t)
+
+message_put_func(uint32_t)
+message_get_func(uint32_t)
+
+message_put_func(size_t)
+message_get_func(size_t)
+
+bool message_put_string(struct message *msg, const char *str) {
+  size_t str_len = strlen(str);
+
+  return message_put_size_t(msg, str_len) && message_put(msg, str, str_len);
 }
 
-char *read_string(int fd) {
+char *message_get_string(struct message *msg) {
   size_t str_len = 0;
-  ssize_t read_bytes = read(fd, &str_len, sizeof(size_t));
-  if (read_bytes != (ssize_t)sizeof(size_t)) {
-    LOGE("Failed to read string length: Not all bytes were read (%zd != %zu).\n", read_bytes, sizeof(size_t));
+  if (!message_get_size_t(msg, &str_len)) return NULL;
+
+  if (msg->len - msg->pos < str_len) {
+    LOGE("Failed to get string from message: Promised bytes doesn't exist (%zu < %zu).\n", msg->len - msg->pos, str_len);
 
     return NULL;
   }
@@ -80,35 +112,143 @@ char *read_string(int fd) {
     return NULL;
   }
 
-  read_bytes = read(fd, buf, str_len);
-  if (read_bytes != (ssize_t)str_len) {
-    LOGE("Failed to read string: Promised bytes doesn't exist (%zd != %zu).\n", read_bytes, str_len);
+  message_get(msg, buf, str_len);
+  buf[str_len] = '\0';
+
+  return buf;
+}
 
-    free(buf);
+int message_take_fd(struct message *msg) {
+  if (msg->fds_pos == msg->fds_len) {
+    LOGE("Failed to take fd from message: No fds left.\n");
 
-    return NULL;
+    return -1;
   }
 
-  if (str_len > 0) buf[str_len] = '\0';
+  return msg->fds[msg->fds_pos++];
+}
 
-  return buf;
+/* INFO: The header and the payload go in a single sendmsg, which only
+           needs to be repeated if the socket buffer is full. */
+bool message_send(int fd, const struct message *msg) {
+  uint32_t header = (uint32_t)msg->len;
+  size_t total = sizeof(header) + msg->len;
+  size_t sent = 0;
+
+  while (sent < total) {
+    struct iovec iov[2];
+    size_t iov_len = 0;
+
+    if (sent < sizeof(header)) {
+      iov[iov_len].iov_base = (uint8_t *)&header + sent;
+      iov[iov_len].iov_len = sizeof(header) - sent;
+      iov_len++;
+
+      if (msg->len != 0) {
+        iov[iov_len].iov_base = msg->data;
+        iov[iov_len].iov_len = msg->len;
+        iov_len++;
+      }
+    } else {
+      iov[iov_len].iov_base = msg->data + (sent - sizeof(header));
+      iov[iov_len].iov_len = total - sent;
+      iov_len++;
+    }
+
+    struct msghdr msghdr = {
+      .msg_iov = iov,
+      .msg_iovlen = iov_len
+    };
+
+    ssize_t ret = sendmsg(fd, &msghdr, MSG_NOSIGNAL);
+    if (ret == -1) {
+      if (errno == EINTR) continue;
+
+      PLOGE("sendmsg");
+
+      return false;
+    }
+
+    sent += (size_t)ret;
+  }
+
+  return true;
 }
 
-#define write_func(type)                    \
-  ssize_t write_## type(int fd, type val) { \
-    return write(fd, &val, sizeof(type));   \
+static bool _message_recv_all(int fd, void *buf, size_t len, struct message *msg) {
+  size_t received = 0;
+
+  while (received < len) {
+    struct iovec iov = {
+      .iov_base = (uint8_t *)buf + received,
+      .iov_len = len - received
+    };
+
+    struct msghdr msghdr = {
+      .msg_iov = &iov,
+      .msg_iovlen = 1
+    };
+
+    char cmsgbuf[CMSG_SPACE(sizeof(int) * MESSAGE_MAX_FDS)];
+    if (msg != NULL && received == 0) {
+      msghdr.msg_control = cmsgbuf;
+      msghdr.msg_controllen = sizeof(cmsgbuf);
+    }
+
+    ssize_t ret = recvmsg(fd, &msghdr, MSG_CMSG_CLOEXEC);
+    if (ret == -1) {
+      if (errno == EINTR) continue;
+
+      PLOGE("recvmsg");
+
+      return false;
+    }
+
+    if (msghdr.msg_controllen != 0) {
+      for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msghdr); cmsg != NULL; cmsg = CMSG_NXTHDR(&msghdr, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+
+        size_t fds_len = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        memcpy(msg->fds + msg->fds_len, CMSG_DATA(cmsg), fds_len * sizeof(int));
+        msg->fds_len += fds_len;
+      }
+    }
+
+    if (ret == 0) {
+      LOGE("Failed to receive message: Connection closed (%zu < %zu).\n", received, len);
+
+      return false;
+    }
+
+    received += (size_t)ret;
   }
 
-#define read_func(type)                     \
-  ssize_t read_## type(int fd, type *val) { \
-    return read(fd, val, sizeof(type));     \
+  return true;
+}
+
+bool message_recv(int fd, struct message *msg) {
+  message_init(msg);
+
+  uint32_t header = 0;
+  if (!_message_recv_all(fd, &header, sizeof(header), msg)) return false;
+
+  if (header > MESSAGE_MAX_LEN) {
+    LOGE("Failed to receive message: Message is too big (%u > %d).\n", header, MESSAGE_MAX_LEN);
+
+    return false;
   }
 
-write_func(uint8_t)
-read_func(uint8_t)
+  if (header == 0) return true;
+
+  msg->data = malloc(header);
+  if (msg->data == NULL) {
+    PLOGE("allocate memory for message");
 
-write_func(uint32_t)
-read_func(uint32_t)
+    return false;
+  }
+
+  msg->capacity = header;
+  msg->len = header;
 
-write_func(size_t)
-read_func(size_t)
+  return _message_recv_all(fd, msg->data, header, NULL);
+}
@@ -6,8 +6,10 @@ extern "C" {
 #endif /* __cplusplus */
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include <unistd.h>
+#include <linux/limits.h>
 
 #ifdef __LP64__
   #define LP_SELECT(lp32, lp64) lp64
@@ -26,11 +28,19 @@ enum rezygiskd_actions {
   GetModuleDir,
   ZygoteRestart,
   SystemServerStarted,
-  UpdateMountNamespace
+  UpdateMountNamespace,
+  GetSpecializeBundle,
+  GetPolicyTable,
+  GetLinkerCache,
+  PutLinkerCache
 };
 
 struct zygisk_modules {
   char **modules;
+  /* INFO: The opened library of each module, if received from ReZygiskd */
+  int *lib_fds;
+  /* INFO: Whether each module is to be loaded once in zygote */
+  bool *preload;
   size_t modules_count;
 };
 
@@ -53,6 +63,39 @@ enum mount_namespace_state {
   Mounted
 };
 
+/* INFO: Everything a process needs to specialize, received at once */
+struct specialize_bundle {
+  uint32_t flags;
+  struct zygisk_modules modules;
+  /* INFO: -1 when the process must not switch mount namespace */
+  int mns_fd;
+};
+
+/* INFO: Must be a power of 2 */
+#define POLICY_TABLE_SIZE 1024
+
+/* INFO: Layout of the policy table ReZygiskd shares through a read-only
+           memfd. Must be kept in sync with zygiskd's root_impl/common.h. */
+struct policy_entry {
+  uint64_t process_hash;
+  uint32_t uid;
+  uint32_t flags;
+  uint32_t used;
+  uint32_t reserved;
+};
+
+struct policy_table {
+  /* INFO: Odd while the table is being written */
+  uint32_t seq;
+  uint32_t impl_flags;
+  /* INFO: Changes whenever the mounts of the root implementation do */
+  uint32_t mounts_generation;
+  /* INFO: Changes on every change of the mount table, and is 0 while it is
+             not watched, in which case nothing may be cached from it */
+  uint32_t mount_changes;
+  struct policy_entry entries[POLICY_TABLE_SIZE];
+};
+
 #define TMP_PATH "/data/adb/rezygisk"
 
 static inline const char *rezygiskd_get_path() {
@@ -81,7 +124,22 @@ void rezygiskd_zygote_restart();
 
 void rezygiskd_system_server_started();
 
-bool rezygiskd_update_mns(enum mount_namespace_state nms_state, char *buf, size_t buf_size);
+int rezygiskd_update_mns(enum mount_namespace_state nms_state);
+
+bool rezygiskd_get_specialize_bundle(uid_t uid, const char *const process, bool system_server, struct specialize_bundle *bundle);
+
+void free_specialize_bundle(struct specialize_bundle *bundle);
+
+const struct policy_table *rezygiskd_map_policy_table();
+
+bool policy_table_lookup(const struct policy_table *table, uid_t uid, const char *const process, uint32_t *flags);
+
+/* INFO: ReZygiskd only keeps the last cache stored, it is up to the caller
+           to check whether it still applies. Fails if it has none of that
+           size. */
+bool rezygiskd_get_linker_cache(void *cache, size_t len);
+
+void rezygiskd_put_linker_cache(const void *cache, size_t len);
 
 #ifdef __cplusplus
 }
@@ -8,11 +8,18 @@
 
 #define SHT_GNU_HASH 0x6ffffff6
 
+/* INFO: The name points into the mapped file */
 struct symtabs {
-  char *name;
+  const char *name;
   ElfW(Sym) *sym;
 };
 
+struct symtabs_slot {
+  uint32_t hash;
+  /* INFO: Index in symtabs_ plus 1, 0 when the slot is empty */
+  uint32_t index;
+};
+
 typedef struct {
   char *elf;
   void *base;
@@ -48,6 +55,10 @@ typedef struct {
   ElfW(Off) symstr_offset_for_symtab;
 
   struct symtabs *symtabs_;
+  size_t symtabs_count;
+  /* INFO: Open addressing table over symtabs_, by GnuHash of the name */
+  struct symtabs_slot *symtabs_hash_;
+  size_t symtabs_hash_mask;
 } ElfImg;
 
 void ElfImg_destroy(ElfImg *img);
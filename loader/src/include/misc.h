@@ -1,6 +1,8 @@
 #ifndef MISC_H
 #define MISC_H
 
+#include <stdbool.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif /* __cplusplus */
@@ -14,6 +16,13 @@ extern "C" {
  */
 int parse_int(const char *str);
 
+/*
+ * Calls callback for every fd open in the process, except the one used
+ * to list them. /proc/self/fd is read with getdents64 into a stack buffer,
+ * so that, unlike opendir, nothing is allocated.
+ */
+bool for_each_open_fd(void (*callback)(int fd, void *data), void *data);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
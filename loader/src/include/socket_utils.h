@@ -1,27 +1,59 @@
 #ifndef SOCKET_UTILS_H
 #define SOCKET_UTILS_H
 
+#include <stdbool.h>
 #include <stdint.h>
+#include <stddef.h>
 
-int read_fd(int fd);
+/* INFO: Every message is its payload length, as an uint32_t, followed by
+           the payload itself. Fds, if any, go along with the length. */
+#define MESSAGE_MAX_LEN (1024 * 1024)
+/* INFO: SCM_MAX_FD, the most fds the kernel accepts in a single message */
+#define MESSAGE_MAX_FDS 253
 
-ssize_t write_string(int fd, const char *str);
-  
-char *read_string(int fd);
+struct message {
+  uint8_t *data;
+  size_t len;
+  size_t capacity;
+  /* INFO: Read position of message_get */
+  size_t pos;
 
-#define write_func_def(type)              \
-  ssize_t write_## type(int fd, type val)
+  int fds[MESSAGE_MAX_FDS];
+  size_t fds_len;
+  size_t fds_pos;
+};
 
-#define read_func_def(type)               \
-  ssize_t read_## type(int fd, type *val)
+#define message_put_func_def(type) \
+  bool message_put_## type(struct message *msg, type val)
 
-write_func_def(uint8_t);
-read_func_def(uint8_t);
+#define message_get_func_def(type) \
+  bool message_get_## type(struct message *msg, type *val)
 
-write_func_def(uint32_t);
-read_func_def(uint32_t);
+void message_init(struct message *msg);
 
-write_func_def(size_t);
-read_func_def(size_t);
+void message_free(struct message *msg);
 
-#endif /* SOCKET_UTILS_H */
\ No newline at end of file
+bool message_put(struct message *msg, const void *data, size_t len);
+
+bool message_get(struct message *msg, void *out, size_t len);
+
+message_put_func_def(uint8_t);
+message_get_func_def(uint8_t);
+
+message_put_func_def(uint32_t);
+message_get_func_def(uint32_t);
+
+message_put_func_def(size_t);
+message_get_func_def(size_t);
+
+bool message_put_string(struct message *msg, const char *str);
+
+char *message_get_string(struct message *msg);
+
+int message_take_fd(struct message *msg);
+
+bool message_send(int fd, const struct message *msg);
+
+bool message_recv(int fd, struct message *msg);
+
+#endif /* SOCKET_UTILS_H */
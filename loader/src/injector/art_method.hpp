@@ -1,5 +1,7 @@
 #pragma once
 
+#include <atomic>
+
 #include "logging.h"
 #include "jni_helper.hpp"
 
@@ -19,6 +21,16 @@ namespace lsplant::art {
             return *reinterpret_cast<void **>(reinterpret_cast<uintptr_t>(this) + data_offset);
         }
 
+        /* INFO: Right after declaring_class_, a 32-bit GcRoot, on every version */
+        uint32_t GetAccessFlags() {
+            return reinterpret_cast<const std::atomic<uint32_t> *>(
+                    reinterpret_cast<uintptr_t>(this) + access_flags_offset)->load(std::memory_order_relaxed);
+        }
+
+        bool IsNative() {
+            return (GetAccessFlags() & kAccNative) != 0;
+        }
+
         static art::ArtMethod *FromReflectedMethod(JNIEnv *env, jobject method) {
             if (art_method_field) [[likely]] {
                 return reinterpret_cast<art::ArtMethod *>(
@@ -74,6 +86,9 @@ namespace lsplant::art {
         }
 
     private:
+        inline static constexpr size_t access_flags_offset = sizeof(uint32_t);
+        inline static constexpr uint32_t kAccNative = 0x0100;
+
         inline static jfieldID art_method_field = nullptr;
         inline static size_t art_method_size = 0;
         inline static size_t entry_point_offset = 0;
@@ -23,6 +23,10 @@ void entry(void* addr, size_t size, const char* path) {
     LOGD("start plt hooking");
     hook_functions();
 
+    preload_modules();
+    map_policy_table();
+    map_reopen_cache();
+
     void *module_addrs[1] = { addr };
     clean_trace(path, module_addrs, 1, 1, 0);
     send_seccomp_event();
@@ -58,9 +58,13 @@ class Method:
         return ''
 
 class JNIHook(Method):
-    def __init__(self, ver, ret, args):
+    def __init__(self, ver, ret, args, sdk = (0, 0), vendor = None):
         name = f'{self.base_name()}_{ver}'
         super().__init__(name, ret, args)
+        # SDK range the variant ships on (max 0 for no upper bound, min 0 to only
+        # reach it by probing) and the ro.product.manufacturer it is specific to
+        self.sdk = sdk
+        self.vendor = vendor
 
     def base_name(self):
         return ''
@@ -81,8 +85,8 @@ jlongArray = JArray(jlong)
 void = JType('void', 'V')
 
 class ForkAndSpec(JNIHook):
-    def __init__(self, ver, args):
-        super().__init__(ver, Return('ctx.pid', jint), args)
+    def __init__(self, ver, args, sdk = (0, 0), vendor = None):
+        super().__init__(ver, Return('ctx.pid', jint), args, sdk, vendor)
 
     def base_name(self):
         return 'nativeForkAndSpecialize'
@@ -105,8 +109,8 @@ class ForkAndSpec(JNIHook):
         return decl
 
 class SpecApp(ForkAndSpec):
-    def __init__(self, ver, args):
-        super().__init__(ver, args)
+    def __init__(self, ver, args, sdk = (0, 0), vendor = None):
+        super().__init__(ver, args, sdk, vendor)
         self.ret = Return('', void)
 
     def base_name(self):
@@ -156,60 +160,60 @@ effective_capabilities = Argument('effective_capabilities', jlong)
 
 # Method definitions
 fas_l = ForkAndSpec('l', [uid, gid, gids, runtime_flags, rlimits, mount_external,
-    se_info, nice_name, fds_to_close, instruction_set, app_data_dir])
+    se_info, nice_name, fds_to_close, instruction_set, app_data_dir], sdk = (21, 25))
 
 fas_o = ForkAndSpec('o', [uid, gid, gids, runtime_flags, rlimits, mount_external,
-    se_info, nice_name, fds_to_close, fds_to_ignore, instruction_set, app_data_dir])
+    se_info, nice_name, fds_to_close, fds_to_ignore, instruction_set, app_data_dir], sdk = (26, 27))
 
 fas_p = ForkAndSpec('p', [uid, gid, gids, runtime_flags, rlimits, mount_external, se_info,
-    nice_name, fds_to_close, fds_to_ignore, is_child_zygote, instruction_set, app_data_dir])
+    nice_name, fds_to_close, fds_to_ignore, is_child_zygote, instruction_set, app_data_dir], sdk = (28, 29))
 
 fas_q_alt = ForkAndSpec('q_alt', [uid, gid, gids, runtime_flags, rlimits, mount_external, se_info,
-    nice_name, fds_to_close, fds_to_ignore, is_child_zygote, instruction_set, app_data_dir, is_top_app])
+    nice_name, fds_to_close, fds_to_ignore, is_child_zygote, instruction_set, app_data_dir, is_top_app], sdk = (29, 29))
 
 fas_r = ForkAndSpec('r', [uid, gid, gids, runtime_flags, rlimits, mount_external, se_info,
     nice_name, fds_to_close, fds_to_ignore, is_child_zygote, instruction_set, app_data_dir, is_top_app,
-    pkg_data_info_list, whitelisted_data_info_list, mount_data_dirs, mount_storage_dirs])
+    pkg_data_info_list, whitelisted_data_info_list, mount_data_dirs, mount_storage_dirs], sdk = (30, 33))
 
 fas_u = ForkAndSpec('u', [uid, gid, gids, runtime_flags, rlimits, mount_external, se_info,
     nice_name, fds_to_close, fds_to_ignore, is_child_zygote, instruction_set, app_data_dir, is_top_app,
-    pkg_data_info_list, whitelisted_data_info_list, mount_data_dirs, mount_storage_dirs, mount_sysprop_overrides])
+    pkg_data_info_list, whitelisted_data_info_list, mount_data_dirs, mount_storage_dirs, mount_sysprop_overrides], sdk = (34, 0))
 
 fas_samsung_m = ForkAndSpec('samsung_m', [uid, gid, gids, runtime_flags, rlimits, mount_external,
-    se_info, Anon(jint), Anon(jint), nice_name, fds_to_close, instruction_set, app_data_dir])
+    se_info, Anon(jint), Anon(jint), nice_name, fds_to_close, instruction_set, app_data_dir], sdk = (23, 23), vendor = 'samsung')
 
 fas_samsung_n = ForkAndSpec('samsung_n', [uid, gid, gids, runtime_flags, rlimits, mount_external,
-    se_info, Anon(jint), Anon(jint), nice_name, fds_to_close, instruction_set, app_data_dir, Anon(jint)])
+    se_info, Anon(jint), Anon(jint), nice_name, fds_to_close, instruction_set, app_data_dir, Anon(jint)], sdk = (24, 25), vendor = 'samsung')
 
 fas_samsung_o = ForkAndSpec('samsung_o', [uid, gid, gids, runtime_flags, rlimits, mount_external,
-    se_info, Anon(jint), Anon(jint), nice_name, fds_to_close, fds_to_ignore, instruction_set, app_data_dir])
+    se_info, Anon(jint), Anon(jint), nice_name, fds_to_close, fds_to_ignore, instruction_set, app_data_dir], sdk = (26, 27), vendor = 'samsung')
 
 fas_samsung_p = ForkAndSpec('samsung_p', [uid, gid, gids, runtime_flags, rlimits, mount_external,
     se_info, Anon(jint), Anon(jint), nice_name, fds_to_close, fds_to_ignore, is_child_zygote,
-    instruction_set, app_data_dir])
+    instruction_set, app_data_dir], sdk = (28, 29), vendor = 'samsung')
 
 spec_q = SpecApp('q', [uid, gid, gids, runtime_flags, rlimits, mount_external, se_info,
-    nice_name, is_child_zygote, instruction_set, app_data_dir])
+    nice_name, is_child_zygote, instruction_set, app_data_dir], sdk = (29, 29))
 
 spec_q_alt = SpecApp('q_alt', [uid, gid, gids, runtime_flags, rlimits, mount_external, se_info,
-    nice_name, is_child_zygote, instruction_set, app_data_dir, is_top_app])
+    nice_name, is_child_zygote, instruction_set, app_data_dir, is_top_app], sdk = (29, 29))
 
 spec_r = SpecApp('r', [uid, gid, gids, runtime_flags, rlimits, mount_external, se_info, nice_name,
     is_child_zygote, instruction_set, app_data_dir, is_top_app, pkg_data_info_list,
-    whitelisted_data_info_list, mount_data_dirs, mount_storage_dirs])
+    whitelisted_data_info_list, mount_data_dirs, mount_storage_dirs], sdk = (30, 33))
 
 spec_u = SpecApp('u', [uid, gid, gids, runtime_flags, rlimits, mount_external, se_info, nice_name,
     is_child_zygote, instruction_set, app_data_dir, is_top_app, pkg_data_info_list,
-    whitelisted_data_info_list, mount_data_dirs, mount_storage_dirs, mount_sysprop_overrides])
+    whitelisted_data_info_list, mount_data_dirs, mount_storage_dirs, mount_sysprop_overrides], sdk = (34, 0))
 
 spec_samsung_q = SpecApp('samsung_q', [uid, gid, gids, runtime_flags, rlimits, mount_external,
-    se_info, Anon(jint), Anon(jint), nice_name, is_child_zygote, instruction_set, app_data_dir])
+    se_info, Anon(jint), Anon(jint), nice_name, is_child_zygote, instruction_set, app_data_dir], sdk = (29, 29), vendor = 'samsung')
 
 server_l = ForkServer('l', [uid, gid, gids, runtime_flags, rlimits,
-    permitted_capabilities, effective_capabilities])
+    permitted_capabilities, effective_capabilities], sdk = (21, 0))
 
 server_samsung_q = ForkServer('samsung_q', [uid, gid, gids, runtime_flags, Anon(jint), Anon(jint), rlimits,
-    permitted_capabilities, effective_capabilities])
+    permitted_capabilities, effective_capabilities], sdk = (29, 0), vendor = 'samsung')
 
 # GrapheneOS Android 14 Support
 server_grapheneos_u = ForkServer('grapheneos_u', [uid, gid, gids, runtime_flags, rlimits, permitted_capabilities, effective_capabilities])
@@ -244,6 +248,12 @@ def gen_jni_def(clz, methods):
         decl += ind(2) + f'(void *) &{m.name}'
         decl += ind(1) + '},'
     decl += ind(0) + '};'
+
+    decl += ind(0) + f'std::array {m.base_name()}_variants = {{'
+    for m in methods:
+        vendor = f'"{m.vendor}"' if m.vendor else 'nullptr'
+        decl += ind(1) + f'JniHookVariant {{ {m.sdk[0]}, {m.sdk[1]}, {vendor} }},'
+    decl += ind(0) + '};'
     decl = ind(0) + f'void *{m.base_name()}_orig = nullptr;' + decl
     decl += ind(0)
 
@@ -255,6 +265,12 @@ with open('jni_hooks.hpp', 'w') as f:
     f.write('// Generated by gen_jni_hooks.py\n')
     f.write('\nnamespace {\n')
 
+    f.write('\nstruct JniHookVariant {')
+    f.write(ind(1) + 'int min_sdk;')
+    f.write(ind(1) + 'int max_sdk;')
+    f.write(ind(1) + 'const char *vendor;')
+    f.write(ind(0) + '};\n')
+
     zygote = 'com/android/internal/os/Zygote'
 
     methods = [fas_l, fas_o, fas_p, fas_q_alt, fas_r, fas_u, fas_samsung_m, fas_samsung_n, fas_samsung_o, fas_samsung_p, fas_grapheneos_u]
@@ -269,34 +285,71 @@ with open('jni_hooks.hpp', 'w') as f:
     f.write('\n} // namespace\n')
 
     f.write("""
-static void do_hook_zygote(JNIEnv *env) {
-    vector<JNINativeMethod> hooks;
-    const char *clz;
-    clz = "com/android/internal/os/Zygote";
-    hookJniNativeMethods(env, clz, nativeForkAndSpecialize_methods.data(), nativeForkAndSpecialize_methods.size());
-    for (auto &method : nativeForkAndSpecialize_methods) {
-        if (method.fnPtr) {
-            nativeForkAndSpecialize_orig = method.fnPtr;
-            hooks.emplace_back(method);
-            break;
+/* INFO: Hooks the variant of a Zygote method this device is expected to have,
+           vendor specific ones first, before probing all of them. Every failed
+           probe throws and clears a Java exception during zygote boot.
+*/
+template <size_t N>
+static void hook_zygote_method(JNIEnv *env, const char *clz, std::array<JNINativeMethod, N> &methods,
+                               const std::array<JniHookVariant, N> &variants, int sdk, const char *vendor,
+                               void *&orig, vector<JNINativeMethod> &hooks) {
+    vector<JNINativeMethod> likely;
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t i = 0; i < N; i++) {
+            const auto &variant = variants[i];
+            if (variant.min_sdk == 0 || sdk < variant.min_sdk) continue;
+            if (variant.max_sdk != 0 && sdk > variant.max_sdk) continue;
+
+            bool vendor_specific = variant.vendor != nullptr;
+            if (vendor_specific != (pass == 0)) continue;
+            if (vendor_specific && strcmp(variant.vendor, vendor) != 0) continue;
+
+            likely.emplace_back(methods[i]);
         }
     }
-    hookJniNativeMethods(env, clz, nativeSpecializeAppProcess_methods.data(), nativeSpecializeAppProcess_methods.size());
-    for (auto &method : nativeSpecializeAppProcess_methods) {
-        if (method.fnPtr) {
-            nativeSpecializeAppProcess_orig = method.fnPtr;
-            hooks.emplace_back(method);
-            break;
+
+    if (!likely.empty()) {
+        hookJniNativeMethods(env, clz, likely.data(), static_cast<int>(likely.size()));
+        for (auto &method : likely) {
+            if (method.fnPtr) {
+                orig = method.fnPtr;
+                hooks.emplace_back(method);
+                return;
+            }
         }
+
+        LOGV("no expected variant of %s for sdk %d [%s], probing all", methods[0].name, sdk, vendor);
     }
-    hookJniNativeMethods(env, clz, nativeForkSystemServer_methods.data(), nativeForkSystemServer_methods.size());
-    for (auto &method : nativeForkSystemServer_methods) {
+
+    hookJniNativeMethods(env, clz, methods.data(), static_cast<int>(N));
+    for (auto &method : methods) {
         if (method.fnPtr) {
-            nativeForkSystemServer_orig = method.fnPtr;
+            orig = method.fnPtr;
             hooks.emplace_back(method);
             break;
         }
     }
+}
+
+static void do_hook_zygote(JNIEnv *env) {
+    vector<JNINativeMethod> hooks;
+    const char *clz;
+    clz = "com/android/internal/os/Zygote";
+
+    char prop[PROP_VALUE_MAX] = { 0 };
+    __system_property_get("ro.build.version.sdk", prop);
+    int sdk = atoi(prop);
+
+    char vendor[PROP_VALUE_MAX] = { 0 };
+    __system_property_get("ro.product.manufacturer", vendor);
+    for (char *c = vendor; *c; c++) *c = static_cast<char>(tolower(*c));
+
+    hook_zygote_method(env, clz, nativeForkAndSpecialize_methods, nativeForkAndSpecialize_variants,
+                       sdk, vendor, nativeForkAndSpecialize_orig, hooks);
+    hook_zygote_method(env, clz, nativeSpecializeAppProcess_methods, nativeSpecializeAppProcess_variants,
+                       sdk, vendor, nativeSpecializeAppProcess_orig, hooks);
+    hook_zygote_method(env, clz, nativeForkSystemServer_methods, nativeForkSystemServer_variants,
+                       sdk, vendor, nativeForkSystemServer_orig, hooks);
     jni_hook_list->emplace(clz, std::move(hooks));
 }
 """)
@@ -1,20 +1,28 @@
 #include <sys/mount.h>
 #include <dlfcn.h>
+#include <android/dlext.h>
 #include <regex.h>
 #include <bitset>
 #include <list>
 #include <map>
+#include <set>
+#include <string_view>
+#include <unordered_map>
 #include <array>
 #include <vector>
 
 #include <lsplt.h>
 
 #include <fcntl.h>
-#include <dirent.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/prctl.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
+#include <link.h>
+#include <sys/system_properties.h>
+#include <ctype.h>
+#include <stdlib.h>
 
 #include <unistd.h>
 #include <pthread.h>
@@ -50,8 +58,6 @@ enum {
 void name##_pre();         \
 void name##_post();
 
-#define MAX_FD_SIZE 1024
-
 struct ZygiskContext;
 
 // Current context
@@ -71,22 +77,41 @@ struct ZygiskContext {
     int pid;
     bitset<FLAG_MAX> flags;
     uint32_t info_flags;
-    bitset<MAX_FD_SIZE> allowed_fds;
+    /* INFO: Indexed by fd, grows to the highest fd allowed */
+    vector<bool> allowed_fds;
     vector<int> exempted_fds;
 
-    struct RegisterInfo {
+    /* INFO: Lets the paths be looked up without copying them into a string,
+               which is only done the first time a path is matched. */
+    struct PathHash {
+        using is_transparent = void;
+
+        size_t operator()(string_view path) const { return hash<string_view>{}(path); }
+    };
+
+    /* INFO: Compiled once per distinct regex, and kept for the whole process
+               along with the paths it was matched against, as modules often
+               register the same regexes.
+    */
+    struct PltPattern {
         regex_t regex;
+        unordered_map<string, bool, PathHash, equal_to<>> matches;
+    };
+
+    struct RegisterInfo {
+        PltPattern *pattern;
         string symbol;
         void *callback;
         void **backup;
     };
 
     struct IgnoreInfo {
-        regex_t regex;
+        PltPattern *pattern;
         string symbol;
     };
 
     pthread_mutex_t hook_info_lock;
+    map<string, PltPattern> plt_patterns;
     vector<RegisterInfo> register_info;
     vector<IgnoreInfo> ignore_info;
 
@@ -98,7 +123,9 @@ struct ZygiskContext {
     ~ZygiskContext();
 
     /* Zygisksu changed: Load module fds */
-    bool load_modules_only();
+    void load_modules_only(const struct zygisk_modules *ms);
+    void load_preloaded_modules_only();
+    void unmap_unused_preloaded_modules();
     void run_modules_pre();
     void run_modules_post();
     DCL_PRE_POST(fork)
@@ -107,11 +134,13 @@ struct ZygiskContext {
     DCL_PRE_POST(nativeSpecializeAppProcess)
     DCL_PRE_POST(nativeForkSystemServer)
 
+    void allow_fd(int fd);
     void sanitize_fds();
     bool exempt_fd(int fd);
     bool is_child() const { return pid <= 0; }
 
     // Compatibility shim
+    PltPattern *plt_hook_pattern(const char *regex);
     void plt_hook_register(const char *regex, const char *symbol, void *fn, void **backup);
     void plt_hook_exclude(const char *regex, const char *symbol);
     void plt_hook_process_regex();
@@ -128,6 +157,133 @@ bool should_unmap_zygisk = false;
 bool enable_unloader = false;
 bool hooked_unloader = false;
 
+struct PreloadedModule {
+    size_t id;
+    string lib_path;
+    void *handle;
+    void *entry;
+    /* INFO: Page aligned PT_LOAD segments, so that forks can still unmap it,
+               as it can't be dlclosed once dropped from the solist. */
+    vector<pair<uintptr_t, size_t>> segments;
+};
+
+/* INFO: Modules loaded in zygote, inherited by all its forks */
+vector<PreloadedModule> *preloaded_modules;
+/* INFO: Whether no module has to be loaded from its fd after forking */
+bool all_modules_preloaded = false;
+
+/* INFO: Flags ReZygiskd computed for each process, mapped read-only in zygote */
+const struct policy_table *policy_table;
+/* INFO: Read from the policy table before a fork unmaps it, 0 if unknown */
+uint32_t mount_changes = 0;
+
+#define REOPEN_CACHE_SIZE 4096
+#define REOPEN_CACHE_PROBES 8
+
+enum {
+    REOPEN_OK = 1,
+    REOPEN_FAILED = 2
+};
+
+/* INFO: Whether the fds zygote reopens after forking still can be, per path,
+           mount namespace and mounts generation. Shared by zygote and its
+           forks, which fill it until they specialize. Each slot is a key
+           with the outcome in its lowest 2 bits, so that it can be filled
+           by many forks at once without locks.
+*/
+struct reopen_cache {
+    uint32_t checks;
+    uint32_t avoided;
+    uint64_t slots[REOPEN_CACHE_SIZE];
+};
+
+struct reopen_cache *reopen_cache;
+
+/* INFO: A single parse of /proc/self/maps, shared by everything that needs it
+           until the linker loads or unloads a library, or the mappings are
+           changed by ReZygisk itself, such as when committing hooks.
+*/
+struct maps_snapshot {
+    struct lsplt_map_info *maps;
+    size_t load_counter;
+    size_t unload_counter;
+    uint32_t generation;
+};
+
+struct maps_snapshot maps_snapshot = { nullptr, 0, 0, 0 };
+uint32_t maps_generation = 0;
+pthread_mutex_t maps_snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* INFO: The snapshot must be given back with release_maps, unless it could
+           not be scanned. It is scanned again every time if the linker
+           counters could not be found.
+*/
+struct lsplt_map_info *acquire_maps() {
+    pthread_mutex_lock(&maps_snapshot_lock);
+
+    size_t load = 0;
+    size_t unload = 0;
+    bool counted = solist_get_counters(&load, &unload);
+    uint32_t generation = __atomic_load_n(&maps_generation, __ATOMIC_RELAXED);
+
+    if (maps_snapshot.maps && counted && maps_snapshot.load_counter == load &&
+        maps_snapshot.unload_counter == unload && maps_snapshot.generation == generation)
+        return maps_snapshot.maps;
+
+    if (maps_snapshot.maps) lsplt_free_maps(maps_snapshot.maps);
+
+    maps_snapshot.maps = lsplt_scan_maps("self");
+    maps_snapshot.load_counter = load;
+    maps_snapshot.unload_counter = unload;
+    maps_snapshot.generation = generation;
+
+    if (!maps_snapshot.maps) {
+        LOGE("Failed to scan maps for self");
+
+        pthread_mutex_unlock(&maps_snapshot_lock);
+
+        return nullptr;
+    }
+
+    return maps_snapshot.maps;
+}
+
+void release_maps() {
+    pthread_mutex_unlock(&maps_snapshot_lock);
+}
+
+/* INFO: For the changes to the mappings the linker counters miss */
+void invalidate_maps() {
+    __atomic_add_fetch(&maps_generation, 1, __ATOMIC_RELAXED);
+}
+
+void free_maps_snapshot() {
+    pthread_mutex_lock(&maps_snapshot_lock);
+
+    if (maps_snapshot.maps) lsplt_free_maps(maps_snapshot.maps);
+    maps_snapshot.maps = nullptr;
+
+    pthread_mutex_unlock(&maps_snapshot_lock);
+}
+
+/* INFO: Commits the registered PLT hooks against the shared snapshot, rather
+           than having LSPlt scan the maps once more. */
+bool commit_plt_hooks() {
+    struct lsplt_map_info *map_infos = acquire_maps();
+
+    bool res = false;
+    if (map_infos) {
+        res = lsplt_commit_hook_manual(map_infos);
+        release_maps();
+    } else {
+        res = lsplt_commit_hook();
+    }
+
+    invalidate_maps();
+
+    return res;
+}
+
 } // namespace
 
 namespace {
@@ -144,39 +300,34 @@ DCL_HOOK_FUNC(int, fork) {
     return (g_ctx && g_ctx->pid >= 0) ? g_ctx->pid : old_fork();
 }
 
-bool update_mnt_ns(enum mount_namespace_state mns_state, bool dry_run) {
-    char ns_path[PATH_MAX];
-    if (rezygiskd_update_mns(mns_state, ns_path, sizeof(ns_path)) == false) {
-        PLOGE("Failed to update mount namespace");
-
-        return false;
-    }
-
-    if (dry_run) return true;
+bool switch_mnt_ns(int ns_fd, enum mount_namespace_state mns_state) {
+    const char *mns_state_str = NULL;
+    if (mns_state == Clean) mns_state_str = "clean";
+    else if (mns_state == Mounted) mns_state_str = "mounted";
+    else mns_state_str = "unknown";
 
-    int updated_ns = open(ns_path, O_RDONLY);
-    if (updated_ns == -1) {
-        PLOGE("Failed to open mount namespace [%s]", ns_path);
+    LOGD("set mount namespace to fd=[%d]: %s", ns_fd, mns_state_str);
+    if (setns(ns_fd, CLONE_NEWNS) == -1) {
+        PLOGE("Failed to set mount namespace fd=[%d]", ns_fd);
 
         return false;
     }
 
-    const char *mns_state_str = NULL;
-    if (mns_state == Clean) mns_state_str = "clean";
-    else if (mns_state == Mounted) mns_state_str = "mounted";
-    else mns_state_str = "unknown";
+    return true;
+}
 
-    LOGD("set mount namespace to [%s] fd=[%d]: %s", ns_path, updated_ns, mns_state_str);
-    if (setns(updated_ns, CLONE_NEWNS) == -1) {
-        PLOGE("Failed to set mount namespace [%s]", ns_path);
-        close(updated_ns);
+bool update_mnt_ns(enum mount_namespace_state mns_state, bool dry_run) {
+    int ns_fd = rezygiskd_update_mns(mns_state);
+    if (ns_fd == -1) {
+        PLOGE("Failed to update mount namespace");
 
         return false;
     }
 
-    close(updated_ns);
+    bool res = dry_run || switch_mnt_ns(ns_fd, mns_state);
+    close(ns_fd);
 
-    return true;
+    return res;
 }
 struct FileDescriptorInfo {
     const int fd;
@@ -189,6 +340,52 @@ struct FileDescriptorInfo {
     const bool is_sock;
 };
 
+static uint64_t reopen_cache_key(const char *path, bool clean_ns) {
+    /* INFO: FNV-1a */
+    uint64_t key = 14695981039346656037ULL;
+    for (const char *ptr = path; *ptr != '\0'; ptr++) {
+        key ^= (uint8_t)*ptr;
+        key *= 1099511628211ULL;
+    }
+
+    key ^= (((uint64_t)mount_changes << 1) | clean_ns) * 0x9E3779B97F4A7C15ULL;
+    key &= ~3ULL;
+
+    /* INFO: 0 marks the empty slots */
+    return key == 0 ? 4 : key;
+}
+
+static int reopen_cache_lookup(uint64_t key) {
+    for (size_t i = 0; i < REOPEN_CACHE_PROBES; i++) {
+        uint64_t slot = __atomic_load_n(&reopen_cache->slots[((key >> 2) + i) & (REOPEN_CACHE_SIZE - 1)], __ATOMIC_RELAXED);
+        if (slot == 0) return 0;
+        if ((slot & ~3ULL) == key) return (int)(slot & 3);
+    }
+
+    return 0;
+}
+
+static void reopen_cache_store(uint64_t key, int outcome) {
+    for (size_t i = 0; i < REOPEN_CACHE_PROBES; i++) {
+        uint64_t *slot = &reopen_cache->slots[((key >> 2) + i) & (REOPEN_CACHE_SIZE - 1)];
+
+        uint64_t expected = 0;
+        if (__atomic_compare_exchange_n(slot, &expected, key | (uint64_t)outcome, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) return;
+        if ((expected & ~3ULL) == key) return;
+    }
+}
+
+/* INFO: Opens the path the same way zygote will reopen it, as any lighter
+           check, like access, misses SELinux and effective uid denials. */
+static int check_reopen(const char *path, int open_flags) {
+    int new_fd = TEMP_FAILURE_RETRY(open(path, open_flags));
+    if (new_fd == -1) return REOPEN_FAILED;
+
+    close(new_fd);
+
+    return REOPEN_OK;
+}
+
 /* INFO: This hook avoids that umounted overlays made by root modules lead to Zygote
            to Abort its operation as it cannot open anymore.
 
@@ -203,7 +400,9 @@ DCL_HOOK_FUNC(void, _ZNK18FileDescriptorInfo14ReopenOrDetachERKNSt3__18functionI
     const int open_flags = *(const int *)((uintptr_t)_this + offsetof(FileDescriptorInfo, open_flags));
     const bool is_sock = *(const bool *)((uintptr_t)_this + offsetof(FileDescriptorInfo, is_sock));
 
-    int new_fd;
+    bool cacheable;
+    uint64_t key;
+    int outcome;
 
     if (is_sock)
         goto bypass_fd_check;
@@ -211,9 +410,25 @@ DCL_HOOK_FUNC(void, _ZNK18FileDescriptorInfo14ReopenOrDetachERKNSt3__18functionI
     if (strncmp(file_path->c_str(), "/memfd:/boot-image-methods.art", strlen("/memfd:/boot-image-methods.art")) == 0)
         goto bypass_fd_check;
 
-    new_fd = TEMP_FAILURE_RETRY(open(file_path->c_str(), open_flags));
-    close(new_fd);
-    if (new_fd == -1) {
+    /* INFO: Paths only stop being reachable when the mount table changes,
+               so the outcome is reused by the next forks in the same
+               namespace, as long as ReZygiskd watches it for changes. */
+    cacheable = reopen_cache && mount_changes != 0;
+    key = cacheable ? reopen_cache_key(file_path->c_str(), g_ctx && g_ctx->flags[DO_REVERT_UNMOUNT]) : 0;
+    outcome = cacheable ? reopen_cache_lookup(key) : 0;
+
+    if (outcome != 0) {
+        __atomic_add_fetch(&reopen_cache->avoided, 1, __ATOMIC_RELAXED);
+    } else {
+        outcome = check_reopen(file_path->c_str(), open_flags);
+
+        if (cacheable) {
+            __atomic_add_fetch(&reopen_cache->checks, 1, __ATOMIC_RELAXED);
+            reopen_cache_store(key, outcome);
+        }
+    }
+
+    if (outcome == REOPEN_FAILED) {
         LOGD("Failed to open file %s, detaching it", file_path->c_str());
 
         close(fd);
@@ -294,14 +509,80 @@ DCL_HOOK_FUNC(int, property_get, const char *key, char *value, const char *defau
 // -----------------------------------------------------------------
 
 static bool can_hook_jni = false;
-static jint MODIFIER_NATIVE = 0;
-static jmethodID member_getModifiers = nullptr;
 
-void hookJniNativeMethods(JNIEnv *env, const char *clz, JNINativeMethod *methods, int numMethods) {
-    if (!can_hook_jni) return;
-    auto clazz = env->FindClass(clz);
+struct JniHook {
+    string name;
+    string signature;
+    void *fnPtr;
+};
+
+/* INFO: Classes hooked so far, kept for the whole process and inherited by the
+           forks of zygote, as modules mostly hook the same classes. Methods
+           are keyed by name and signature, and are null when they cannot be
+           hooked.
+*/
+struct JniClass {
+    jclass clazz;
+    map<string, lsplant::art::ArtMethod *> methods;
+    /* INFO: Hooks waiting for commit_jni_hooks, by name and signature */
+    map<string, JniHook> pending;
+};
+
+static map<string, JniClass> *jni_classes = nullptr;
+/* INFO: While the modules run their pre specialize, so that each class has
+           all of its hooks registered at once. */
+static bool jni_batching = false;
+
+static JniClass *find_jni_class(JNIEnv *env, const char *clz) {
+    if (!jni_classes) jni_classes = new map<string, JniClass>();
+
+    auto it = jni_classes->find(clz);
+    if (it != jni_classes->end()) return &it->second;
+
+    jclass clazz = env->FindClass(clz);
     if (clazz == nullptr) {
         env->ExceptionClear();
+
+        return nullptr;
+    }
+
+    jclass global = static_cast<jclass>(env->NewGlobalRef(clazz));
+    env->DeleteLocalRef(clazz);
+
+    return &jni_classes->emplace(clz, JniClass{global, {}, {}}).first->second;
+}
+
+static lsplant::art::ArtMethod *find_jni_method(JNIEnv *env, JniClass *jni_class, const JNINativeMethod &nm, const string &key) {
+    auto it = jni_class->methods.find(key);
+    if (it != jni_class->methods.end()) return it->second;
+
+    auto mid = env->GetMethodID(jni_class->clazz, nm.name, nm.signature);
+    bool is_static = false;
+    if (mid == nullptr) {
+        env->ExceptionClear();
+        mid = env->GetStaticMethodID(jni_class->clazz, nm.name, nm.signature);
+        is_static = true;
+    }
+
+    lsplant::art::ArtMethod *art_method = nullptr;
+    if (mid == nullptr) {
+        env->ExceptionClear();
+    } else {
+        auto method = lsplant::JNI_ToReflectedMethod(env, jni_class->clazz, mid, is_static);
+        art_method = lsplant::art::ArtMethod::FromReflectedMethod(env, method);
+
+        if (art_method && !art_method->IsNative()) art_method = nullptr;
+    }
+
+    jni_class->methods.emplace(key, art_method);
+
+    return art_method;
+}
+
+void hookJniNativeMethods(JNIEnv *env, const char *clz, JNINativeMethod *methods, int numMethods) {
+    if (!can_hook_jni) return;
+    JniClass *jni_class = find_jni_class(env, clz);
+    if (jni_class == nullptr) {
         for (int i = 0; i < numMethods; i++) {
             methods[i].fnPtr = nullptr;
         }
@@ -311,33 +592,59 @@ void hookJniNativeMethods(JNIEnv *env, const char *clz, JNINativeMethod *methods
     vector<JNINativeMethod> hooks;
     for (int i = 0; i < numMethods; i++) {
         auto &nm = methods[i];
-        auto mid = env->GetMethodID(clazz, nm.name, nm.signature);
-        bool is_static = false;
-        if (mid == nullptr) {
-            env->ExceptionClear();
-            mid = env->GetStaticMethodID(clazz, nm.name, nm.signature);
-            is_static = true;
-        }
-        if (mid == nullptr) {
-            env->ExceptionClear();
-            nm.fnPtr = nullptr;
-            continue;
-        }
-        auto method = lsplant::JNI_ToReflectedMethod(env, clazz, mid, is_static);
-        auto modifier = lsplant::JNI_CallIntMethod(env, method, member_getModifiers);
-        if ((modifier & MODIFIER_NATIVE) == 0) {
+        string key = string(nm.name) + nm.signature;
+
+        auto artMethod = find_jni_method(env, jni_class, nm, key);
+        if (artMethod == nullptr) {
             nm.fnPtr = nullptr;
             continue;
         }
-        auto artMethod = lsplant::art::ArtMethod::FromReflectedMethod(env, method);
-        hooks.push_back(nm);
-        auto orig = artMethod->GetData();
+
+        /* INFO: A hook not registered yet is the one being replaced */
+        auto pending = jni_class->pending.find(key);
+        void *orig = pending != jni_class->pending.end() ? pending->second.fnPtr : artMethod->GetData();
+
+        if (jni_batching) jni_class->pending[key] = JniHook{nm.name, nm.signature, nm.fnPtr};
+        else hooks.push_back(nm);
+
         LOGV("replaced %s %s orig %p", clz, nm.name, orig);
         nm.fnPtr = orig;
     }
 
     if (hooks.empty()) return;
-    env->RegisterNatives(clazz, hooks.data(), hooks.size());
+    env->RegisterNatives(jni_class->clazz, hooks.data(), hooks.size());
+}
+
+static void commit_jni_hooks(JNIEnv *env) {
+    jni_batching = false;
+    if (!jni_classes) return;
+
+    for (auto &[clz, jni_class] : *jni_classes) {
+        if (jni_class.pending.empty()) continue;
+
+        vector<JNINativeMethod> hooks;
+        for (const auto &[key, hook] : jni_class.pending) {
+            hooks.push_back({hook.name.c_str(), hook.signature.c_str(), hook.fnPtr});
+        }
+
+        if (env->RegisterNatives(jni_class.clazz, hooks.data(), static_cast<jint>(hooks.size())) != 0) {
+            LOGE("Failed to register JNI hooks of class [%s]", clz.c_str());
+            env->ExceptionClear();
+        }
+
+        jni_class.pending.clear();
+    }
+}
+
+static void free_jni_classes(JNIEnv *env) {
+    if (!jni_classes) return;
+
+    for (auto &[clz, jni_class] : *jni_classes) {
+        env->DeleteGlobalRef(jni_class.clazz);
+    }
+
+    delete jni_classes;
+    jni_classes = nullptr;
 }
 
 // JNI method hook definitions, auto generated
@@ -347,12 +654,8 @@ void initialize_jni_hook() {
     auto get_created_java_vms = reinterpret_cast<jint (*)(JavaVM **, jsize, jsize *)>(
             dlsym(RTLD_DEFAULT, "JNI_GetCreatedJavaVMs"));
     if (!get_created_java_vms) {
-        struct lsplt_map_info *map_infos = lsplt_scan_maps("self");
-        if (!map_infos) {
-            LOGE("Failed to scan maps for self");
-
-            return;
-        }
+        struct lsplt_map_info *map_infos = acquire_maps();
+        if (!map_infos) return;
 
         for (size_t i = 0; i < map_infos->length; i++) {
             struct lsplt_map_entry map = map_infos->maps[i];
@@ -368,7 +671,7 @@ void initialize_jni_hook() {
             break;
         }
 
-        lsplt_free_maps(map_infos);
+        release_maps();
 
         if (!get_created_java_vms) {
             LOGW("JNI_GetCreatedJavaVMs not found");
@@ -383,14 +686,6 @@ void initialize_jni_hook() {
     res = vm->GetEnv(reinterpret_cast<void **>(&env), JNI_VERSION_1_6);
     if (res != JNI_OK || env == nullptr) return;
 
-    auto classMember = lsplant::JNI_FindClass(env, "java/lang/reflect/Member");
-    if (classMember != nullptr) member_getModifiers = lsplant::JNI_GetMethodID(env, classMember, "getModifiers", "()I");
-    auto classModifier = lsplant::JNI_FindClass(env, "java/lang/reflect/Modifier");
-    if (classModifier != nullptr) {
-        auto fieldId = lsplant::JNI_GetStaticFieldID(env, classModifier, "NATIVE", "I");
-        if (fieldId != nullptr) MODIFIER_NATIVE = lsplant::JNI_GetStaticIntField(env, classModifier, fieldId);
-    }
-    if (member_getModifiers == nullptr || MODIFIER_NATIVE == 0) return;
     if (!lsplant::art::ArtMethod::Init(env)) {
         LOGE("failed to init ArtMethod");
         return;
@@ -402,8 +697,8 @@ void initialize_jni_hook() {
 
 // -----------------------------------------------------------------
 
-ZygiskModule::ZygiskModule(int id, void *handle, void *entry)
-: id(id), handle(handle), entry{entry}, api{}, mod{nullptr} {
+ZygiskModule::ZygiskModule(int id, void *handle, void *entry, bool preloaded)
+: id(id), preloaded(preloaded), handle(handle), entry{entry}, api{}, mod{nullptr} {
     // Make sure all pointers are null
     memset(&api, 0, sizeof(api));
     api.base.impl = this;
@@ -440,7 +735,7 @@ bool ZygiskModule::RegisterModuleImpl(ApiTable *api, long *module) {
         api->v2.getFlags = [](auto) { return ZygiskModule::getFlags(); };
     }
     if (api_version >= 4) {
-        api->v4.pltHookCommit = []() { return lsplt_commit_hook(); };
+        api->v4.pltHookCommit = []() { return commit_plt_hooks(); };
         api->v4.pltHookRegister = [](dev_t dev, ino_t inode, const char *symbol, void *fn, void **backup) {
             if (dev == 0 || inode == 0 || symbol == nullptr || fn == nullptr)
                 return;
@@ -452,24 +747,44 @@ bool ZygiskModule::RegisterModuleImpl(ApiTable *api, long *module) {
     return true;
 }
 
-void ZygiskContext::plt_hook_register(const char *regex, const char *symbol, void *fn, void **backup) {
-    if (regex == nullptr || symbol == nullptr || fn == nullptr)
-        return;
+/* INFO: Must be called with hook_info_lock held */
+ZygiskContext::PltPattern *ZygiskContext::plt_hook_pattern(const char *regex) {
+    auto it = plt_patterns.find(regex);
+    if (it != plt_patterns.end())
+        return &it->second;
+
     regex_t re;
     if (regcomp(&re, regex, REG_NOSUB) != 0)
+        return nullptr;
+
+    return &plt_patterns.emplace(regex, PltPattern{re, {}}).first->second;
+}
+
+static bool plt_pattern_matches(ZygiskContext::PltPattern *pattern, const char *path) {
+    auto it = pattern->matches.find(string_view(path));
+    if (it != pattern->matches.end())
+        return it->second;
+
+    bool matched = regexec(&pattern->regex, path, 0, nullptr, 0) == 0;
+    pattern->matches.emplace(path, matched);
+
+    return matched;
+}
+
+void ZygiskContext::plt_hook_register(const char *regex, const char *symbol, void *fn, void **backup) {
+    if (regex == nullptr || symbol == nullptr || fn == nullptr)
         return;
     pthread_mutex_lock(&hook_info_lock);
-    register_info.emplace_back(RegisterInfo{re, symbol, fn, backup});
+    if (PltPattern *pattern = plt_hook_pattern(regex))
+        register_info.emplace_back(RegisterInfo{pattern, symbol, fn, backup});
     pthread_mutex_unlock(&hook_info_lock);
 }
 
 void ZygiskContext::plt_hook_exclude(const char *regex, const char *symbol) {
     if (!regex) return;
-    regex_t re;
-    if (regcomp(&re, regex, REG_NOSUB) != 0)
-        return;
     pthread_mutex_lock(&hook_info_lock);
-    ignore_info.emplace_back(IgnoreInfo{re, symbol ?: ""});
+    if (PltPattern *pattern = plt_hook_pattern(regex))
+        ignore_info.emplace_back(IgnoreInfo{pattern, symbol ?: ""});
     pthread_mutex_unlock(&hook_info_lock);
 }
 
@@ -477,25 +792,28 @@ void ZygiskContext::plt_hook_process_regex() {
     if (register_info.empty())
         return;
 
-    struct lsplt_map_info *map_infos = lsplt_scan_maps("self");
-    if (!map_infos) {
-        LOGE("Failed to scan maps for self");
+    struct lsplt_map_info *map_infos = acquire_maps();
+    if (!map_infos) return;
 
-        return;
-    }
+    /* INFO: Hooks are registered per object, which may be mapped many times.
+               Mappings without an inode all share inode 0 whatever they are,
+               so they are never merged. */
+    set<pair<dev_t, ino_t>> objects;
 
     for (size_t i = 0; i < map_infos->length; i++) {
         struct lsplt_map_entry map = map_infos->maps[i];
 
         if (map.offset != 0 || !map.is_private || !(map.perms & PROT_READ)) continue;
+        if (map.inode != 0 && !objects.emplace(map.dev, map.inode).second) continue;
+
         for (auto &reg: register_info) {
-            if (regexec(&reg.regex, map.path, 0, nullptr, 0) != 0)
+            if (!plt_pattern_matches(reg.pattern, map.path))
                 continue;
             bool ignored = false;
             for (auto &ign: ignore_info) {
-                if (regexec(&ign.regex, map.path, 0, nullptr, 0) != 0)
+                if (!ign.symbol.empty() && ign.symbol != reg.symbol)
                     continue;
-                if (ign.symbol.empty() || ign.symbol == reg.symbol) {
+                if (plt_pattern_matches(ign.pattern, map.path)) {
                     ignored = true;
                     break;
                 }
@@ -506,7 +824,7 @@ void ZygiskContext::plt_hook_process_regex() {
         }
     }
 
-    lsplt_free_maps(map_infos);
+    release_maps();
 }
 
 bool ZygiskContext::plt_hook_commit() {
@@ -518,7 +836,7 @@ bool ZygiskContext::plt_hook_commit() {
         pthread_mutex_unlock(&hook_info_lock);
     }
 
-    return lsplt_commit_hook();
+    return commit_plt_hooks();
 }
 
 
@@ -555,6 +873,8 @@ void ZygiskModule::setOption(zygisk::Option opt) {
         g_ctx->flags[DO_REVERT_UNMOUNT] = true;
         break;
     case zygisk::DLCLOSE_MODULE_LIBRARY:
+        /* INFO: Preloaded modules are unmapped instead, once they ran */
+        if (preloaded) LOGW("Preloaded module %d asked to be closed, it will be unmapped", id);
         unload = true;
         break;
     }
@@ -583,29 +903,31 @@ void ZygiskContext::fork_pre() {
         return;
 
     /* INFO: Record all open fds */
-    DIR *dir = opendir("/proc/self/fd");
-    if (dir == nullptr) {
-        PLOGE("Failed to open /proc/self/fd");
+    allowed_fds.reserve(1024);
 
-        return;
-    }
+    auto record_fd = [](int fd, void *data) {
+        static_cast<ZygiskContext *>(data)->allow_fd(fd);
+    };
 
-    struct dirent *entry;
-    while ((entry = readdir(dir))) {
-        int fd = parse_int(entry->d_name);
-        if (fd < 0 || fd >= MAX_FD_SIZE) {
-            close(fd);
+    if (!for_each_open_fd(record_fd, this))
+        PLOGE("Failed to read /proc/self/fd");
+}
 
-            continue;
-        }
+void ZygiskContext::allow_fd(int fd) {
+    if (fd < 0) return;
 
-        allowed_fds[fd] = true;
-    }
+    if (static_cast<size_t>(fd) >= allowed_fds.size())
+        allowed_fds.resize(static_cast<size_t>(fd) + 1, false);
 
-    /* INFO: The dirfd should not be allowed */
-    allowed_fds[dirfd(dir)] = false;
+    allowed_fds[static_cast<size_t>(fd)] = true;
+}
 
-    closedir(dir);
+#ifndef __NR_close_range
+#define __NR_close_range 436
+#endif
+
+static int close_fd_range(unsigned int first, unsigned int last) {
+    return static_cast<int>(syscall(__NR_close_range, first, last, 0));
 }
 
 void ZygiskContext::sanitize_fds() {
@@ -623,9 +945,7 @@ void ZygiskContext::sanitize_fds() {
 
             env->SetIntArrayRegion(array, off, static_cast<int>(exempted_fds.size()), exempted_fds.data());
             for (int fd : exempted_fds) {
-                if (fd >= 0 && fd < MAX_FD_SIZE) {
-                    allowed_fds[fd] = true;
-                }
+                allow_fd(fd);
             }
             *args.app->fds_to_ignore = array;
             flags[SKIP_FD_SANITIZATION] = true;
@@ -636,10 +956,7 @@ void ZygiskContext::sanitize_fds() {
             int *arr = env->GetIntArrayElements(fdsToIgnore, nullptr);
             int len = env->GetArrayLength(fdsToIgnore);
             for (int i = 0; i < len; ++i) {
-                int fd = arr[i];
-                if (fd >= 0 && fd < MAX_FD_SIZE) {
-                    allowed_fds[fd] = true;
-                }
+                allow_fd(arr[i]);
             }
             if (jintArray newFdList = update_fd_array(len)) {
                 env->SetIntArrayRegion(newFdList, 0, len, arr);
@@ -653,26 +970,43 @@ void ZygiskContext::sanitize_fds() {
     if (pid != 0)
         return;
 
-    // Close all forbidden fds to prevent crashing
-    DIR *dir = opendir("/proc/self/fd");
-    if (dir == nullptr) {
-        PLOGE("Failed to open /proc/self/fd");
+    /* INFO: Close all forbidden fds to prevent crashing. Each gap between the
+               allowed fds is closed at once with close_range, which does not
+               need to know which fds in it are open.
+    */
+    size_t size = allowed_fds.size();
+    size_t first = 0;
+    for (size_t fd = 0; fd <= size; fd++) {
+        if (fd < size && !allowed_fds[fd]) continue;
 
-        return;
+        int res = 0;
+        if (fd == size) res = close_fd_range(static_cast<unsigned int>(first), ~0U);
+        else if (fd > first) res = close_fd_range(static_cast<unsigned int>(first), static_cast<unsigned int>(fd - 1));
+
+        if (res == -1) break;
+
+        first = fd + 1;
     }
 
-    int dfd = dirfd(dir);
-    struct dirent *entry;
-    while ((entry = readdir(dir))) {
-        int fd = parse_int(entry->d_name);
-        if (fd < 0 || fd > MAX_FD_SIZE || fd == dfd || allowed_fds[fd]) continue;
+    if (first > size) return;
+
+    /* INFO: close_range is only available since Linux 5.9, so older kernels
+               have the leaked fds looked up and closed one by one.
+    */
+    if (errno != ENOSYS)
+        PLOGE("Failed to close fds from %zu", first);
+
+    auto close_leaked_fd = [](int fd, void *data) {
+        const vector<bool> &allowed = *static_cast<const vector<bool> *>(data);
+        if (static_cast<size_t>(fd) < allowed.size() && allowed[static_cast<size_t>(fd)]) return;
 
         close(fd);
 
         LOGW("Closed leaked fd: %d", fd);
-    }
+    };
 
-    closedir(dir);
+    if (!for_each_open_fd(close_leaked_fd, &allowed_fds))
+        PLOGE("Failed to read /proc/self/fd");
 }
 
 void ZygiskContext::fork_post() {
@@ -681,77 +1015,186 @@ void ZygiskContext::fork_post() {
     g_ctx = nullptr;
 }
 
-bool ZygiskContext::load_modules_only() {
-  struct zygisk_modules ms;
-  if (rezygiskd_read_modules(&ms) == false) {
-    LOGE("Failed to read modules from zygiskd");
+static void *load_module(const char *lib_path, int lib_fd, void **entry) {
+  /* INFO: The library is already opened by ReZygiskd, so there is no need
+             to look it up in /data/adb again, which may also be unmounted
+             for this process already. */
+  const android_dlextinfo info = {
+    .flags = ANDROID_DLEXT_USE_LIBRARY_FD,
+    .library_fd = lib_fd
+  };
 
-    return false;
+  void *handle = android_dlopen_ext(lib_path, RTLD_NOW, &info);
+  if (!handle) {
+    LOGE("Failed to load module [%s]: %s", lib_path, dlerror());
+
+    return NULL;
+  }
+
+  *entry = dlsym(handle, "zygisk_module_entry");
+  if (!*entry) {
+    LOGE("Failed to find entry point in module [%s]: %s", lib_path, dlerror());
+
+    dlclose(handle);
+
+    return NULL;
   }
 
-  for (size_t i = 0; i < ms.modules_count; i++) {
-    char *lib_path = ms.modules[i];
+  return handle;
+}
+
+/* INFO: Preloaded modules can't be dlclosed, yet they must not stay visible
+           in the maps of processes that asked them to be closed. Their
+           segments are unmapped instead, which is only safe as long as
+           nothing zygote set up still points into them. */
+static void unmap_preloaded_module(size_t id) {
+  if (!preloaded_modules) return;
 
-    void *handle = dlopen(lib_path, RTLD_NOW);
-    if (!handle) {
-      LOGE("Failed to load module [%s]: %s", lib_path, dlerror());
+  for (auto &m : *preloaded_modules) {
+    if (m.id != id || m.segments.empty()) continue;
 
-      continue;
+    for (const auto &[start, size] : m.segments) {
+      if (munmap((void *)start, size) == -1) PLOGE("Failed to unmap preloaded module [%s]", m.lib_path.c_str());
     }
 
-    void *entry = dlsym(handle, "zygisk_module_entry");
-    if (!entry) {
-      LOGE("Failed to find entry point in module [%s]: %s", lib_path, dlerror());
+    LOGD("Unmapped preloaded module [%s]", m.lib_path.c_str());
+
+    m.segments.clear();
+
+    /* INFO: The maps snapshot still has its segments */
+    invalidate_maps();
+  }
+}
+
+static const PreloadedModule *find_preloaded_module(size_t id, const char *lib_path) {
+  if (!preloaded_modules) return nullptr;
+
+  for (const auto &m : *preloaded_modules) {
+    if (m.id == id && m.lib_path == lib_path) return &m;
+  }
+
+  return nullptr;
+}
+
+void ZygiskContext::load_modules_only(const struct zygisk_modules *ms) {
+  for (size_t i = 0; i < ms->modules_count; i++) {
+    char *lib_path = ms->modules[i];
+
+    if (ms->preload[i]) {
+      const PreloadedModule *preloaded = find_preloaded_module(i, lib_path);
+      if (preloaded) {
+        modules.emplace_back(i, preloaded->handle, preloaded->entry, true);
 
-      dlclose(handle);
+        continue;
+      }
 
-      continue;
+      /* INFO: Preloading failed in zygote, it is still loaded in this process */
+      LOGD("Module [%s] was not preloaded, loading it now", lib_path);
     }
 
+    void *entry = NULL;
+    void *handle = load_module(lib_path, ms->lib_fds[i], &entry);
+    if (!handle) continue;
+
     modules.emplace_back(i, handle, entry);
   }
+}
 
-  free_modules(&ms);
+static void unmap_policy_table() {
+  if (!policy_table) return;
 
-  return true;
+  mount_changes = __atomic_load_n(&policy_table->mount_changes, __ATOMIC_ACQUIRE);
+
+  munmap((void *)policy_table, sizeof(struct policy_table));
+  policy_table = nullptr;
+}
+
+/* INFO: Only zygote keeps it mapped, as the app must not be able to change
+           what zygote's next forks will detach. */
+static void unmap_reopen_cache() {
+  if (!reopen_cache) return;
+
+  LOGD("Reopen checks: %u made, %u avoided", __atomic_load_n(&reopen_cache->checks, __ATOMIC_RELAXED),
+       __atomic_load_n(&reopen_cache->avoided, __ATOMIC_RELAXED));
+
+  munmap(reopen_cache, sizeof(struct reopen_cache));
+  reopen_cache = nullptr;
+}
+
+void ZygiskContext::load_preloaded_modules_only() {
+  if (!preloaded_modules) return;
+
+  for (const auto &m : *preloaded_modules) {
+    modules.emplace_back(m.id, m.handle, m.entry, true);
+  }
+}
+
+/* INFO: Processes that won't run a preloaded module, like the manager, or
+           when it was disabled since zygote started, must not keep it mapped. */
+void ZygiskContext::unmap_unused_preloaded_modules() {
+  if (!preloaded_modules) return;
+
+  for (const auto &preloaded : *preloaded_modules) {
+    bool used = false;
+    for (const auto &m : modules) {
+      if (m.isPreloaded() && (size_t)m.getId() == preloaded.id) used = true;
+    }
+
+    if (!used) unmap_preloaded_module(preloaded.id);
+  }
 }
 
 /* Zygisksu changed: Load module fds */
 void ZygiskContext::run_modules_pre() {
+  jni_batching = true;
+
   for (auto &m : modules) {
     m.onLoad(env);
 
     if (flags[APP_SPECIALIZE]) m.preAppSpecialize(args.app);
     else if (flags[SERVER_FORK_AND_SPECIALIZE]) m.preServerSpecialize(args.server);
   }
+
+  commit_jni_hooks(env);
 }
 
 void ZygiskContext::run_modules_post() {
     flags[POST_SPECIALIZE] = true;
 
+    /* INFO: Preloaded modules were already handled in zygote */
+    size_t modules_loaded = 0;
     size_t modules_unloaded = 0;
     for (const auto &m : modules) {
         if (flags[APP_SPECIALIZE]) m.postAppSpecialize(args.app);
         else if (flags[SERVER_FORK_AND_SPECIALIZE]) m.postServerSpecialize(args.server);
 
+        if (m.isPreloaded()) {
+            if (m.shouldUnload()) unmap_preloaded_module((size_t)m.getId());
+
+            continue;
+        }
+
+        modules_loaded++;
         if (m.tryUnload()) modules_unloaded++;
     }
 
-    if (modules.size() > 0) {
-        LOGD("modules unloaded: %zu/%zu", modules_unloaded, modules.size());
+    if (modules_loaded > 0) {
+        LOGD("modules unloaded: %zu/%zu", modules_unloaded, modules_loaded);
 
         /* INFO: While Variable Length Arrays (VLAs) aren't usually
                    recommended due to the ease of using too much of the
                    stack, this should be fine since it should not be
                    possible to exhaust the stack with only a few addresses. */
-        void *module_addrs[modules.size() * sizeof(void *)];
+        void *module_addrs[modules_loaded * sizeof(void *)];
 
         size_t i = 0;
         for (const auto &m : modules) {
+            if (m.isPreloaded()) continue;
+
             module_addrs[i++] = m.getEntry();
         }
 
-        clean_trace("/data/adb", module_addrs, modules.size(), modules.size(), modules_unloaded);
+        clean_trace("/data/adb", module_addrs, modules_loaded, modules_loaded, modules_unloaded);
     }
 }
 
@@ -800,16 +1243,41 @@ void ZygiskContext::app_specialize_pre() {
         env->ReleaseStringUTFChars(args.app->app_data_dir, data_dir);
     }
 
-    info_flags = rezygiskd_get_process_flags(uid, (const char *const)process);
-     if (info_flags & PROCESS_IS_FIRST_STARTED) {
-        /* INFO: To ensure we are really using a clean mount namespace, we use
-                   the first process it as reference for clean mount namespace,
-                   before it even does something, so that it will be clean yet
-                   with expected mounts.
-        */
-        update_mnt_ns(Clean, true);
+    /* INFO: The flags, the modules and the clean mount namespace are all
+               received from ReZygiskd in a single request, as each connection
+               adds up in the time to fork every app.
+
+             To ensure we are really using a clean mount namespace, ReZygiskd
+               uses the mount namespace of zygote, the parent of the first
+               process, as reference for the clean mount namespace. Zygote never
+               specializes, so that it will be clean yet with expected mounts.
+    */
+    struct specialize_bundle bundle = {};
+    bundle.mns_fd = -1;
+
+    /* INFO: Once ReZygiskd computed the flags of a process, they are read from
+               the policy table it shares, without connecting to it. The bundle
+               is then only needed for modules that were not preloaded, or for
+               the clean mount namespace.
+    */
+    uint32_t cached_flags = 0;
+    bool from_table = policy_table && policy_table_lookup(policy_table, uid, process, &cached_flags) &&
+                      ((cached_flags & PROCESS_IS_MANAGER) == PROCESS_IS_MANAGER ||
+                       (all_modules_preloaded && (cached_flags & PROCESS_ON_DENYLIST) == 0));
+
+    /* INFO: Only zygote keeps it mapped, so that it does not show in the app's maps */
+    unmap_policy_table();
+
+    if (from_table) {
+        bundle.flags = cached_flags;
+    } else if (!rezygiskd_get_specialize_bundle(uid, (const char *const)process, false, &bundle)) {
+        LOGE("Failed to get specialize bundle from zygiskd");
+
+        return;
     }
 
+    info_flags = bundle.flags;
+
     if ((info_flags & PROCESS_IS_MANAGER) == PROCESS_IS_MANAGER) {
         LOGD("Manager process detected. Notifying that Zygisk has been enabled.");
 
@@ -823,15 +1291,17 @@ void ZygiskContext::app_specialize_pre() {
                    if Zygisk is enabled.
         */
         setenv("ZYGISK_ENABLED", "1", 1);
+
+        unmap_unused_preloaded_modules();
     } else {
-        /* INFO: Because we load directly from the file, we need to do it before we umount
-                   the mounts, or else it won't have access to /data/adb anymore.
+        /* INFO: The modules are loaded from the fds sent by ReZygiskd, so that it works
+                   regardless of the mount namespace. They are still loaded before it is
+                   switched, so that modules' constructors see the same environment.
         */
-        if (!load_modules_only()) {
-            LOGE("Failed to load modules");
+        if (from_table) load_preloaded_modules_only();
+        else load_modules_only(&bundle.modules);
 
-            return;
-        }
+        unmap_unused_preloaded_modules();
 
         /* INFO: Modules only have two "start off" points from Zygisk, preSpecialize and
                    postSpecialize. In preSpecialize, the process still has privileged 
@@ -850,7 +1320,8 @@ void ZygiskContext::app_specialize_pre() {
         if (in_denylist) {
             flags[DO_REVERT_UNMOUNT] = true;
 
-            update_mnt_ns(Clean, false);
+            if (bundle.mns_fd != -1) switch_mnt_ns(bundle.mns_fd, Clean);
+            else update_mnt_ns(Clean, false);
         }
 
         /* INFO: Executed after setns to ensure a module can update the mounts of an 
@@ -869,6 +1340,8 @@ void ZygiskContext::app_specialize_pre() {
         if (!in_denylist && flags[DO_REVERT_UNMOUNT])
             update_mnt_ns(Clean, false);
     }
+
+    free_specialize_bundle(&bundle);
 }
 
 
@@ -913,7 +1386,17 @@ void ZygiskContext::nativeForkSystemServer_pre() {
     if (!is_child())
       return;
 
-    load_modules_only();
+    unmap_policy_table();
+
+    struct specialize_bundle bundle;
+    if (rezygiskd_get_specialize_bundle((uid_t)args.server->uid, "system_server", true, &bundle)) {
+        load_modules_only(&bundle.modules);
+        unmap_unused_preloaded_modules();
+        free_specialize_bundle(&bundle);
+    } else {
+        LOGE("Failed to get specialize bundle from zygiskd");
+    }
+
     run_modules_pre();
     rezygiskd_system_server_started();
 
@@ -956,9 +1439,15 @@ ZygiskContext::~ZygiskContext() {
     // This also disables most plt hooked functions.
     g_ctx = nullptr;
 
+    for (auto &[regex, pattern] : plt_patterns) {
+        regfree(&pattern.regex);
+    }
+
     if (!is_child())
         return;
 
+    unmap_reopen_cache();
+
     should_unmap_zygisk = true;
 
     // Unhook JNI methods
@@ -973,6 +1462,8 @@ ZygiskContext::~ZygiskContext() {
     delete jni_hook_list;
     jni_hook_list = nullptr;
 
+    free_jni_classes(env);
+
     // Strip out all API function pointers
     for (auto &m : modules) {
         m.clearApi();
@@ -984,7 +1475,10 @@ ZygiskContext::~ZygiskContext() {
 } // namespace
 
 static bool hook_commit(struct lsplt_map_info *map_infos) {
-    if (map_infos ? lsplt_commit_hook_manual(map_infos) : lsplt_commit_hook()) {
+    bool res = map_infos ? lsplt_commit_hook_manual(map_infos) : lsplt_commit_hook();
+    invalidate_maps();
+
+    if (res) {
         return true;
     } else {
         LOGE("plt_hook failed");
@@ -1010,7 +1504,12 @@ static void hook_register(dev_t dev, ino_t inode, const char *symbol, void *new_
 void clean_trace(const char *path, void **module_addrs, size_t module_addrs_length, size_t load, size_t unload) {
     LOGD("cleaning trace for path %s", path);
 
-    if (load > 0 || unload > 0) solist_reset_counters(load, unload);
+    if (load > 0 || unload > 0) {
+        solist_reset_counters(load, unload);
+
+        /* INFO: The counters may now be back to those of the snapshot */
+        invalidate_maps();
+    }
 
     LOGD("Dropping solist record for %s", path);
 
@@ -1029,12 +1528,8 @@ void hook_functions() {
     ino_t android_runtime_inode = 0;
     dev_t android_runtime_dev = 0;
 
-    struct lsplt_map_info *map_infos = lsplt_scan_maps("self");
-    if (!map_infos) {
-        LOGE("Failed to scan maps for self");
-
-        return;
-    }
+    struct lsplt_map_info *map_infos = acquire_maps();
+    if (!map_infos) return;
 
     for (size_t i = 0; i < map_infos->length; i++) {
         struct lsplt_map_entry map = map_infos->maps[i];
@@ -1055,7 +1550,7 @@ void hook_functions() {
     PLT_HOOK_REGISTER(android_runtime_dev, android_runtime_inode, _ZNK18FileDescriptorInfo14ReopenOrDetachERKNSt3__18functionIFvNS0_12basic_stringIcNS0_11char_traitsIcEENS0_9allocatorIcEEEEEEE);
     hook_commit(map_infos);
 
-    lsplt_free_maps(map_infos);
+    release_maps();
 
     // Remove unhooked methods
     plt_hook_list->erase(
@@ -1064,6 +1559,98 @@ void hook_functions() {
             plt_hook_list->end());
 }
 
+static int find_module_segments(struct dl_phdr_info *info, size_t size, void *data) {
+    (void)size;
+
+    PreloadedModule *m = (PreloadedModule *)data;
+    uintptr_t entry = (uintptr_t)m->entry;
+
+    bool contains_entry = false;
+    for (ElfW(Half) i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+        if (phdr->p_type != PT_LOAD) continue;
+
+        uintptr_t start = info->dlpi_addr + phdr->p_vaddr;
+        if (entry >= start && entry < start + phdr->p_memsz) contains_entry = true;
+    }
+
+    if (!contains_entry) return 0;
+
+    uintptr_t page_size = (uintptr_t)sysconf(_SC_PAGESIZE);
+    for (ElfW(Half) i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+        if (phdr->p_type != PT_LOAD) continue;
+
+        uintptr_t start = (info->dlpi_addr + phdr->p_vaddr) & ~(page_size - 1);
+        uintptr_t end = (info->dlpi_addr + phdr->p_vaddr + phdr->p_memsz + page_size - 1) & ~(page_size - 1);
+
+        m->segments.emplace_back(start, end - start);
+    }
+
+    return 1;
+}
+
+void preload_modules() {
+    struct zygisk_modules ms;
+    if (!rezygiskd_read_modules(&ms)) {
+        LOGE("Failed to read modules from zygiskd");
+
+        return;
+    }
+
+    preloaded_modules = new vector<PreloadedModule>();
+
+    for (size_t i = 0; i < ms.modules_count; i++) {
+        if (!ms.preload[i]) continue;
+
+        void *entry = NULL;
+        void *handle = load_module(ms.modules[i], ms.lib_fds[i], &entry);
+        if (!handle) continue;
+
+        LOGD("Preloaded module [%s]", ms.modules[i]);
+
+        PreloadedModule module = { i, ms.modules[i], handle, entry, {} };
+
+        /* INFO: Must be found before its solist record is dropped below */
+        if (dl_iterate_phdr(find_module_segments, &module) == 0)
+            LOGW("Failed to find segments of preloaded module [%s], it can't be unmapped", ms.modules[i]);
+
+        preloaded_modules->push_back(std::move(module));
+    }
+
+    all_modules_preloaded = preloaded_modules->size() == ms.modules_count;
+
+    free_modules(&ms);
+
+    if (preloaded_modules->empty()) return;
+
+    /* INFO: Hidden right away, as they will stay loaded in zygote and all of
+               its forks, which then only call their entries. */
+    void *module_addrs[preloaded_modules->size()];
+
+    size_t i = 0;
+    for (const auto &m : *preloaded_modules) {
+        module_addrs[i++] = m.entry;
+    }
+
+    clean_trace("/data/adb", module_addrs, i, i, 0);
+}
+
+void map_policy_table() {
+    policy_table = rezygiskd_map_policy_table();
+}
+
+void map_reopen_cache() {
+    void *cache = mmap(nullptr, sizeof(struct reopen_cache), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (cache == MAP_FAILED) {
+        PLOGE("Failed to map reopen cache");
+
+        return;
+    }
+
+    reopen_cache = static_cast<struct reopen_cache *>(cache);
+}
+
 static void hook_unloader() {
     if (hooked_unloader) return;
     hooked_unloader = true;
@@ -1071,12 +1658,8 @@ static void hook_unloader() {
     ino_t art_inode = 0;
     dev_t art_dev = 0;
 
-    struct lsplt_map_info *map_infos = lsplt_scan_maps("self");
-    if (!map_infos) {
-        LOGE("Failed to scan maps for self");
-
-        return;
-    }
+    struct lsplt_map_info *map_infos = acquire_maps();
+    if (!map_infos) return;
 
     for (size_t i = 0; i < map_infos->length; i++) {
         struct lsplt_map_entry map = map_infos->maps[i];
@@ -1108,7 +1691,7 @@ static void hook_unloader() {
         hook_commit(map_infos);
     }
 
-    lsplt_free_maps(map_infos);
+    release_maps();
 }
 
 static void unhook_functions() {
@@ -1123,4 +1706,6 @@ static void unhook_functions() {
         LOGE("Failed to restore plt_hook");
         should_unmap_zygisk = false;
     }
+
+    free_maps_snapshot();
 }
@@ -2,6 +2,12 @@
 
 namespace {
 
+struct JniHookVariant {
+    int min_sdk;
+    int max_sdk;
+    const char *vendor;
+};
+
 void *nativeForkAndSpecialize_orig = nullptr;
 [[clang::no_stack_protector]] jint nativeForkAndSpecialize_l(JNIEnv *env, jclass clazz, jint uid, jint gid, jintArray gids, jint runtime_flags, jobjectArray rlimits, jint mount_external, jstring se_info, jstring nice_name, jintArray fds_to_close, jstring instruction_set, jstring app_data_dir) {
     AppSpecializeArgs_v5 args(uid, gid, gids, runtime_flags, rlimits, mount_external, se_info, nice_name, instruction_set, app_data_dir);
@@ -202,6 +208,19 @@ std::array nativeForkAndSpecialize_methods = {
         (void *) &nativeForkAndSpecialize_grapheneos_u
     },
 };
+std::array nativeForkAndSpecialize_variants = {
+    JniHookVariant { 21, 25, nullptr },
+    JniHookVariant { 26, 27, nullptr },
+    JniHookVariant { 28, 29, nullptr },
+    JniHookVariant { 29, 29, nullptr },
+    JniHookVariant { 30, 33, nullptr },
+    JniHookVariant { 34, 0, nullptr },
+    JniHookVariant { 23, 23, "samsung" },
+    JniHookVariant { 24, 25, "samsung" },
+    JniHookVariant { 26, 27, "samsung" },
+    JniHookVariant { 28, 29, "samsung" },
+    JniHookVariant { 0, 0, nullptr },
+};
 
 void *nativeSpecializeAppProcess_orig = nullptr;
 [[clang::no_stack_protector]] void nativeSpecializeAppProcess_q(JNIEnv *env, jclass clazz, jint uid, jint gid, jintArray gids, jint runtime_flags, jobjectArray rlimits, jint mount_external, jstring se_info, jstring nice_name, jboolean is_child_zygote, jstring instruction_set, jstring app_data_dir) {
@@ -314,6 +333,14 @@ std::array nativeSpecializeAppProcess_methods = {
         (void *) &nativeSpecializeAppProcess_grapheneos_u
     },
 };
+std::array nativeSpecializeAppProcess_variants = {
+    JniHookVariant { 29, 29, nullptr },
+    JniHookVariant { 29, 29, nullptr },
+    JniHookVariant { 30, 33, nullptr },
+    JniHookVariant { 34, 0, nullptr },
+    JniHookVariant { 29, 29, "samsung" },
+    JniHookVariant { 0, 0, nullptr },
+};
 
 void *nativeForkSystemServer_orig = nullptr;
 [[clang::no_stack_protector]] jint nativeForkSystemServer_l(JNIEnv *env, jclass clazz, jint uid, jint gid, jintArray gids, jint runtime_flags, jobjectArray rlimits, jlong permitted_capabilities, jlong effective_capabilities) {
@@ -363,36 +390,78 @@ std::array nativeForkSystemServer_methods = {
         (void *) &nativeForkSystemServer_grapheneos_u
     },
 };
+std::array nativeForkSystemServer_variants = {
+    JniHookVariant { 21, 0, nullptr },
+    JniHookVariant { 29, 0, "samsung" },
+    JniHookVariant { 0, 0, nullptr },
+};
 
 } // namespace
 
-static void do_hook_zygote(JNIEnv *env) {
-    vector<JNINativeMethod> hooks;
-    const char *clz;
-    clz = "com/android/internal/os/Zygote";
-    hookJniNativeMethods(env, clz, nativeForkAndSpecialize_methods.data(), nativeForkAndSpecialize_methods.size());
-    for (auto &method : nativeForkAndSpecialize_methods) {
-        if (method.fnPtr) {
-            nativeForkAndSpecialize_orig = method.fnPtr;
-            hooks.emplace_back(method);
-            break;
+/* INFO: Hooks the variant of a Zygote method this device is expected to have,
+           vendor specific ones first, before probing all of them. Every failed
+           probe throws and clears a Java exception during zygote boot.
+*/
+template <size_t N>
+static void hook_zygote_method(JNIEnv *env, const char *clz, std::array<JNINativeMethod, N> &methods,
+                               const std::array<JniHookVariant, N> &variants, int sdk, const char *vendor,
+                               void *&orig, vector<JNINativeMethod> &hooks) {
+    vector<JNINativeMethod> likely;
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t i = 0; i < N; i++) {
+            const auto &variant = variants[i];
+            if (variant.min_sdk == 0 || sdk < variant.min_sdk) continue;
+            if (variant.max_sdk != 0 && sdk > variant.max_sdk) continue;
+
+            bool vendor_specific = variant.vendor != nullptr;
+            if (vendor_specific != (pass == 0)) continue;
+            if (vendor_specific && strcmp(variant.vendor, vendor) != 0) continue;
+
+            likely.emplace_back(methods[i]);
         }
     }
-    hookJniNativeMethods(env, clz, nativeSpecializeAppProcess_methods.data(), nativeSpecializeAppProcess_methods.size());
-    for (auto &method : nativeSpecializeAppProcess_methods) {
-        if (method.fnPtr) {
-            nativeSpecializeAppProcess_orig = method.fnPtr;
-            hooks.emplace_back(method);
-            break;
+
+    if (!likely.empty()) {
+        hookJniNativeMethods(env, clz, likely.data(), static_cast<int>(likely.size()));
+        for (auto &method : likely) {
+            if (method.fnPtr) {
+                orig = method.fnPtr;
+                hooks.emplace_back(method);
+                return;
+            }
         }
+
+        LOGV("no expected variant of %s for sdk %d [%s], probing all", methods[0].name, sdk, vendor);
     }
-    hookJniNativeMethods(env, clz, nativeForkSystemServer_methods.data(), nativeForkSystemServer_methods.size());
-    for (auto &method : nativeForkSystemServer_methods) {
+
+    hookJniNativeMethods(env, clz, methods.data(), static_cast<int>(N));
+    for (auto &method : methods) {
         if (method.fnPtr) {
-            nativeForkSystemServer_orig = method.fnPtr;
+            orig = method.fnPtr;
             hooks.emplace_back(method);
             break;
         }
     }
+}
+
+static void do_hook_zygote(JNIEnv *env) {
+    vector<JNINativeMethod> hooks;
+    const char *clz;
+    clz = "com/android/internal/os/Zygote";
+
+    char prop[PROP_VALUE_MAX] = { 0 };
+    __system_property_get("ro.build.version.sdk", prop);
+    int sdk = atoi(prop);
+
+    char vendor[PROP_VALUE_MAX] = { 0 };
+    __system_property_get("ro.product.manufacturer", vendor);
+    for (char *c = vendor; *c; c++) *c = static_cast<char>(tolower(*c));
+
+    hook_zygote_method(env, clz, nativeForkAndSpecialize_methods, nativeForkAndSpecialize_variants,
+                       sdk, vendor, nativeForkAndSpecialize_orig, hooks);
+    hook_zygote_method(env, clz, nativeSpecializeAppProcess_methods, nativeSpecializeAppProcess_variants,
+                       sdk, vendor, nativeSpecializeAppProcess_orig, hooks);
+    hook_zygote_method(env, clz, nativeForkSystemServer_methods, nativeForkSystemServer_variants,
+                       sdk, vendor, nativeForkSystemServer_orig, hooks);
     jni_hook_list->emplace(clz, std::move(hooks));
 }
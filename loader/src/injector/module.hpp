@@ -210,17 +210,22 @@ case 5:                                \
         int getModuleDir() const;
         void setOption(zygisk::Option opt);
         static uint32_t getFlags();
-        bool tryUnload() const { return unload && dlclose(handle) == 0; };
+        /* INFO: Preloaded modules are dropped from the solist in zygote, so
+                   they can't be closed anymore, and are unmapped instead. */
+        bool tryUnload() const { return unload && !preloaded && dlclose(handle) == 0; };
+        bool shouldUnload() const { return unload; }
         void clearApi() { memset(&api, 0, sizeof(api)); }
         int getId() const { return id; }
         void *getEntry() const { return entry.ptr; }
+        bool isPreloaded() const { return preloaded; }
 
-        ZygiskModule(int id, void *handle, void *entry);
+        ZygiskModule(int id, void *handle, void *entry, bool preloaded = false);
 
         static bool RegisterModuleImpl(ApiTable *api, long *module);
 
     private:
         const int id;
+        const bool preloaded;
         bool unload = false;
 
         void * const handle;
@@ -1,11 +1,16 @@
 #include <stdio.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <errno.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <sys/system_properties.h>
 
 #include <android/dlext.h>
 
 #include <linux/limits.h>
 
+#include "daemon.h"
 #include "elf_util.h"
 #include "logging.h"
 
@@ -56,16 +61,120 @@ static void pdg_protect() {
 }
 
 static SoInfo *somain = NULL;
+static SoInfo **somain_sym = NULL;
 
 static size_t *g_module_load_counter = NULL;
 static size_t *g_module_unload_counter = NULL;
 
-static bool solist_init() {
-  #ifdef __LP64__
-    ElfImg *linker = ElfImg_create("/system/bin/linker64", NULL);
-  #else
-    ElfImg *linker = ElfImg_create("/system/bin/linker", NULL);
-  #endif
+#ifdef __LP64__
+  #define LINKER_PATH "/system/bin/linker64"
+#else
+  #define LINKER_PATH "/system/bin/linker"
+#endif
+
+/* INFO: Everything solist_init resolves, as offsets from the linker base, so
+           that later zygote starts do not have to parse the linker again.
+           Kept by ReZygiskd, and only valid for the same linker file and
+           build, which the fields before somain identify. */
+#define LINKER_CACHE_VERSION 1
+
+struct linker_cache {
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t dev;
+  uint64_t ino;
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+  char fingerprint[PROP_VALUE_MAX];
+
+  uint64_t somain;
+  uint64_t get_realpath;
+  uint64_t soinfo_free;
+  uint64_t find_containing_library;
+  uint64_t pdg_ctor;
+  uint64_t pdg_dtor;
+  /* INFO: 0 when the linker does not have them */
+  uint64_t load_counter;
+  uint64_t unload_counter;
+  uint64_t solist_size_offset;
+};
+
+static bool linker_cache_key(struct linker_cache *cache) {
+  memset(cache, 0, sizeof(*cache));
+
+  struct stat st;
+  if (stat(LINKER_PATH, &st) == -1) {
+    PLOGE("stat %s", LINKER_PATH);
+
+    return false;
+  }
+
+  cache->version = LINKER_CACHE_VERSION;
+  cache->dev = (uint64_t)st.st_dev;
+  cache->ino = (uint64_t)st.st_ino;
+  cache->mtime_sec = (int64_t)st.st_mtim.tv_sec;
+  cache->mtime_nsec = (int64_t)st.st_mtim.tv_nsec;
+
+  if (__system_property_get("ro.build.fingerprint", cache->fingerprint) <= 0) {
+    LOGD("No build fingerprint, not caching linker offsets");
+
+    return false;
+  }
+
+  return true;
+}
+
+/* INFO: The same base ElfImg_create finds */
+static uintptr_t linker_base() {
+  ElfImg img = {
+    .elf = (char *)LINKER_PATH,
+    .base = NULL
+  };
+
+  dl_iterate_phdr(dl_cb, &img);
+
+  return (uintptr_t)img.base;
+}
+
+static bool linker_cache_load(const struct linker_cache *cache, uintptr_t base) {
+  if (cache->somain == 0 || cache->get_realpath == 0 || cache->soinfo_free == 0 ||
+      cache->find_containing_library == 0 || cache->pdg_ctor == 0 || cache->pdg_dtor == 0)
+    return false;
+
+  somain_sym = (SoInfo **)(base + (uintptr_t)cache->somain);
+  if (*somain_sym == NULL) return false;
+
+  somain = *somain_sym;
+  get_realpath_sym = (const char *(*)(SoInfo *))(base + (uintptr_t)cache->get_realpath);
+  soinfo_free = (void (*)(SoInfo *))(base + (uintptr_t)cache->soinfo_free);
+  find_containing_library = (SoInfo *(*)(const void *))(base + (uintptr_t)cache->find_containing_library);
+  ppdg.ctor = (void *(*)())(base + (uintptr_t)cache->pdg_ctor);
+  ppdg.dtor = (void *(*)())(base + (uintptr_t)cache->pdg_dtor);
+
+  if (cache->load_counter != 0) g_module_load_counter = (size_t *)(base + (uintptr_t)cache->load_counter);
+  if (cache->unload_counter != 0) g_module_unload_counter = (size_t *)(base + (uintptr_t)cache->unload_counter);
+
+  solist_size_offset = (size_t)cache->solist_size_offset;
+
+  return true;
+}
+
+static void linker_cache_store(struct linker_cache *cache, uintptr_t base) {
+  cache->somain = (uintptr_t)somain_sym - base;
+  cache->get_realpath = (uintptr_t)get_realpath_sym - base;
+  cache->soinfo_free = (uintptr_t)soinfo_free - base;
+  cache->find_containing_library = (uintptr_t)find_containing_library - base;
+  cache->pdg_ctor = (uintptr_t)ppdg.ctor - base;
+  cache->pdg_dtor = (uintptr_t)ppdg.dtor - base;
+  cache->load_counter = g_module_load_counter ? (uintptr_t)g_module_load_counter - base : 0;
+  cache->unload_counter = g_module_unload_counter ? (uintptr_t)g_module_unload_counter - base : 0;
+  cache->solist_size_offset = solist_size_offset;
+
+  rezygiskd_put_linker_cache(cache, sizeof(*cache));
+}
+
+static bool solist_resolve() {
+  ElfImg *linker = ElfImg_create(LINKER_PATH, NULL);
   if (linker == NULL) {
     LOGE("Failed to load linker");
 
@@ -87,7 +196,8 @@ static bool solist_init() {
 
       See #63 for more information.
   */
-  somain = (SoInfo *)getSymbValueByPrefix(linker, "__dl__ZL6somain");
+  somain_sym = (SoInfo **)getSymbAddressByPrefix(linker, "__dl__ZL6somain");
+  somain = somain_sym ? *somain_sym : NULL;
   if (somain == NULL) {
     LOGE("Failed to find somain __dl__ZL6somain*");
 
@@ -152,15 +262,56 @@ static bool solist_init() {
   return true;
 }
 
-/* INFO: find_containing_library returns the SoInfo for the library that contains
-           that memory inside its limits, hence why named "lib_memory" in ReZygisk. */
-bool solist_drop_so_path(void *lib_memory) {
-  if (somain == NULL && !solist_init()) {
-    LOGE("Failed to initialize solist");
+static bool solist_init() {
+  uintptr_t base = linker_base();
+  if (base == 0) {
+    LOGE("Failed to find linker base");
 
     return false;
   }
 
+  struct linker_cache key;
+  bool cacheable = linker_cache_key(&key);
+
+  struct linker_cache cache;
+  if (cacheable && rezygiskd_get_linker_cache(&cache, sizeof(cache)) &&
+      memcmp(&cache, &key, offsetof(struct linker_cache, somain)) == 0) {
+    if (linker_cache_load(&cache, base)) {
+      LOGD("Using cached linker offsets, %p is somain", (void *)somain);
+
+      return true;
+    }
+
+    LOGW("Cached linker offsets are invalid, resolving them again");
+  }
+
+  if (!solist_resolve()) return false;
+
+  if (cacheable) linker_cache_store(&key, base);
+
+  return true;
+}
+
+/* INFO: Only attempted once, as every attempt asks ReZygiskd and may parse
+           the whole linker, while some callers run often, like acquire_maps. */
+static bool solist_ready() {
+  static bool tried = false;
+  static bool ready = false;
+
+  if (tried) return ready;
+
+  tried = true;
+  ready = solist_init();
+  if (!ready) LOGE("Failed to initialize solist");
+
+  return ready;
+}
+
+/* INFO: find_containing_library returns the SoInfo for the library that contains
+           that memory inside its limits, hence why named "lib_memory" in ReZygisk. */
+bool solist_drop_so_path(void *lib_memory) {
+  if (!solist_ready()) return false;
+
   SoInfo *found = (*find_containing_library)(lib_memory);
   if (found == NULL) {
     LOGD("Could not find containing library for %p", lib_memory);
@@ -193,12 +344,19 @@ bool solist_drop_so_path(void *lib_memory) {
   return true;
 }
 
-void solist_reset_counters(size_t load, size_t unload) {
-  if (somain == NULL && !solist_init()) {
-    LOGE("Failed to initialize solist");
+bool solist_get_counters(size_t *load, size_t *unload) {
+  if (!solist_ready()) return false;
 
-    return;
-  }
+  if (g_module_load_counter == NULL || g_module_unload_counter == NULL) return false;
+
+  *load = *g_module_load_counter;
+  *unload = *g_module_unload_counter;
+
+  return true;
+}
+
+void solist_reset_counters(size_t load, size_t unload) {
+  if (!solist_ready()) return;
 
   if (g_module_load_counter == NULL || g_module_unload_counter == NULL) {
     LOGD("g_module counters not defined, skip reseting them");
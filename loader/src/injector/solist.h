@@ -58,6 +58,13 @@ bool solist_drop_so_path(void *lib_memory);
 */
 void solist_reset_counters(size_t load, size_t unload);
 
+/*
+  INFO: Reads the same counters, which change whenever the linker loads or
+          unloads a library, and therefore whenever its mappings do. Fails if
+          they could not be found.
+*/
+bool solist_get_counters(size_t *load, size_t *unload);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -7,6 +7,12 @@ extern size_t block_size;
 
 void hook_functions();
 
+void preload_modules();
+
+void map_policy_table();
+
+void map_reopen_cache();
+
 void clean_trace(const char *path, void **module_addrs, size_t module_addrs_length, size_t load, size_t unload);
 
 extern "C" void send_seccomp_event();
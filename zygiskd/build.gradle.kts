@@ -29,7 +29,7 @@ val commitHash: String by rootProject.extra
 val CStandardFlags = arrayOf(
   "-D_GNU_SOURCE", "-std=c99", "-Wpedantic", "-Wall", "-Wextra", "-Werror",
   "-Wformat", "-Wuninitialized", "-Wshadow", "-Wno-zero-length-array",
-  "-Wconversion", "-Wno-fixed-enum-extension", "-Iroot_impl", "-llog",
+  "-Wconversion", "-Iroot_impl", "-llog",
   "-DMIN_APATCH_VERSION=$minAPatchVersion",
   "-DMIN_KSU_VERSION=$minKsuVersion",
   "-DMAX_KSU_VERSION=$maxKsuVersion",
@@ -52,13 +52,29 @@ val Files = arrayOf(
   "root_impl/magisk.c",
   "companion.c",
   "main.c",
+  "spawn.c",
   "utils.c",
+  "workers.c",
   "zygiskd.c"
 )
 
+task("hostTest") {
+  group = "verification"
+  description = "Run the host tests of the daemon sources."
+
+  /* INFO: They build against the libc and SQLite of a Linux host */
+  onlyIf { OperatingSystem.current().isLinux() }
+  doLast {
+    exec {
+      commandLine("sh", Paths.get(project.projectDir.toString(), "tests", "magisk", "run.sh").toString())
+    }
+  }
+}
+
 task("buildAndStrip") {
   group = "build"
   description = "Build the native library and strip the debug symbols."
+  dependsOn("hostTest")
 
   val isDebug = gradle.startParameter.taskNames.any { it.lowercase().contains("debug") }
   doLast {
@@ -85,17 +85,29 @@ void *entry_thread(void *arg) {
 void companion_entry(int fd) {
   LOGI("New companion entry.\n - Client fd: %d\n", fd);
 
+  struct message msg;
+  if (!message_recv(fd, &msg)) {
+    LOGE("Failed to receive module\n");
+
+    message_free(&msg);
+
+    goto cleanup;
+  }
+
   char name[256 + 1];
-  ssize_t ret = read_string(fd, name, sizeof(name));
-  if (ret == -1) {
+  if (!message_get_string(&msg, name, sizeof(name))) {
     LOGE("Failed to read module name\n");
 
+    message_free(&msg);
+
     goto cleanup;
   }
 
   LOGI(" - Module name: \"%s\"\n", name);
 
-  int library_fd = read_fd(fd);
+  int library_fd = message_take_fd(&msg);
+  message_free(&msg);
+
   if (library_fd == -1) {
     LOGE("Failed to receive library fd\n");
 
@@ -107,18 +119,32 @@ void companion_entry(int fd) {
   zygisk_companion_entry module_entry = load_module(library_fd);
   close(library_fd);
 
+  /* INFO: Both replies below are a single byte, which is always the same */
+  struct message reply;
+  message_init(&reply);
+
   if (module_entry == NULL) {
     LOGE(" - No companion module entry for module: %s\n", name);
 
-    ret = write_uint8_t(fd, 0);
-    ASSURE_SIZE_WRITE("ZygiskdCompanion", "module_entry", ret, sizeof(uint8_t));
+    message_put_uint8_t(&reply, 0);
+    if (!message_send(fd, &reply, NULL, 0)) {
+      LOGE("Failed to send module entry status\n");
+    }
+
+    message_free(&reply);
 
     goto cleanup;
   } else {
     LOGI(" - Module entry found\n");
 
-    ret = write_uint8_t(fd, 1);
-    ASSURE_SIZE_WRITE("ZygiskdCompanion", "module_entry", ret, sizeof(uint8_t));
+    message_put_uint8_t(&reply, 1);
+    if (!message_send(fd, &reply, NULL, 0)) {
+      LOGE("Failed to send module entry status\n");
+
+      message_free(&reply);
+
+      goto cleanup;
+    }
   }
 
   struct sigaction sa = { .sa_handler = SIG_IGN };
@@ -131,7 +157,18 @@ void companion_entry(int fd) {
       break;
     }
 
-    int client_fd = read_fd(fd);
+    struct message client_msg;
+    if (!message_recv(fd, &client_msg)) {
+      LOGE("Failed to receive client\n");
+
+      message_free(&client_msg);
+
+      break;
+    }
+
+    int client_fd = message_take_fd(&client_msg);
+    message_free(&client_msg);
+
     if (client_fd == -1) {
       LOGE("Failed to receive client fd\n");
 
@@ -152,8 +189,14 @@ void companion_entry(int fd) {
 
     LOGI("New companion request.\n - Module name: %s\n - Client fd: %d\n", name, client_fd);
 
-    ret = write_uint8_t(client_fd, 1);
-    ASSURE_SIZE_WRITE("ZygiskdCompanion", "client_fd", ret, sizeof(uint8_t));
+    if (!message_send(client_fd, &reply, NULL, 0)) {
+      LOGE("Failed to send companion status to client\n");
+
+      close(client_fd);
+      free(args);
+
+      continue;
+    }
 
     pthread_t thread;
     if (pthread_create(&thread, NULL, entry_thread, (void *)args) == 0)
@@ -167,6 +210,8 @@ void companion_entry(int fd) {
     break;
   }
 
+  message_free(&reply);
+
   cleanup:
     close(fd);
     LOGE("Companion thread exited\n");
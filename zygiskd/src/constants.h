@@ -29,18 +29,22 @@ enum DaemonSocketAction {
   GetModuleDir           = 5,
   ZygoteRestart          = 6,
   SystemServerStarted    = 7,
-  UpdateMountNamespace   = 8
+  UpdateMountNamespace   = 8,
+  GetSpecializeBundle    = 9,
+  GetPolicyTable         = 10,
+  GetLinkerCache         = 11,
+  PutLinkerCache         = 12
 };
 
-enum ProcessFlags: uint32_t {
-  PROCESS_GRANTED_ROOT = (1u << 0),
-  PROCESS_ON_DENYLIST = (1u << 1),
-  PROCESS_IS_MANAGER = (1u << 27),
-  PROCESS_ROOT_IS_APATCH = (1u << 28),
-  PROCESS_ROOT_IS_KSU = (1u << 29),
-  PROCESS_ROOT_IS_MAGISK = (1u << 30),
-  PROCESS_IS_FIRST_STARTED = (1u << 31)
-};
+/* INFO: Macros rather than an enum, as enum constants must fit in an int
+           before C23, which PROCESS_IS_FIRST_STARTED does not. */
+#define PROCESS_GRANTED_ROOT (1u << 0)
+#define PROCESS_ON_DENYLIST (1u << 1)
+#define PROCESS_IS_MANAGER (1u << 27)
+#define PROCESS_ROOT_IS_APATCH (1u << 28)
+#define PROCESS_ROOT_IS_KSU (1u << 29)
+#define PROCESS_ROOT_IS_MAGISK (1u << 30)
+#define PROCESS_IS_FIRST_STARTED (1u << 31)
 
 enum RootImplState {
   Supported,
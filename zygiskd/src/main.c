@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
 
 #include <android/log.h>
 
@@ -28,6 +29,16 @@ int main(int argc, char *argv[]) {
         return 1;
       }
 
+      /* INFO: Detaches from zygiskd, which only waits for this first process */
+      pid_t pid = fork();
+      if (pid == -1) {
+        LOGE("Failed forking companion: %s\n", strerror(errno));
+
+        return 1;
+      }
+
+      if (pid > 0) return 0;
+
       int fd = atoi(argv[2]);
       companion_entry(fd);
 
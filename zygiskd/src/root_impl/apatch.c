@@ -1,15 +1,27 @@
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/inotify.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "../constants.h"
 #include "../utils.h"
+#include "../spawn.h"
 #include "common.h"
 
 #include "apatch.h"
 
+#define PACKAGE_CONFIG_DIR "/data/adb/ap"
+#define PACKAGE_CONFIG_NAME "package_config"
+
+/* INFO: Lets ReZygiskd drop the processes it cached as soon as the
+           package_config is changed, -1 if it could not be watched */
+static int packages_watch = -1;
+
 void apatch_get_existence(struct root_impl_state *state) {
   struct stat s;
   if (stat("/data/adb/apd", &s) != 0) {
@@ -59,8 +71,24 @@ void apatch_get_existence(struct root_impl_state *state) {
   else if (version >= MIN_APATCH_VERSION && version <= 999999) state->state = Supported;
   else if (version >= 1 && version <= MIN_APATCH_VERSION - 1) state->state = TooOld;
   else state->state = Abnormal;
+
+  if (state->state != Supported) return;
+
+  packages_watch = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (packages_watch == -1) {
+    LOGE("Failed to create inotify for APatch's package_config: %s\n", strerror(errno));
+    errno = 0;
+  } else if (inotify_add_watch(packages_watch, PACKAGE_CONFIG_DIR, IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_TO) == -1) {
+    LOGE("Failed to watch APatch's package_config: %s\n", strerror(errno));
+    errno = 0;
+
+    close(packages_watch);
+    packages_watch = -1;
+  }
 }
 
+#define PACKAGE_CONFIG_PATH PACKAGE_CONFIG_DIR "/" PACKAGE_CONFIG_NAME
+
 struct package_config {
   char *process;
   uid_t uid;
@@ -68,143 +96,378 @@ struct package_config {
   bool umount_needed;
 };
 
+/* INFO: package_config is parsed once, in place, into a single buffer, and
+           indexed by UID (open addressing) and by process name (sorted),
+           then kept until the file changes. */
 struct packages_config {
+  bool loaded;
+  struct stat file_stat;
+
+  char *buffer;
   struct package_config *configs;
   size_t size;
+
+  /* INFO: Indexes of configs plus one, 0 meaning an empty slot */
+  size_t *uid_index;
+  size_t uid_index_mask;
+
+  /* INFO: Indexes of configs, sorted by process, then by position */
+  size_t *process_index;
 };
 
-/* WARNING: Dynamic memory based */
-bool _apatch_get_package_config(struct packages_config *restrict config) {
-  config->configs = NULL;
-  config->size = 0;
+static struct packages_config packages = { 0 };
+static uint32_t packages_generation = 0;
+static pthread_mutex_t packages_lock = PTHREAD_MUTEX_INITIALIZER;
 
-  FILE *fp = fopen("/data/adb/ap/package_config", "r");
-  if (fp == NULL) {
+static void _apatch_free_package_config(void) {
+  free(packages.buffer);
+  free(packages.configs);
+  free(packages.uid_index);
+  free(packages.process_index);
+
+  memset(&packages, 0, sizeof(packages));
+}
+
+static char *_apatch_read_package_config(struct stat *restrict file_stat) {
+  int fd = open(PACKAGE_CONFIG_PATH, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
     LOGE("Failed to open APatch's package_config: %s\n", strerror(errno));
 
-    return false;
+    return NULL;
   }
 
-  char line[1048];
-  /* INFO: Skip the CSV header */
-  if (fgets(line, sizeof(line), fp) == NULL) {
-    LOGE("Failed to read APatch's package_config header: %s\n", strerror(errno));
+  if (fstat(fd, file_stat) == -1) {
+    LOGE("Failed to stat APatch's package_config: %s\n", strerror(errno));
+
+    close(fd);
+
+    return NULL;
+  }
+
+  size_t capacity = (size_t)file_stat->st_size + 1;
+  char *buffer = malloc(capacity);
+  if (buffer == NULL) {
+    LOGE("Failed to allocate memory for APatch's package_config: %s\n", strerror(errno));
+
+    close(fd);
+
+    return NULL;
+  }
+
+  /* INFO: The file may grow while being read, so read until EOF */
+  size_t len = 0;
+  while (1) {
+    if (len + 1 == capacity) {
+      char *new_buffer = realloc(buffer, capacity * 2);
+      if (new_buffer == NULL) {
+        LOGE("Failed to allocate memory for APatch's package_config: %s\n", strerror(errno));
+
+        free(buffer);
+        close(fd);
+
+        return NULL;
+      }
+
+      buffer = new_buffer;
+      capacity *= 2;
+    }
+
+    ssize_t ret = read(fd, buffer + len, capacity - len - 1);
+    if (ret == -1 && errno == EINTR) continue;
+    if (ret == -1) {
+      LOGE("Failed to read APatch's package_config: %s\n", strerror(errno));
+
+      free(buffer);
+      close(fd);
+
+      return NULL;
+    }
+
+    if (ret == 0) break;
+
+    len += (size_t)ret;
+  }
+
+  buffer[len] = '\0';
+
+  close(fd);
+
+  return buffer;
+}
 
-    fclose(fp);
+static size_t _apatch_hash_uid(uid_t uid) {
+  /* INFO: Fibonacci hashing, as UIDs of apps are sequential */
+  return (size_t)((uint32_t)uid * 2654435769U);
+}
+
+static int _apatch_cmp_process(const void *a, const void *b) {
+  size_t index_a = *(const size_t *)a;
+  size_t index_b = *(const size_t *)b;
+
+  int cmp = strcmp(packages.configs[index_a].process, packages.configs[index_b].process);
+  if (cmp != 0) return cmp;
+
+  return (index_a > index_b) - (index_a < index_b);
+}
+
+static bool _apatch_build_indexes(void) {
+  size_t uid_index_size = 16;
+  while (uid_index_size < packages.size * 2) uid_index_size *= 2;
+
+  packages.uid_index = calloc(uid_index_size, sizeof(size_t));
+  packages.process_index = malloc((packages.size ? packages.size : 1) * sizeof(size_t));
+  if (packages.uid_index == NULL || packages.process_index == NULL) {
+    LOGE("Failed to allocate memory for APatch's package_config indexes: %s\n", strerror(errno));
 
     return false;
   }
 
-  while (fgets(line, sizeof(line), fp) != NULL) { 
-    config->configs = realloc(config->configs, (config->size + 1) * sizeof(struct package_config));
-    if (config->configs == NULL) {
-      LOGE("Failed to realloc APatch config struct: %s\n", strerror(errno));
+  packages.uid_index_mask = uid_index_size - 1;
+
+  for (size_t i = 0; i < packages.size; i++) {
+    size_t slot = _apatch_hash_uid(packages.configs[i].uid) & packages.uid_index_mask;
 
-      fclose(fp);
+    while (packages.uid_index[slot] != 0) {
+      /* INFO: The first entry of a UID is the one that counts */
+      if (packages.configs[packages.uid_index[slot] - 1].uid == packages.configs[i].uid) break;
 
-      return false;
+      slot = (slot + 1) & packages.uid_index_mask;
     }
 
-    config->configs[config->size].process = strdup(strtok(line, ","));
+    if (packages.uid_index[slot] == 0) packages.uid_index[slot] = i + 1;
 
-    char *exclude_str = strtok(NULL, ",");
+    packages.process_index[i] = i;
+  }
+
+  qsort(packages.process_index, packages.size, sizeof(size_t), _apatch_cmp_process);
+
+  return true;
+}
+
+/* INFO: Must be called with packages_lock held */
+static bool _apatch_load_package_config(void) {
+  struct stat s;
+  if (stat(PACKAGE_CONFIG_PATH, &s) == -1) {
+    LOGE("Failed to stat APatch's package_config: %s\n", strerror(errno));
+    errno = 0;
+
+    _apatch_free_package_config();
+
+    return false;
+  }
+
+  if (packages.loaded && s.st_ino == packages.file_stat.st_ino && s.st_size == packages.file_stat.st_size &&
+      s.st_mtim.tv_sec == packages.file_stat.st_mtim.tv_sec && s.st_mtim.tv_nsec == packages.file_stat.st_mtim.tv_nsec)
+    return true;
+
+  _apatch_free_package_config();
+
+  packages.buffer = _apatch_read_package_config(&packages.file_stat);
+  if (packages.buffer == NULL) {
+    errno = 0;
+
+    return false;
+  }
+
+  size_t lines = 0;
+  for (char *ptr = packages.buffer; *ptr != '\0'; ptr++) {
+    if (*ptr == '\n') lines++;
+  }
+
+  packages.configs = malloc((lines + 1) * sizeof(struct package_config));
+  if (packages.configs == NULL) {
+    LOGE("Failed to allocate memory for APatch config struct: %s\n", strerror(errno));
+    errno = 0;
+
+    _apatch_free_package_config();
+
+    return false;
+  }
+
+  /* INFO: Skip the CSV header */
+  char *line_saveptr = NULL;
+  strtok_r(packages.buffer, "\n", &line_saveptr);
+
+  char *line = NULL;
+  while ((line = strtok_r(NULL, "\n", &line_saveptr)) != NULL) {
+    char *saveptr = NULL;
+
+    char *process = strtok_r(line, ",", &saveptr);
+    if (process == NULL) continue;
+
+    char *exclude_str = strtok_r(NULL, ",", &saveptr);
     if (exclude_str == NULL) continue;
 
-    char *allow_str = strtok(NULL, ",");
+    char *allow_str = strtok_r(NULL, ",", &saveptr);
     if (allow_str == NULL) continue;
 
-    char *uid_str = strtok(NULL, ",");
+    char *uid_str = strtok_r(NULL, ",", &saveptr);
     if (uid_str == NULL) continue;
 
-    config->configs[config->size].uid = (uid_t)atoi(uid_str);
-    config->configs[config->size].root_granted = strcmp(allow_str, "1") == 0;
-    config->configs[config->size].umount_needed = strcmp(exclude_str, "1") == 0;
+    packages.configs[packages.size].process = process;
+    packages.configs[packages.size].uid = (uid_t)atoi(uid_str);
+    packages.configs[packages.size].root_granted = strcmp(allow_str, "1") == 0;
+    packages.configs[packages.size].umount_needed = strcmp(exclude_str, "1") == 0;
 
-    config->size++;
+    packages.size++;
   }
 
-  fclose(fp);
+  if (!_apatch_build_indexes()) {
+    errno = 0;
+
+    _apatch_free_package_config();
+
+    return false;
+  }
+
+  packages.loaded = true;
+  packages_generation++;
 
   return true;
 }
 
-void _apatch_free_package_config(struct packages_config *restrict config) {
-  for (size_t i = 0; i < config->size; i++) {
-    free(config->configs[i].process);
+bool apatch_get_policies_generation(uint32_t *generation) {
+  pthread_mutex_lock(&packages_lock);
+
+  bool loaded = _apatch_load_package_config();
+  *generation = packages_generation;
+
+  pthread_mutex_unlock(&packages_lock);
+
+  return loaded;
+}
+
+int apatch_get_policies_watch(void) {
+  return packages_watch;
+}
+
+/* INFO: Drains the pending events, telling if any was about package_config.
+           It is read again on the next lookup anyway, as its stat changed. */
+bool apatch_policies_changed(void) {
+  if (packages_watch == -1) return false;
+
+  bool changed = false;
+
+  char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  ssize_t len = 0;
+  while ((len = read(packages_watch, buf, sizeof(buf))) > 0) {
+    for (char *ptr = buf; ptr < buf + len; ptr += sizeof(struct inotify_event) + ((struct inotify_event *)ptr)->len) {
+      struct inotify_event *event = (struct inotify_event *)ptr;
+
+      if (event->len != 0 && strcmp(event->name, PACKAGE_CONFIG_NAME) == 0)
+        changed = true;
+    }
   }
 
-  free(config->configs);
+  /* INFO: Events were lost, so it is unknown what changed */
+  if (len == -1 && errno != EAGAIN) changed = true;
+  errno = 0;
+
+  return changed;
 }
 
-bool apatch_uid_granted_root(uid_t uid) {
-  struct packages_config config;
-  if (!_apatch_get_package_config(&config)) {
-    _apatch_free_package_config(&config);
+static struct package_config *_apatch_find_uid(uid_t uid) {
+  size_t slot = _apatch_hash_uid(uid) & packages.uid_index_mask;
 
-    return false;
+  while (packages.uid_index[slot] != 0) {
+    struct package_config *config = &packages.configs[packages.uid_index[slot] - 1];
+    if (config->uid == uid) return config;
+
+    slot = (slot + 1) & packages.uid_index_mask;
+  }
+
+  return NULL;
+}
+
+/* INFO: Finds the first process in process_index which is equal to the first
+           prefix_len characters of process. */
+static size_t _apatch_lower_bound_process(const char *process, size_t prefix_len) {
+  size_t low = 0;
+  size_t high = packages.size;
+
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+    const char *config_process = packages.configs[packages.process_index[mid]].process;
+
+    int cmp = strncmp(config_process, process, prefix_len);
+    if (cmp == 0 && config_process[prefix_len] != '\0') cmp = 1;
+
+    if (cmp < 0) low = mid + 1;
+    else high = mid;
   }
 
-  for (size_t i = 0; i < config.size; i++) {
-    if (config.configs[i].uid != uid) continue;
+  return low;
+}
 
-    /* INFO: This allow us to copy the information to avoid use-after-free */
-    bool root_granted = config.configs[i].root_granted;
+/* INFO: Matches the first config, in file order, where either process is a
+           prefix of the other one. */
+static struct package_config *_apatch_find_process_prefix(const char *process) {
+  size_t process_len = strlen(process);
+  size_t found = SIZE_MAX;
 
-    _apatch_free_package_config(&config);
+  /* INFO: Configs which have process as a prefix are contiguous */
+  for (size_t i = _apatch_lower_bound_process(process, process_len); i < packages.size; i++) {
+    size_t index = packages.process_index[i];
+    if (strncmp(packages.configs[index].process, process, process_len) != 0) break;
 
-    return root_granted;
+    if (index < found) found = index;
   }
 
-  _apatch_free_package_config(&config);
+  /* INFO: Configs which are a prefix of process, shorter than it */
+  for (size_t prefix_len = 0; prefix_len < process_len; prefix_len++) {
+    size_t i = _apatch_lower_bound_process(process, prefix_len);
+    if (i == packages.size) continue;
+
+    size_t index = packages.process_index[i];
+    const char *config_process = packages.configs[index].process;
+    if (strncmp(config_process, process, prefix_len) != 0 || config_process[prefix_len] != '\0') continue;
+
+    if (index < found) found = index;
+  }
 
-  return false;
+  if (found == SIZE_MAX) return NULL;
+
+  return &packages.configs[found];
 }
 
-bool apatch_uid_should_umount(uid_t uid, const char *const process) {
-  struct packages_config config;
-  if (!_apatch_get_package_config(&config)) {
-    _apatch_free_package_config(&config);
+bool apatch_uid_granted_root(uid_t uid) {
+  pthread_mutex_lock(&packages_lock);
 
-    return false;
+  bool root_granted = false;
+  if (_apatch_load_package_config()) {
+    struct package_config *config = _apatch_find_uid(uid);
+    if (config != NULL) root_granted = config->root_granted;
   }
 
-  for (size_t i = 0; i < config.size; i++) {
-    if (config.configs[i].uid != uid) continue;
+  pthread_mutex_unlock(&packages_lock);
 
-    /* INFO: This allow us to copy the information to avoid use-after-free */
-    bool umount_needed = config.configs[i].umount_needed;
+  return root_granted;
+}
+
+bool apatch_uid_should_umount(uid_t uid, const char *const process) {
+  pthread_mutex_lock(&packages_lock);
 
-    _apatch_free_package_config(&config);
+  if (!_apatch_load_package_config()) {
+    pthread_mutex_unlock(&packages_lock);
 
-    return umount_needed;
+    return false;
   }
 
+  struct package_config *config = _apatch_find_uid(uid);
+
   /* INFO: Isolated services have different UIDs than the main app, and
              while libzygisk.so has code to send the UID of the app related
              to the isolated service, we add this so that in case it fails,
              this should avoid it pass through as Mounted.
   */
-  if (IS_ISOLATED_SERVICE(uid)) {
-    size_t targeted_process_length = strlen(process);
-
-    for (size_t i = 0; i < config.size; i++) {
-      size_t config_process_length = strlen(config.configs[i].process);
-      size_t smallest_process_length = targeted_process_length < config_process_length ? targeted_process_length : config_process_length;
-
-      if (strncmp(config.configs[i].process, process, smallest_process_length) != 0) continue;
-
-      /* INFO: This allow us to copy the information to avoid use-after-free */
-      bool umount_needed = config.configs[i].umount_needed;
+  if (config == NULL && IS_ISOLATED_SERVICE(uid))
+    config = _apatch_find_process_prefix(process);
 
-      _apatch_free_package_config(&config);
-
-      return umount_needed;
-    }
-  }
+  bool umount_needed = config != NULL && config->umount_needed;
 
-  _apatch_free_package_config(&config);
+  pthread_mutex_unlock(&packages_lock);
 
-  return false;
+  return umount_needed;
 }
 
 bool apatch_uid_is_manager(uid_t uid) {
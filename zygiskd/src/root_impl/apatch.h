@@ -5,6 +5,12 @@
 
 void apatch_get_existence(struct root_impl_state *state);
 
+bool apatch_get_policies_generation(uint32_t *generation);
+
+int apatch_get_policies_watch(void);
+
+bool apatch_policies_changed(void);
+
 bool apatch_uid_granted_root(uid_t uid);
 
 bool apatch_uid_should_umount(uid_t uid, const char *const process);
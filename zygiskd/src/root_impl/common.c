@@ -1,9 +1,18 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
+#include <inttypes.h>
+#include <time.h>
 
+#include <unistd.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/memfd.h>
 
 #include "../utils.h"
 #include "kernelsu.h"
@@ -14,15 +23,67 @@
 
 static struct root_impl impl;
 
+/* INFO: Bookkeeping of the policy table, kept out of the shared memory */
+struct policy_table_state {
+  size_t len;
+  uint32_t generation;
+  /* INFO: Bumped whenever the table is dropped because the policies changed,
+             so that flags computed before are not stored afterwards. */
+  uint32_t epoch;
+
+  /* INFO: Since ReZygiskd started. Lookups which could not be cached, like
+             all of KernelSU's, are uncached. */
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t uncached;
+};
+
+/* INFO: Lookups between two reports of the counters */
+#define POLICY_STATS_INTERVAL 256
+
+static struct policy_table *policy_table = NULL;
+static struct policy_table_state policy_table_state = { 0 };
+static pthread_mutex_t policy_table_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *_apatch_get_existence_thread(void *arg) {
+  apatch_get_existence((struct root_impl_state *)arg);
+
+  return NULL;
+}
+
+static void *_magisk_get_existence_thread(void *arg) {
+  magisk_get_existence((struct root_impl_state *)arg);
+
+  return NULL;
+}
+
 void root_impls_setup(void) {
-  struct root_impl_state state_ksu;
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  /* INFO: APatch and Magisk are detected by executing their binaries, which
+             is slow enough during boot to be worth doing at the same time. */
+  struct root_impl_state state_apatch = { 0 };
+  pthread_t apatch_thread;
+  bool apatch_threaded = pthread_create(&apatch_thread, NULL, _apatch_get_existence_thread, &state_apatch) == 0;
+  if (!apatch_threaded) apatch_get_existence(&state_apatch);
+
+  struct root_impl_state state_magisk = { 0 };
+  pthread_t magisk_thread;
+  bool magisk_threaded = pthread_create(&magisk_thread, NULL, _magisk_get_existence_thread, &state_magisk) == 0;
+  if (!magisk_threaded) magisk_get_existence(&state_magisk);
+
+  struct root_impl_state state_ksu = { 0 };
   ksu_get_existence(&state_ksu);
 
-  struct root_impl_state state_apatch;
-  apatch_get_existence(&state_apatch);
+  if (apatch_threaded) pthread_join(apatch_thread, NULL);
+  if (magisk_threaded) pthread_join(magisk_thread, NULL);
+
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
 
-  struct root_impl_state state_magisk;
-  magisk_get_existence(&state_magisk);
+  LOGI("Root implementations detected in %.2f ms\n",
+       (double)(end.tv_sec - start.tv_sec) * 1000.0 + (double)(end.tv_nsec - start.tv_nsec) / 1000000.0);
 
   /* INFO: Check if it's only one supported, if not, it's multile and that's bad.
             Remember that true here is equal to the integer 1. */
@@ -128,3 +189,282 @@ bool uid_is_manager(uid_t uid) {
     }
   }
 }
+
+/* INFO: Only implementations which can tell when their policies change are
+           cached. KernelSU's lookups are already single prctl calls, and
+           the kernel gives no way to know when its allowlist changes. */
+static bool _get_policies_generation(uint32_t *generation) {
+  switch (impl.impl) {
+    case APatch: {
+      return apatch_get_policies_generation(generation);
+    }
+    case Magisk: {
+      return magisk_get_policies_generation(generation);
+    }
+    default: {
+      return false;
+    }
+  }
+}
+
+static uint32_t _compute_policy_flags(uid_t uid, const char *const process) {
+  if (uid_is_manager(uid)) return PROCESS_IS_MANAGER;
+
+  uint32_t flags = 0;
+  if (uid_granted_root(uid)) flags |= PROCESS_GRANTED_ROOT;
+  if (uid_should_umount(uid, process)) flags |= PROCESS_ON_DENYLIST;
+
+  return flags;
+}
+
+/* INFO: FNV-1a, the same as libzygisk.so uses to look up the table */
+static uint64_t _hash_process(const char *process) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (const char *ptr = process; *ptr != '\0'; ptr++) {
+    hash ^= (uint8_t)*ptr;
+    hash *= 1099511628211ULL;
+  }
+
+  return hash;
+}
+
+static struct policy_entry *_find_policy_entry(uid_t uid, uint64_t process_hash) {
+  size_t slot = (size_t)(process_hash ^ ((uint32_t)uid * 2654435769U)) & (POLICY_TABLE_SIZE - 1);
+
+  while (policy_table->entries[slot].used && (policy_table->entries[slot].uid != uid || policy_table->entries[slot].process_hash != process_hash)) {
+    slot = (slot + 1) & (POLICY_TABLE_SIZE - 1);
+  }
+
+  return &policy_table->entries[slot];
+}
+
+/* INFO: Writes to the table are enclosed by these, so that libzygisk.so
+           can tell when it read the table while it was being modified. */
+static void _policy_table_write_begin(void) {
+  __atomic_store_n(&policy_table->seq, policy_table->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void _policy_table_write_end(void) {
+  __atomic_store_n(&policy_table->seq, policy_table->seq + 1, __ATOMIC_RELEASE);
+}
+
+static void _clear_policy_table(void) {
+  _policy_table_write_begin();
+  memset(policy_table->entries, 0, sizeof(policy_table->entries));
+  _policy_table_write_end();
+
+  policy_table_state.len = 0;
+}
+
+/* INFO: Must be called with policy_table_lock held */
+static void _log_policy_stats(const char *reason) {
+  LOGI("Policy lookups (%s): %" PRIu64 " hits, %" PRIu64 " misses, %" PRIu64 " uncached\n", reason,
+       policy_table_state.hits, policy_table_state.misses, policy_table_state.uncached);
+}
+
+/* INFO: Must be called with policy_table_lock held */
+static void _count_policy_lookup(uint64_t *counter) {
+  (*counter)++;
+
+  uint64_t lookups = policy_table_state.hits + policy_table_state.misses + policy_table_state.uncached;
+  if (lookups % POLICY_STATS_INTERVAL == 0) _log_policy_stats("periodic");
+}
+
+void policy_table_log_stats(const char *reason) {
+  pthread_mutex_lock(&policy_table_lock);
+  _log_policy_stats(reason);
+  pthread_mutex_unlock(&policy_table_lock);
+}
+
+static void _reset_policy_table(uint32_t generation) {
+  if (policy_table_state.len != 0) {
+    LOGI("Policies changed, dropping %zu cached processes\n", policy_table_state.len);
+    _log_policy_stats("policies changed");
+  }
+
+  _clear_policy_table();
+  policy_table_state.generation = generation;
+}
+
+int policy_table_setup(uint32_t impl_flags) {
+  int fd = (int)syscall(__NR_memfd_create, "rezygisk-policies", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd == -1) {
+    LOGE("Failed to create policy table memfd: %s\n", strerror(errno));
+    errno = 0;
+
+    goto private_table;
+  }
+
+  if (ftruncate(fd, sizeof(struct policy_table)) == -1) {
+    LOGE("Failed to resize policy table memfd: %s\n", strerror(errno));
+    errno = 0;
+
+    close(fd);
+
+    goto private_table;
+  }
+
+  /* INFO: Zygote must not be able to shrink it under our mapping */
+  if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == -1) {
+    LOGE("Failed to seal policy table memfd: %s\n", strerror(errno));
+    errno = 0;
+  }
+
+  void *table = mmap(NULL, sizeof(struct policy_table), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (table == MAP_FAILED) {
+    LOGE("Failed to map policy table memfd: %s\n", strerror(errno));
+    errno = 0;
+
+    close(fd);
+
+    goto private_table;
+  }
+
+  /* INFO: Zygote only receives a read-only fd */
+  char fd_path[32];
+  snprintf(fd_path, sizeof(fd_path), "/proc/self/fd/%d", fd);
+
+  int ro_fd = open(fd_path, O_RDONLY | O_CLOEXEC);
+  if (ro_fd == -1) {
+    LOGE("Failed to reopen policy table memfd read-only: %s\n", strerror(errno));
+    errno = 0;
+  }
+
+  close(fd);
+
+  policy_table = (struct policy_table *)table;
+  policy_table->impl_flags = impl_flags;
+
+  return ro_fd;
+
+  private_table:
+    policy_table = calloc(1, sizeof(struct policy_table));
+    if (policy_table == NULL) {
+      LOGE("Failed to allocate policy table: %s\n", strerror(errno));
+      errno = 0;
+    }
+
+    return -1;
+}
+
+int policy_table_get_watch(void) {
+  switch (impl.impl) {
+    case APatch: {
+      return apatch_get_policies_watch();
+    }
+    case Magisk: {
+      return magisk_get_policies_watch();
+    }
+    default: {
+      return -1;
+    }
+  }
+}
+
+/* INFO: Zygote reads the table without asking ReZygiskd, which then may not
+           receive any request to notice the change, so it is dropped right
+           away instead. */
+void policy_table_on_watch(void) {
+  bool changed = false;
+  switch (impl.impl) {
+    case APatch: {
+      changed = apatch_policies_changed();
+
+      break;
+    }
+    case Magisk: {
+      changed = magisk_policies_changed();
+
+      break;
+    }
+    default: {
+      break;
+    }
+  }
+
+  if (!changed || policy_table == NULL) return;
+
+  pthread_mutex_lock(&policy_table_lock);
+
+  LOGI("Policies changed, dropping %zu cached processes\n", policy_table_state.len);
+  _log_policy_stats("policies changed");
+
+  _clear_policy_table();
+  policy_table_state.epoch++;
+
+  pthread_mutex_unlock(&policy_table_lock);
+}
+
+void policy_table_set_mounts_generation(uint32_t generation) {
+  if (policy_table == NULL) return;
+
+  __atomic_store_n(&policy_table->mounts_generation, generation, __ATOMIC_RELEASE);
+}
+
+void policy_table_set_mount_changes(uint32_t changes) {
+  if (policy_table == NULL) return;
+
+  __atomic_store_n(&policy_table->mount_changes, changes, __ATOMIC_RELEASE);
+}
+
+uint32_t uid_get_policy_flags(uid_t uid, const char *const process) {
+  uint32_t generation = 0;
+  if (policy_table == NULL || !_get_policies_generation(&generation)) {
+    pthread_mutex_lock(&policy_table_lock);
+    _count_policy_lookup(&policy_table_state.uncached);
+    pthread_mutex_unlock(&policy_table_lock);
+
+    return _compute_policy_flags(uid, process);
+  }
+
+  uint64_t process_hash = _hash_process(process);
+
+  pthread_mutex_lock(&policy_table_lock);
+
+  if (generation != policy_table_state.generation) _reset_policy_table(generation);
+
+  struct policy_entry *entry = _find_policy_entry(uid, process_hash);
+  if (entry->used) {
+    _count_policy_lookup(&policy_table_state.hits);
+
+    uint32_t flags = entry->flags;
+
+    pthread_mutex_unlock(&policy_table_lock);
+
+    return flags;
+  }
+
+  _count_policy_lookup(&policy_table_state.misses);
+  uint32_t epoch = policy_table_state.epoch;
+
+  pthread_mutex_unlock(&policy_table_lock);
+
+  /* INFO: Computed unlocked, as the root implementation may be slow to answer */
+  uint32_t flags = _compute_policy_flags(uid, process);
+
+  pthread_mutex_lock(&policy_table_lock);
+
+  /* INFO: Keep at most half of the table used, so that probing stays short */
+  if (policy_table_state.len >= POLICY_TABLE_SIZE / 2) _clear_policy_table();
+
+  if (policy_table_state.generation == generation && policy_table_state.epoch == epoch) {
+    entry = _find_policy_entry(uid, process_hash);
+    if (!entry->used) {
+      _policy_table_write_begin();
+
+      entry->process_hash = process_hash;
+      entry->uid = (uint32_t)uid;
+      entry->flags = flags;
+      entry->used = 1;
+
+      _policy_table_write_end();
+
+      policy_table_state.len++;
+    }
+  }
+
+  pthread_mutex_unlock(&policy_table_lock);
+
+  return flags;
+}
@@ -25,6 +25,31 @@ struct root_impl {
 
 #define LONGEST_ROOT_IMPL_NAME sizeof("Magisk Official")
 
+/* INFO: Must be a power of 2 */
+#define POLICY_TABLE_SIZE 1024
+
+/* INFO: Layout of the policy table, shared with libzygisk.so through a
+           read-only memfd. Must be kept in sync with loader's daemon.h. */
+struct policy_entry {
+  uint64_t process_hash;
+  uint32_t uid;
+  uint32_t flags;
+  uint32_t used;
+  uint32_t reserved;
+};
+
+struct policy_table {
+  /* INFO: Odd while the table is being written */
+  uint32_t seq;
+  uint32_t impl_flags;
+  /* INFO: Changes whenever the mounts of the root implementation do */
+  uint32_t mounts_generation;
+  /* INFO: Changes on every change of the mount table, and is 0 while it is
+             not watched, in which case nothing may be cached from it */
+  uint32_t mount_changes;
+  struct policy_entry entries[POLICY_TABLE_SIZE];
+};
+
 void root_impls_setup(void);
 
 void get_impl(struct root_impl *uimpl);
@@ -35,4 +60,20 @@ bool uid_should_umount(uid_t uid, const char *const process);
 
 bool uid_is_manager(uid_t uid);
 
+int policy_table_setup(uint32_t impl_flags);
+
+/* INFO: Fd readable when the policies may have changed, -1 if there is none */
+int policy_table_get_watch(void);
+
+void policy_table_on_watch(void);
+
+void policy_table_set_mounts_generation(uint32_t generation);
+
+void policy_table_set_mount_changes(uint32_t changes);
+
+uint32_t uid_get_policy_flags(uid_t uid, const char *const process);
+
+/* INFO: Logs the counters of policy lookups, also logged periodically */
+void policy_table_log_stats(const char *reason);
+
 #endif /* COMMON_H */
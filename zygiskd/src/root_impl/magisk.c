@@ -2,14 +2,18 @@
 #include <string.h>
 #include <fcntl.h>
 #include <dirent.h>
+#include <dlfcn.h>
 #include <sys/stat.h>
 #include <sys/prctl.h>
+#include <sys/inotify.h>
 #include <errno.h>
 
 #include <unistd.h>
+#include <pthread.h>
 
 #include "../constants.h"
 #include "../utils.h"
+#include "../spawn.h"
 #include "common.h"
 
 #include "magisk.h"
@@ -28,11 +32,77 @@ char *magisk_managers[] = {
 #define DEBUG_RAMDISK_MAGISK lp_select("/debug_ramdisk/magisk32", "/debug_ramdisk/magisk64")
 #define BITLESS_DEBUG_RAMDISK_MAGISK "/debug_ramdisk/magisk"
 
+#ifndef MAGISK_DB_DIR
+  #define MAGISK_DB_DIR "/data/adb"
+#endif
+#define MAGISK_DB_NAME "magisk.db"
+
+/* INFO: The SQLite of the platform, which Magisk itself uses to access its
+           database. It is not part of the NDK, so it is loaded on demand. */
+#ifndef SQLITE_LIB
+  #define SQLITE_LIB "libsqlite.so"
+#endif
+
+#define SQLITE_OK 0
+#define SQLITE_ROW 100
+#define SQLITE_DONE 101
+#define SQLITE_OPEN_READONLY 0x00000001
+
+struct sqlite_api {
+  int (*open_v2)(const char *filename, void **db, int flags, const char *vfs);
+  int (*close)(void *db);
+  int (*prepare_v2)(void *db, const char *sql, int len, void **stmt, const char **tail);
+  int (*step)(void *stmt);
+  const unsigned char *(*column_text)(void *stmt, int column);
+  int (*finalize)(void *stmt);
+  const char *(*errmsg)(void *db);
+};
+
 static enum magisk_variants variant = MOfficial;
-/* INFO: Longest path */
-static char path_to_magisk[sizeof(DEBUG_RAMDISK_MAGISK)] = { 0 };
+static char path_to_magisk[PATH_MAX] = { 0 };
 bool is_using_sulist = false;
 
+/* INFO: Everything needed to answer the policy lookups, read from Magisk's
+           database with a single query. It is kept until the database
+           changes, which is noticed through inotify, including its journal. */
+struct magisk_policies {
+  bool loaded;
+
+  uid_t *root_uids;
+  size_t root_uids_len;
+
+  /* INFO: From the DenyList, or the SuList when it is enabled */
+  char **processes;
+  size_t processes_len;
+
+  char requester[128];
+
+  bool sulist_enabled;
+};
+
+static struct magisk_policies policies = { 0 };
+static uint32_t policies_generation = 0;
+static pthread_mutex_t policies_lock = PTHREAD_MUTEX_INITIALIZER;
+static int magisk_db_watch = -1;
+
+/* INFO: Only loaded once, and only used with policies_lock held */
+static struct sqlite_api sqlite = { 0 };
+static bool sqlite_tried = false;
+
+static void _magisk_watch_db(void) {
+  magisk_db_watch = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (magisk_db_watch == -1) {
+    LOGE("Failed to create inotify for Magisk database, policies won't be cached: %s\n", strerror(errno));
+    errno = 0;
+  } else if (inotify_add_watch(magisk_db_watch, MAGISK_DB_DIR, IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_TO) == -1) {
+    LOGE("Failed to watch Magisk database, policies won't be cached: %s\n", strerror(errno));
+    errno = 0;
+
+    close(magisk_db_watch);
+    magisk_db_watch = -1;
+  }
+}
+
 void magisk_get_existence(struct root_impl_state *state) {
   const char *magisk_files[] = {
     SBIN_MAGISK,
@@ -62,7 +132,7 @@ void magisk_get_existence(struct root_impl_state *state) {
     return;
   }
 
-  char *argv[4] = { "magisk", "-v", NULL, NULL };
+  char *argv[3] = { "magisk", "-v", NULL };
 
   char magisk_info[128];
   if (!exec_command(magisk_info, sizeof(magisk_info), (const char *)path_to_magisk, argv)) {
@@ -97,86 +167,347 @@ void magisk_get_existence(struct root_impl_state *state) {
     return;
   }
 
+  _magisk_watch_db();
+
+  if (atoi(magisk_version) >= MIN_MAGISK_VERSION) state->state = Supported;
+  else state->state = TooOld;
+}
+
+static int _magisk_cmp_uid(const void *a, const void *b) {
+  uid_t uid_a = *(const uid_t *)a;
+  uid_t uid_b = *(const uid_t *)b;
+
+  return (uid_a > uid_b) - (uid_a < uid_b);
+}
+
+static int _magisk_cmp_process(const void *a, const void *b) {
+  return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+static void _magisk_free_policies(void) {
+  for (size_t i = 0; i < policies.processes_len; i++) {
+    free(policies.processes[i]);
+  }
+
+  free(policies.processes);
+  free(policies.root_uids);
+
+  memset(&policies, 0, sizeof(policies));
+}
+
+/* INFO: Drains the pending events, telling if any was about the database */
+static bool _magisk_db_changed(void) {
+  if (magisk_db_watch == -1) return true;
+
+  bool changed = false;
+
+  char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  ssize_t len = 0;
+  while ((len = read(magisk_db_watch, buf, sizeof(buf))) > 0) {
+    for (char *ptr = buf; ptr < buf + len; ptr += sizeof(struct inotify_event) + ((struct inotify_event *)ptr)->len) {
+      struct inotify_event *event = (struct inotify_event *)ptr;
+
+      /* INFO: Also matches its journal, "magisk.db-journal" or "magisk.db-wal" */
+      if (event->len != 0 && strncmp(event->name, MAGISK_DB_NAME, strlen(MAGISK_DB_NAME)) == 0)
+        changed = true;
+    }
+  }
+
+  /* INFO: Events were lost, so it is unknown what changed */
+  if (len == -1 && errno != EAGAIN) changed = true;
+  errno = 0;
+
+  return changed;
+}
+
+static bool _magisk_add_policy(const char *restrict type, const char *restrict value) {
+  if (strcmp(type, "uid") == 0) {
+    uid_t *root_uids = realloc(policies.root_uids, (policies.root_uids_len + 1) * sizeof(uid_t));
+    if (root_uids == NULL) return false;
+
+    policies.root_uids = root_uids;
+    policies.root_uids[policies.root_uids_len++] = (uid_t)atoi(value);
+  } else if (strcmp(type, "process") == 0) {
+    char **processes = realloc(policies.processes, (policies.processes_len + 1) * sizeof(char *));
+    if (processes == NULL) return false;
+
+    policies.processes = processes;
+    policies.processes[policies.processes_len] = strdup(value);
+    if (policies.processes[policies.processes_len] == NULL) return false;
+
+    policies.processes_len++;
+  } else if (strcmp(type, "requester") == 0) {
+    snprintf(policies.requester, sizeof(policies.requester), "%s", value);
+  } else if (strcmp(type, "sulist") == 0) {
+    policies.sulist_enabled = strcmp(value, "1") == 0;
+  }
+
+  return true;
+}
+
+static bool _magisk_load_sqlite(void) {
+  if (sqlite_tried) return sqlite.open_v2 != NULL;
+  sqlite_tried = true;
+
+  void *handle = dlopen(SQLITE_LIB, RTLD_NOW);
+  if (handle == NULL) {
+    /* INFO: Read once, as it is cleared by reading, and LOGW reads it twice */
+    const char *error = dlerror();
+    LOGW("Failed to load SQLite, Magisk database will be read through magisk: %s\n", error);
+
+    return false;
+  }
+
+  struct sqlite_api api = {
+    .open_v2 = (int (*)(const char *, void **, int, const char *))dlsym(handle, "sqlite3_open_v2"),
+    .close = (int (*)(void *))dlsym(handle, "sqlite3_close"),
+    .prepare_v2 = (int (*)(void *, const char *, int, void **, const char **))dlsym(handle, "sqlite3_prepare_v2"),
+    .step = (int (*)(void *))dlsym(handle, "sqlite3_step"),
+    .column_text = (const unsigned char *(*)(void *, int))dlsym(handle, "sqlite3_column_text"),
+    .finalize = (int (*)(void *))dlsym(handle, "sqlite3_finalize"),
+    .errmsg = (const char *(*)(void *))dlsym(handle, "sqlite3_errmsg")
+  };
+
+  if (!api.open_v2 || !api.close || !api.prepare_v2 || !api.step || !api.column_text || !api.finalize || !api.errmsg) {
+    LOGW("Failed to resolve SQLite, Magisk database will be read through magisk\n");
+
+    dlclose(handle);
+
+    return false;
+  }
+
+  sqlite = api;
+
+  return true;
+}
+
+/* INFO: Reads the policies in-process, read-only, so that no magisk has to
+           be spawned. Returns false when the database could not be read
+           that way, leaving whatever was added to be freed. */
+static bool _magisk_read_db(const char *sql) {
+  if (!_magisk_load_sqlite()) return false;
+
+  void *db = NULL;
+  if (sqlite.open_v2(MAGISK_DB_DIR "/" MAGISK_DB_NAME, &db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK) {
+    LOGE("Failed to open Magisk database: %s\n", db ? sqlite.errmsg(db) : "out of memory");
+
+    if (db) sqlite.close(db);
+
+    return false;
+  }
+
+  void *stmt = NULL;
+  if (sqlite.prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+    LOGE("Failed to query Magisk database: %s\n", sqlite.errmsg(db));
+
+    sqlite.close(db);
+
+    return false;
+  }
+
+  bool read = true;
+
+  int ret = SQLITE_OK;
+  while ((ret = sqlite.step(stmt)) == SQLITE_ROW) {
+    const char *type = (const char *)sqlite.column_text(stmt, 0);
+    const char *value = (const char *)sqlite.column_text(stmt, 1);
+    if (type == NULL || value == NULL) continue;
+
+    if (!_magisk_add_policy(type, value)) {
+      LOGE("Failed to allocate memory for Magisk policies\n");
+
+      read = false;
+
+      break;
+    }
+  }
+
+  if (read && ret != SQLITE_DONE) {
+    LOGE("Failed to read Magisk database: %s\n", sqlite.errmsg(db));
+
+    read = false;
+  }
+
+  sqlite.finalize(stmt);
+  sqlite.close(db);
+
+  return read;
+}
+
+/* INFO: The fallback when SQLite cannot be used, such as when the database is
+           busy. Magisk prints each row as "column=value" pairs, separated by
+           "|", with the column names of the first SELECT. */
+static bool _magisk_spawn_query(const char *sql) {
+  char *const argv[] = { "magisk", "--sqlite", (char *)sql, NULL };
+
+  char *output = spawn_read_output((const char *)path_to_magisk, argv, SPAWN_TIMEOUT_MS);
+  if (output == NULL) {
+    LOGE("Failed to execute magisk binary: %s\n", strerror(errno));
+    errno = 0;
+
+    return false;
+  }
+
+  char *saveptr = NULL;
+  for (char *line = strtok_r(output, "\n", &saveptr); line != NULL; line = strtok_r(NULL, "\n", &saveptr)) {
+    if (strncmp(line, "type=", strlen("type=")) != 0) continue;
+
+    char *type = line + strlen("type=");
+    char *value = strstr(type, "|value=");
+    if (value == NULL) continue;
+
+    *value = '\0';
+    value += strlen("|value=");
+
+    if (!_magisk_add_policy(type, value)) {
+      LOGE("Failed to allocate memory for Magisk policies\n");
+
+      free(output);
+
+      return false;
+    }
+  }
+
+  free(output);
+
+  return true;
+}
+
+static bool _magisk_query_policies(void) {
+  char sql[512];
+  snprintf(sql, sizeof(sql),
+    "SELECT 'uid' AS type, uid AS value FROM policies WHERE policy=2 "
+    "UNION ALL SELECT 'process', process FROM %s "
+    "UNION ALL SELECT 'requester', value FROM strings WHERE key='requester' "
+    "UNION ALL SELECT 'sulist', value FROM settings WHERE key='sulist'",
+    is_using_sulist ? "sulist" : "denylist");
+
+  if (!_magisk_read_db(sql)) {
+    _magisk_free_policies();
+
+    if (!_magisk_spawn_query(sql)) {
+      _magisk_free_policies();
+
+      return false;
+    }
+  }
+
+  qsort(policies.root_uids, policies.root_uids_len, sizeof(uid_t), _magisk_cmp_uid);
+  qsort(policies.processes, policies.processes_len, sizeof(char *), _magisk_cmp_process);
+
+  return true;
+}
+
+/* INFO: Must be called with policies_lock held */
+static bool _magisk_load_policies(void) {
+  if (policies.loaded && !_magisk_db_changed()) return true;
+
+  _magisk_free_policies();
+
+  if (!_magisk_query_policies()) return false;
+
   /* INFO: Magisk Kitsune has a feature called SuList, which is a whitelist of
              which processes are allowed to see root. Although only Kitsune has
              this option, there are Kitsune forks without "-kitsune" suffix, so
              to avoid excluding them from taking advantage of that feature, we
              will not check the variant.
-  */
-  argv[1] = "--sqlite";
-  argv[2] = "select value from settings where key = 'sulist' limit 1";
 
-  char sulist_enabled[32];
-  if (!exec_command(sulist_enabled, sizeof(sulist_enabled), (const char *)path_to_magisk, argv)) {
-    LOGE("Failed to execute magisk binary: %s\n", strerror(errno));
-    errno = 0;
+           Whether it is enabled is only known once the database was read, so
+             the list is read once more whenever it gets toggled.
+  */
+  if (policies.sulist_enabled != is_using_sulist) {
+    is_using_sulist = policies.sulist_enabled;
 
-    state->state = Abnormal;
+    _magisk_free_policies();
 
-    return;
+    if (!_magisk_query_policies()) return false;
   }
 
-  is_using_sulist = strcmp(sulist_enabled, "value=1") == 0;
+  policies.loaded = true;
+  policies_generation++;
 
-  if (atoi(magisk_version) >= MIN_MAGISK_VERSION) state->state = Supported;
-  else state->state = TooOld;
+  return true;
 }
 
-bool magisk_uid_granted_root(uid_t uid) {
-  char sqlite_cmd[256];
-  snprintf(sqlite_cmd, sizeof(sqlite_cmd), "select 1 from policies where uid=%d and policy=2 limit 1", uid);
+bool magisk_get_policies_generation(uint32_t *generation) {
+  pthread_mutex_lock(&policies_lock);
 
-  char *const argv[] = { "magisk", "--sqlite", sqlite_cmd, NULL };
+  bool loaded = _magisk_load_policies();
+  *generation = policies_generation;
 
-  char result[32];
-  if (!exec_command(result, sizeof(result), (const char *)path_to_magisk, argv)) {
-    LOGE("Failed to execute magisk binary: %s\n", strerror(errno));
-    errno = 0;
+  pthread_mutex_unlock(&policies_lock);
 
-    return false;
-  }
+  return loaded;
+}
 
-  return result[0] != '\0';
+int magisk_get_policies_watch(void) {
+  return magisk_db_watch;
 }
 
-bool magisk_uid_should_umount(const char *const process) {
-  /* INFO: PROCESS_NAME_MAX_LEN already has a +1 for NULL */
-  char sqlite_cmd[51 + PROCESS_NAME_MAX_LEN];
-  if (is_using_sulist)
-    snprintf(sqlite_cmd, sizeof(sqlite_cmd), "SELECT 1 FROM sulist WHERE process=\"%s\" LIMIT 1", process);
-  else
-    snprintf(sqlite_cmd, sizeof(sqlite_cmd), "SELECT 1 FROM denylist WHERE process=\"%s\" LIMIT 1", process);
+bool magisk_policies_changed(void) {
+  if (magisk_db_watch == -1) return false;
 
-  char *const argv[] = { "magisk", "--sqlite", sqlite_cmd, NULL };
+  pthread_mutex_lock(&policies_lock);
 
-  char result[sizeof("1=1")];
-  if (!exec_command(result, sizeof(result), (const char *)path_to_magisk, argv)) {
-    LOGE("Failed to execute magisk binary: %s\n", strerror(errno));
-    errno = 0;
+  /* INFO: The events are consumed here, so the database must be read again
+             on the next lookup regardless. */
+  bool changed = _magisk_db_changed();
+  if (changed) policies.loaded = false;
+
+  pthread_mutex_unlock(&policies_lock);
+
+  return changed;
+}
+
+bool magisk_uid_granted_root(uid_t uid) {
+  pthread_mutex_lock(&policies_lock);
+
+  bool granted = false;
+  if (_magisk_load_policies())
+    granted = bsearch(&uid, policies.root_uids, policies.root_uids_len, sizeof(uid_t), _magisk_cmp_uid) != NULL;
+
+  pthread_mutex_unlock(&policies_lock);
+
+  return granted;
+}
+
+bool magisk_uid_should_umount(const char *const process) {
+  pthread_mutex_lock(&policies_lock);
+
+  if (!_magisk_load_policies()) {
+    pthread_mutex_unlock(&policies_lock);
 
     return false;
   }
 
-  if (is_using_sulist) return result[0] == '\0';
-  else return result[0] != '\0';
+  bool listed = bsearch(&process, policies.processes, policies.processes_len, sizeof(char *), _magisk_cmp_process) != NULL;
+  bool using_sulist = is_using_sulist;
+
+  pthread_mutex_unlock(&policies_lock);
+
+  if (using_sulist) return !listed;
+  else return listed;
 }
 
 bool magisk_uid_is_manager(uid_t uid) {
-  char *const argv[] = { "magisk", "--sqlite", "select value from strings where key=\"requester\" limit 1", NULL };
+  pthread_mutex_lock(&policies_lock);
 
-  char output[128];
-  if (!exec_command(output, sizeof(output), (const char *)path_to_magisk, argv)) {
-    LOGE("Failed to execute magisk binary: %s\n", strerror(errno));
-    errno = 0;
+  if (!_magisk_load_policies()) {
+    pthread_mutex_unlock(&policies_lock);
 
     return false;
   }
 
+  char requester[sizeof(policies.requester)];
+  strcpy(requester, policies.requester);
+
+  pthread_mutex_unlock(&policies_lock);
+
   char stat_path[PATH_MAX];
-  if (output[0] == '\0')
+  if (requester[0] == '\0')
     snprintf(stat_path, sizeof(stat_path), "/data/user_de/0/%s", magisk_managers[(int)variant]);
   else
-    snprintf(stat_path, sizeof(stat_path), "/data/user_de/0/%s", output + strlen("value="));
+    snprintf(stat_path, sizeof(stat_path), "/data/user_de/0/%s", requester);
 
   struct stat s;
   if (stat(stat_path, &s) == -1) {
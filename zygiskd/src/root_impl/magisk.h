@@ -10,6 +10,12 @@ enum magisk_variants {
 
 void magisk_get_existence(struct root_impl_state *state);
 
+bool magisk_get_policies_generation(uint32_t *generation);
+
+int magisk_get_policies_watch(void);
+
+bool magisk_policies_changed(void);
+
 bool magisk_uid_granted_root(uid_t uid);
 
 bool magisk_uid_should_umount(const char *const process);
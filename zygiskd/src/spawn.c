@@ -0,0 +1,220 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "utils.h"
+
+#include "spawn.h"
+
+/* INFO: Processes are started with vfork, which copies neither the memory
+           nor the page tables of the daemon, so that spawning does not get
+           slower as it grows. Until it execs, the child runs on the memory
+           of the calling thread, which stays suspended, hence it must only
+           call async-signal-safe functions.
+
+         All signals are blocked around vfork, as bionic's posix_spawn does,
+           since the daemon is multithreaded and a handler running in the
+           child would run on, and corrupt, the memory of the daemon. Both
+           sides restore the previous mask, the child right before exec.
+
+         stdout_fd, if not -1, becomes the stdout of the process, and keep_fd,
+           if not -1, is inherited by it under the same number.
+*/
+pid_t spawn_process(const char *restrict file, char *const argv[], int stdout_fd, int keep_fd) {
+  sigset_t all_signals, old_signals;
+  sigfillset(&all_signals);
+  pthread_sigmask(SIG_SETMASK, &all_signals, &old_signals);
+
+  pid_t pid = vfork();
+  if (pid == 0) {
+    if (stdout_fd != -1 && stdout_fd != STDOUT_FILENO && dup2(stdout_fd, STDOUT_FILENO) == -1) _exit(127);
+
+    /* INFO: The fd table is not shared with the daemon, only its memory */
+    if (keep_fd != -1 && fcntl(keep_fd, F_SETFD, 0) == -1) _exit(127);
+
+    pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+    execv(file, argv);
+
+    _exit(127);
+  }
+
+  int vfork_errno = errno;
+  pthread_sigmask(SIG_SETMASK, &old_signals, NULL);
+
+  if (pid == -1) {
+    LOGE("vfork: %s\n", strerror(vfork_errno));
+
+    errno = vfork_errno;
+
+    return -1;
+  }
+
+  return pid;
+}
+
+static int _elapsed_ms(const struct timespec *start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (int)((now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000);
+}
+
+/* INFO: Waits for pid to exit until the deadline, killing it past that.
+           Returns whether it exited in time. */
+static bool _wait_until(pid_t pid, const struct timespec *start, int timeout_ms) {
+  /* INFO: The command has usually exited, or is about to, once its stdout
+             is closed, so the sleeps start short, and only grow for the
+             ones that keep running. */
+  long delay_us = 50;
+
+  while (1) {
+    pid_t ret = waitpid(pid, NULL, WNOHANG);
+    if (ret == pid) return true;
+    if (ret == -1 && errno != EINTR) return true;
+
+    long remaining_us = (long)(timeout_ms - _elapsed_ms(start)) * 1000;
+    if (remaining_us <= 0) break;
+
+    if (delay_us > remaining_us) delay_us = remaining_us;
+
+    struct timespec delay = {
+      .tv_sec = 0,
+      .tv_nsec = delay_us * 1000
+    };
+    nanosleep(&delay, NULL);
+
+    if (delay_us < 10000) delay_us *= 2;
+  }
+
+  kill(pid, SIGKILL);
+  while (waitpid(pid, NULL, 0) == -1 && errno == EINTR);
+
+  return false;
+}
+
+/* INFO: Reads the whole output of a command. If it does not finish in time,
+           either printing its output or exiting, it is killed, and NULL is
+           returned, as for any other failure. The returned buffer must be
+           freed. */
+char *spawn_read_output(const char *restrict file, char *const argv[], int timeout_ms) {
+  /* INFO: Close-on-exec, as commands may be executed by several threads at
+             once, and a leaked write end would delay the EOF of the others. */
+  int link[2];
+  if (pipe2(link, O_CLOEXEC) == -1) {
+    LOGE("pipe: %s\n", strerror(errno));
+
+    return NULL;
+  }
+
+  pid_t pid = spawn_process(file, argv, link[1], -1);
+  close(link[1]);
+
+  if (pid == -1) {
+    close(link[0]);
+
+    return NULL;
+  }
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  size_t len = 0;
+  size_t capacity = 256;
+  char *buf = malloc(capacity);
+  bool timed_out = false;
+
+  while (buf != NULL) {
+    if (len + 1 == capacity) {
+      char *new_buf = realloc(buf, capacity * 2);
+      if (new_buf == NULL) {
+        LOGE("Failed reallocating memory for command output.\n");
+
+        free(buf);
+        buf = NULL;
+
+        break;
+      }
+
+      buf = new_buf;
+      capacity *= 2;
+    }
+
+    int remaining_ms = timeout_ms - _elapsed_ms(&start);
+    if (remaining_ms <= 0) {
+      timed_out = true;
+
+      break;
+    }
+
+    struct pollfd pfd = {
+      .fd = link[0],
+      .events = POLLIN,
+      .revents = 0
+    };
+
+    int ret = poll(&pfd, 1, remaining_ms);
+    if (ret == -1 && errno == EINTR) continue;
+    if (ret == -1) break;
+    if (ret == 0) {
+      timed_out = true;
+
+      break;
+    }
+
+    ssize_t nbytes = read(link[0], buf + len, capacity - len - 1);
+    if (nbytes == -1 && errno == EINTR) continue;
+    if (nbytes <= 0) break;
+
+    len += (size_t)nbytes;
+  }
+
+  close(link[0]);
+
+  if (timed_out) kill(pid, SIGKILL);
+
+  /* INFO: The command may close its stdout and keep running, so waiting for
+             it counts against the same deadline. */
+  if (!_wait_until(pid, &start, timeout_ms)) timed_out = true;
+
+  if (timed_out) {
+    LOGE("Command %s did not finish in %d ms, killing it.\n", file, timeout_ms);
+
+    free(buf);
+    buf = NULL;
+  }
+
+  if (buf == NULL) {
+    errno = timed_out ? ETIMEDOUT : ENOMEM;
+
+    return NULL;
+  }
+
+  buf[len] = '\0';
+
+  return buf;
+}
+
+/* INFO: Cannot use restrict here as execv does not have restrict */
+bool exec_command(char *restrict buf, size_t len, const char *restrict file, char *const argv[]) {
+  char *output = spawn_read_output(file, argv, SPAWN_TIMEOUT_MS);
+  if (output == NULL) return false;
+
+  /* INFO: Only the first line, without its newline */
+  size_t output_len = strcspn(output, "\n");
+  if (output_len > len - 1) output_len = len - 1;
+
+  memcpy(buf, output, output_len);
+  buf[output_len] = '\0';
+
+  free(output);
+
+  return true;
+}
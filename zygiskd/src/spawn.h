@@ -0,0 +1,17 @@
+#ifndef SPAWN_H
+#define SPAWN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/* INFO: How long commands have to print their output and exit */
+#define SPAWN_TIMEOUT_MS 10000
+
+pid_t spawn_process(const char *restrict file, char *const argv[], int stdout_fd, int keep_fd);
+
+char *spawn_read_output(const char *restrict file, char *const argv[], int timeout_ms);
+
+bool exec_command(char *restrict buf, size_t len, const char *restrict file, char *const argv[]);
+
+#endif /* SPAWN_H */
@@ -25,6 +25,13 @@
 
 int clean_namespace_fd = 0;
 int mounted_namespace_fd = 0;
+/* INFO: Mount namespace of zygote, which the others are built from */
+static int reference_namespace_fd = -1;
+/* INFO: Guards the cached namespace fds, as namespaces may be requested by
+           multiple workers at once. Held while a namespace is first built,
+           so that it is only built once. */
+static pthread_mutex_t mns_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool mns_watching = false;
 
 bool switch_mount_namespace(pid_t pid) {
   char path[PATH_MAX];
@@ -185,7 +192,9 @@ int unix_listener_from_path(char *restrict path) {
     return -1;
   }
 
-  if (listen(socket_fd, 2) == -1) {
+  /* INFO: Zygote may fork many apps at once, and each of them connects to
+             ReZygiskd, so leave room for bursts of pending connections. */
+  if (listen(socket_fd, SOMAXCONN) == -1) {
     LOGE("listen: %s\n", strerror(errno));
 
     return -1;
@@ -200,228 +209,283 @@ int unix_listener_from_path(char *restrict path) {
   return socket_fd;
 }
 
-ssize_t write_fd(int fd, int sendfd) {
-  char cmsgbuf[CMSG_SPACE(sizeof(int))];
-  char buf[1] = { 0 };
-  
-  struct iovec iov = {
-    .iov_base = buf,
-    .iov_len = 1
-  };
-
-  struct msghdr msg = {
-    .msg_iov = &iov,
-    .msg_iovlen = 1,
-    .msg_control = cmsgbuf,
-    .msg_controllen = sizeof(cmsgbuf)
-  };
-
-  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
-  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
-  cmsg->cmsg_level = SOL_SOCKET;
-  cmsg->cmsg_type = SCM_RIGHTS;
-
-  memcpy(CMSG_DATA(cmsg), &sendfd, sizeof(int));
-
-  ssize_t ret = sendmsg(fd, &msg, 0);
-  if (ret == -1) {
-    LOGE("sendmsg: %s\n", strerror(errno));
+void message_init(struct message *msg) {
+  msg->data = NULL;
+  msg->len = 0;
+  msg->capacity = 0;
+  msg->pos = 0;
+  msg->fds_len = 0;
+  msg->fds_pos = 0;
+}
 
-    return -1;
+void message_free(struct message *msg) {
+  /* INFO: Received fds which were not taken would otherwise leak */
+  for (size_t i = msg->fds_pos; i < msg->fds_len; i++) {
+    close(msg->fds[i]);
   }
 
-  return ret;
-}
+  free(msg->data);
 
-int read_fd(int fd) {
-  char cmsgbuf[CMSG_SPACE(sizeof(int))];
+  message_init(msg);
+}
 
-  int cnt = 1;
-  struct iovec iov = {
-    .iov_base = &cnt,
-    .iov_len = sizeof(cnt)
-  };
+bool message_put(struct message *msg, const void *data, size_t len) {
+  if (msg->len + len > MESSAGE_MAX_LEN) {
+    LOGE("Failed to put data in message: Message is too big (%zu > %d).\n", msg->len + len, MESSAGE_MAX_LEN);
 
-  struct msghdr msg = {
-    .msg_iov = &iov,
-    .msg_iovlen = 1,
-    .msg_control = cmsgbuf,
-    .msg_controllen = sizeof(cmsgbuf)
-  };
+    return false;
+  }
 
-  ssize_t ret = recvmsg(fd, &msg, MSG_WAITALL);
-  if (ret == -1) {
-    LOGE("recvmsg: %s\n", strerror(errno));
+  if (msg->len + len > msg->capacity) {
+    size_t new_capacity = msg->capacity == 0 ? 64 : msg->capacity;
+    while (new_capacity < msg->len + len) new_capacity *= 2;
 
-    return -1;
-  }
+    uint8_t *new_data = realloc(msg->data, new_capacity);
+    if (new_data == NULL) {
+      LOGE("Failed reallocating memory for message.\n");
 
-  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
-  if (cmsg == NULL) {
-    LOGE("CMSG_FIRSTHDR: %s\n", strerror(errno));
+      return false;
+    }
 
-    return -1;
+    msg->data = new_data;
+    msg->capacity = new_capacity;
   }
 
-  int sendfd;
-  memcpy(&sendfd, CMSG_DATA(cmsg), sizeof(int));
+  memcpy(msg->data + msg->len, data, len);
+  msg->len += len;
 
-  return sendfd;
+  return true;
 }
 
-#define write_func(type)                    \
-  ssize_t write_## type(int fd, type val) { \
-    return write(fd, &val, sizeof(type));   \
+#define message_put_func(type)                                \
+  bool message_put_## type(struct message *msg, type val) {   \
+    return message_put(msg, &val, sizeof(type));              \
   }
 
-#define read_func(type)                     \
-  ssize_t read_## type(int fd, type *val) { \
-    return read(fd, val, sizeof(type));     \
+#define message_get_func(type)                                \
+  bool message_get_## type(struct message *msg, type *val) {  \
+    return message_get(msg, val, sizeof(type));               \
   }
 
-write_func(size_t)
-read_func(size_t)
+message_put_func(size_t)
+message_get_func(size_t)
 
-write_func(uint32_t)
-read_func(uint32_t)
+message_put_func(uint32_t)
+message_get_func(uint32_t)
 
-write_func(uint8_t)
-read_func(uint8_t)
+message_put_func(uint8_t)
+message_get_func(uint8_t)
 
-ssize_t write_string(int fd, const char *restrict str) {
+bool message_put_string(struct message *msg, const char *restrict str) {
   size_t str_len = strlen(str);
-  ssize_t written_bytes = write(fd, &str_len, sizeof(size_t));
-  if (written_bytes != sizeof(size_t)) {
-    LOGE("Failed to write string length: Not all bytes were written (%zd != %zu).\n", written_bytes, sizeof(size_t));
 
-    return -1;
-  }
+  return message_put_size_t(msg, str_len) && message_put(msg, str, str_len);
+}
 
-  written_bytes = write(fd, str, str_len);
-  if ((size_t)written_bytes != str_len) {
-    LOGE("Failed to write string: Not all bytes were written.\n");
+bool message_get(struct message *msg, void *restrict out, size_t len) {
+  if (msg->len - msg->pos < len) {
+    LOGE("Failed to get data from message: Not enough bytes left (%zu < %zu).\n", msg->len - msg->pos, len);
 
-    return -1;
+    return false;
   }
 
-  return written_bytes;
+  memcpy(out, msg->data + msg->pos, len);
+  msg->pos += len;
+
+  return true;
 }
 
-ssize_t read_string(int fd, char *restrict buf, size_t buf_size) {
+bool message_get_string(struct message *msg, char *restrict buf, size_t buf_size) {
   size_t str_len = 0;
-  ssize_t read_bytes = read(fd, &str_len, sizeof(size_t));
-  if (read_bytes != (ssize_t)sizeof(size_t)) {
-    LOGE("Failed to read string length: Not all bytes were read (%zd != %zu).\n", read_bytes, sizeof(size_t));
+  if (!message_get_size_t(msg, &str_len)) return false;
 
-    return -1;
-  }
-  
   if (str_len > buf_size - 1) {
-    LOGE("Failed to read string: Buffer is too small (%zu > %zu - 1).\n", str_len, buf_size);
+    LOGE("Failed to get string from message: Buffer is too small (%zu > %zu - 1).\n", str_len, buf_size);
 
-    return -1;
+    return false;
   }
 
-  read_bytes = read(fd, buf, str_len);
-  if (read_bytes != (ssize_t)str_len) {
-    LOGE("Failed to read string: Promised bytes doesn't exist (%zd != %zu).\n", read_bytes, str_len);
+  if (!message_get(msg, buf, str_len)) return false;
+  buf[str_len] = '\0';
+
+  return true;
+}
+
+int message_take_fd(struct message *msg) {
+  if (msg->fds_pos == msg->fds_len) {
+    LOGE("Failed to take fd from message: No fds left.\n");
 
     return -1;
   }
 
-  if (str_len > 0) buf[str_len] = '\0';
-
-  return read_bytes;
+  return msg->fds[msg->fds_pos++];
 }
 
-/* INFO: Cannot use restrict here as execv does not have restrict */
-bool exec_command(char *restrict buf, size_t len, const char *restrict file, char *const argv[]) {
-  int link[2];
-  pid_t pid;
+/* INFO: The header and the payload are sent with a single sendmsg, the fds
+           going along with the first byte, so that the peer receives them
+           together with the header. */
+enum MessageSendStatus message_send_partial(int fd, const struct message *msg, const int *fds, size_t fds_len, size_t *restrict sent) {
+  uint32_t header = (uint32_t)msg->len;
+  size_t total = sizeof(header) + msg->len;
+
+  while (*sent < total) {
+    struct iovec iov[2];
+    size_t iov_len = 0;
+
+    if (*sent < sizeof(header)) {
+      iov[iov_len].iov_base = (uint8_t *)&header + *sent;
+      iov[iov_len].iov_len = sizeof(header) - *sent;
+      iov_len++;
+
+      if (msg->len != 0) {
+        iov[iov_len].iov_base = msg->data;
+        iov[iov_len].iov_len = msg->len;
+        iov_len++;
+      }
+    } else {
+      iov[iov_len].iov_base = msg->data + (*sent - sizeof(header));
+      iov[iov_len].iov_len = total - *sent;
+      iov_len++;
+    }
+
+    struct msghdr msghdr = {
+      .msg_iov = iov,
+      .msg_iovlen = iov_len
+    };
 
-  if (pipe(link) == -1) {
-    LOGE("pipe: %s\n", strerror(errno));
+    char cmsgbuf[CMSG_SPACE(sizeof(int) * MESSAGE_MAX_FDS)];
+    if (*sent == 0 && fds_len != 0) {
+      msghdr.msg_control = cmsgbuf;
+      msghdr.msg_controllen = CMSG_SPACE(sizeof(int) * fds_len);
 
-    return false;
-  }
+      struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msghdr);
+      cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fds_len);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
 
-  if ((pid = fork()) == -1) {
-    LOGE("fork: %s\n", strerror(errno));
+      memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fds_len);
+    }
 
-    close(link[0]);
-    close(link[1]);
+    ssize_t ret = sendmsg(fd, &msghdr, MSG_NOSIGNAL);
+    if (ret == -1) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) return MessageSendPending;
 
-    return false;
+      LOGE("sendmsg: %s\n", strerror(errno));
+
+      return MessageSendFailed;
+    }
+
+    *sent += (size_t)ret;
   }
 
-  if (pid == 0) {
-    dup2(link[1], STDOUT_FILENO);
-    close(link[0]);
-    close(link[1]);
+  return MessageSendDone;
+}
 
-    execv(file, argv);
+bool message_send(int fd, const struct message *msg, const int *fds, size_t fds_len) {
+  size_t sent = 0;
 
-    LOGE("execv failed: %s\n", strerror(errno));
-    _exit(1);
-  } else {
-    close(link[1]);
+  return message_send_partial(fd, msg, fds, fds_len, &sent) == MessageSendDone;
+}
+
+static bool _message_recv_all(int fd, void *buf, size_t len, struct message *msg) {
+  size_t received = 0;
+
+  while (received < len) {
+    struct iovec iov = {
+      .iov_base = (uint8_t *)buf + received,
+      .iov_len = len - received
+    };
+
+    struct msghdr msghdr = {
+      .msg_iov = &iov,
+      .msg_iovlen = 1
+    };
 
-    ssize_t nbytes = read(link[0], buf, len);
-    if (nbytes > 0) buf[nbytes - 1] = '\0';
-    /* INFO: If something went wrong, at least we must ensure it is NULL-terminated */
-    else buf[0] = '\0';
+    char cmsgbuf[CMSG_SPACE(sizeof(int) * MESSAGE_MAX_FDS)];
+    if (msg != NULL && received == 0) {
+      msghdr.msg_control = cmsgbuf;
+      msghdr.msg_controllen = sizeof(cmsgbuf);
+    }
+
+    ssize_t ret = recvmsg(fd, &msghdr, MSG_CMSG_CLOEXEC);
+    if (ret == -1) {
+      if (errno == EINTR) continue;
+
+      LOGE("recvmsg: %s\n", strerror(errno));
+
+      return false;
+    }
 
-    wait(NULL);
+    if (msghdr.msg_controllen != 0) {
+      for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msghdr); cmsg != NULL; cmsg = CMSG_NXTHDR(&msghdr, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
 
-    close(link[0]);
+        size_t fds_len = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        memcpy(msg->fds + msg->fds_len, CMSG_DATA(cmsg), fds_len * sizeof(int));
+        msg->fds_len += fds_len;
+      }
+    }
+
+    if (ret == 0) {
+      LOGE("Failed to receive message: Connection closed (%zu < %zu).\n", received, len);
+
+      return false;
+    }
+
+    received += (size_t)ret;
   }
 
   return true;
 }
 
-bool check_unix_socket(int fd, bool block) {
-  struct pollfd pfd = {
-    .fd = fd,
-    .events = POLLIN,
-    .revents = 0
-  };
+bool message_recv(int fd, struct message *msg) {
+  message_init(msg);
 
-  int timeout = block ? -1 : 0;
-  poll(&pfd, 1, timeout);
+  uint32_t header = 0;
+  if (!_message_recv_all(fd, &header, sizeof(header), msg)) return false;
 
-  return pfd.revents & ~POLLIN ? false : true;
-}
+  if (header > MESSAGE_MAX_LEN) {
+    LOGE("Failed to receive message: Message is too big (%u > %d).\n", header, MESSAGE_MAX_LEN);
 
-/* INFO: Cannot use restrict here as execv does not have restrict */
-int non_blocking_execv(const char *restrict file, char *const argv[]) {
-  int link[2];
-  pid_t pid;
+    return false;
+  }
 
-  if (pipe(link) == -1) {
-    LOGE("pipe: %s\n", strerror(errno));
+  if (header == 0) return true;
 
-    return -1;
+  msg->data = malloc(header);
+  if (msg->data == NULL) {
+    LOGE("Failed allocating memory for message.\n");
+
+    return false;
   }
 
-  if ((pid = fork()) == -1) {
-    LOGE("fork: %s\n", strerror(errno));
+  msg->capacity = header;
+  msg->len = header;
 
-    return -1;
-  }
+  return _message_recv_all(fd, msg->data, header, NULL);
+}
 
-  if (pid == 0) {
-    dup2(link[1], STDOUT_FILENO);
-    close(link[0]);
-    close(link[1]);
+/* INFO: Only for the handshake of processes forked by zygiskd itself */
+ssize_t write_uint8_t(int fd, uint8_t val) {
+  return write(fd, &val, sizeof(val));
+}
 
-    execv(file, argv);
-  } else {
-    close(link[1]);
+ssize_t read_uint8_t(int fd, uint8_t *val) {
+  return read(fd, val, sizeof(*val));
+}
 
-    return link[0];
-  }
+bool check_unix_socket(int fd, bool block) {
+  struct pollfd pfd = {
+    .fd = fd,
+    .events = POLLIN,
+    .revents = 0
+  };
+
+  int timeout = block ? -1 : 0;
+  poll(&pfd, 1, timeout);
 
-  return -1;
+  return pfd.revents & ~POLLIN ? false : true;
 }
 
 void stringify_root_impl_name(struct root_impl impl, char *restrict output) {
@@ -476,195 +540,369 @@ struct mountinfo {
 struct mountinfos {
   struct mountinfo *mounts;
   size_t length;
+  /* INFO: The whole mountinfo, which the strings of the mounts point into */
+  char *buffer;
 };
 
-char *strndup(const char *restrict str, size_t length) {
-  char *restrict copy = malloc(length + 1);
-  if (copy == NULL) return NULL;
+void free_mounts(struct mountinfos *restrict mounts) {
+  free((void *)mounts->mounts);
+  free(mounts->buffer);
+}
+
+static char *_read_whole_file(const char *restrict path) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    LOGE("open: %s\n", strerror(errno));
+
+    return NULL;
+  }
+
+  /* INFO: procfs files have no size, so it grows as it is read */
+  size_t len = 0;
+  size_t capacity = 16384;
+  char *buffer = malloc(capacity);
 
-  memcpy(copy, str, length);
-  copy[length] = '\0';
+  while (buffer != NULL) {
+    if (len + 1 == capacity) {
+      char *new_buffer = realloc(buffer, capacity * 2);
+      if (new_buffer == NULL) {
+        free(buffer);
+        buffer = NULL;
 
-  return copy;
+        break;
+      }
+
+      buffer = new_buffer;
+      capacity *= 2;
+    }
+
+    ssize_t nbytes = read(fd, buffer + len, capacity - len - 1);
+    if (nbytes == -1 && errno == EINTR) continue;
+    if (nbytes == -1) {
+      LOGE("read: %s\n", strerror(errno));
+
+      free(buffer);
+      buffer = NULL;
+
+      break;
+    }
+
+    if (nbytes == 0) break;
+
+    len += (size_t)nbytes;
+  }
+
+  close(fd);
+
+  if (buffer != NULL) buffer[len] = '\0';
+
+  return buffer;
 }
 
-void free_mounts(struct mountinfos *restrict mounts) {
-  for (size_t i = 0; i < mounts->length; i++) {
-    free((void *)mounts->mounts[i].root);
-    free((void *)mounts->mounts[i].target);
-    free((void *)mounts->mounts[i].vfs_option);
-    free((void *)mounts->mounts[i].type);
-    free((void *)mounts->mounts[i].source);
-    free((void *)mounts->mounts[i].fs_option);
+/* INFO: Terminates the field ptr is at, and moves it to the next one */
+static char *_next_mountinfo_field(char **ptr) {
+  char *field = *ptr;
+
+  char *end = field;
+  while (*end != ' ' && *end != '\n' && *end != '\0') end++;
+
+  if (*end == ' ') {
+    *end = '\0';
+    *ptr = end + 1;
+  } else {
+    /* INFO: End of the line, which is left to be terminated by the caller */
+    *ptr = end;
   }
 
-  free((void *)mounts->mounts);
+  return field;
 }
 
+/* INFO: Reads the whole mountinfo at once, and splits it in place, so that
+           the mounts only point into that single buffer. */
 bool parse_mountinfo(const char *restrict pid, struct mountinfos *restrict mounts) {
   char path[PATH_MAX];
   snprintf(path, PATH_MAX, "/proc/%s/mountinfo", pid);
 
-  FILE *mountinfo = fopen(path, "r");
-  if (mountinfo == NULL) {
-    LOGE("fopen: %s\n", strerror(errno));
+  mounts->mounts = NULL;
+  mounts->length = 0;
+
+  mounts->buffer = _read_whole_file(path);
+  if (mounts->buffer == NULL) {
+    LOGE("Failed to read %s\n", path);
 
     return false;
   }
 
-  char line[PATH_MAX];
-  size_t i = 0;
+  size_t lines = 0;
+  for (const char *ptr = mounts->buffer; *ptr != '\0'; ptr++) {
+    if (*ptr == '\n') lines++;
+  }
 
-  mounts->mounts = NULL;
-  mounts->length = 0;
+  mounts->mounts = (struct mountinfo *)malloc((lines + 1) * sizeof(struct mountinfo));
+  if (!mounts->mounts) {
+    LOGE("Failed to allocate memory for mounts->mounts");
 
-  while (fgets(line, sizeof(line), mountinfo) != NULL) {
-    int root_start = 0, root_end = 0;
-    int target_start = 0, target_end = 0;
-    int vfs_option_start = 0, vfs_option_end = 0;
-    int type_start = 0, type_end = 0;
-    int source_start = 0, source_end = 0;
-    int fs_option_start = 0, fs_option_end = 0;
-    int optional_start = 0, optional_end = 0;
-    unsigned int id, parent, maj, min;
-    sscanf(line,
-            "%u "           // (1) id
-            "%u "           // (2) parent
-            "%u:%u "        // (3) maj:min
-            "%n%*s%n "      // (4) mountroot
-            "%n%*s%n "      // (5) target
-            "%n%*s%n"       // (6) vfs options (fs-independent)
-            "%n%*[^-]%n - " // (7) optional fields
-            "%n%*s%n "      // (8) FS type
-            "%n%*s%n "      // (9) source
-            "%n%*s%n",      // (10) fs options (fs specific)
-            &id, &parent, &maj, &min, &root_start, &root_end, &target_start,
-            &target_end, &vfs_option_start, &vfs_option_end,
-            &optional_start, &optional_end, &type_start, &type_end,
-            &source_start, &source_end, &fs_option_start, &fs_option_end);
-
-    mounts->mounts = (struct mountinfo *)realloc(mounts->mounts, (i + 1) * sizeof(struct mountinfo));
-    if (!mounts->mounts) {
-      LOGE("Failed to allocate memory for mounts->mounts");
-
-      fclose(mountinfo);
-      free_mounts(mounts);
+    free_mounts(mounts);
 
-      return false;
-    }
+    return false;
+  }
 
-    unsigned int shared = 0;
-    unsigned int master = 0;
-    unsigned int propagate_from = 0;
-    if (strstr(line + optional_start, "shared:")) {
-      shared = (unsigned int)atoi(strstr(line + optional_start, "shared:") + 7);
+  char *line = mounts->buffer;
+  while (*line != '\0') {
+    char *line_end = strchr(line, '\n');
+    if (line_end != NULL) *line_end = '\0';
+
+    char *next_line = line_end != NULL ? line_end + 1 : line + strlen(line);
+
+    struct mountinfo *mount = &mounts->mounts[mounts->length];
+    memset(mount, 0, sizeof(*mount));
+
+    char *ptr = line;
+    mount->id = (unsigned int)strtoul(_next_mountinfo_field(&ptr), NULL, 10);
+    mount->parent = (unsigned int)strtoul(_next_mountinfo_field(&ptr), NULL, 10);
+
+    char *device = _next_mountinfo_field(&ptr);
+    char *minor = strchr(device, ':');
+    unsigned int maj = (unsigned int)strtoul(device, NULL, 10);
+    unsigned int min = minor != NULL ? (unsigned int)strtoul(minor + 1, NULL, 10) : 0;
+    mount->device = (dev_t)(makedev(maj, min));
+
+    mount->root = _next_mountinfo_field(&ptr);
+    mount->target = _next_mountinfo_field(&ptr);
+    mount->vfs_option = _next_mountinfo_field(&ptr);
+
+    /* INFO: Optional fields, until the "-" separator */
+    while (*ptr != '\0') {
+      char *field = _next_mountinfo_field(&ptr);
+      if (strcmp(field, "-") == 0) break;
+
+      if (strncmp(field, "shared:", strlen("shared:")) == 0)
+        mount->optional.shared = (unsigned int)strtoul(field + strlen("shared:"), NULL, 10);
+      else if (strncmp(field, "master:", strlen("master:")) == 0)
+        mount->optional.master = (unsigned int)strtoul(field + strlen("master:"), NULL, 10);
+      else if (strncmp(field, "propagate_from:", strlen("propagate_from:")) == 0)
+        mount->optional.propagate_from = (unsigned int)strtoul(field + strlen("propagate_from:"), NULL, 10);
     }
 
-    if (strstr(line + optional_start, "master:")) {
-      master = (unsigned int)atoi(strstr(line + optional_start, "master:") + 7);
-    }
+    mount->type = _next_mountinfo_field(&ptr);
+    mount->source = _next_mountinfo_field(&ptr);
+    mount->fs_option = _next_mountinfo_field(&ptr);
 
-    if (strstr(line + optional_start, "propagate_from:")) {
-      propagate_from = (unsigned int)atoi(strstr(line + optional_start, "propagate_from:") + 15);
-    }
+    mounts->length++;
 
-    mounts->mounts[i].id = id;
-    mounts->mounts[i].parent = parent;
-    mounts->mounts[i].device = (dev_t)(makedev(maj, min));
-    mounts->mounts[i].root = strndup(line + root_start, (size_t)(root_end - root_start));
-    mounts->mounts[i].target = strndup(line + target_start, (size_t)(target_end - target_start));
-    mounts->mounts[i].vfs_option = strndup(line + vfs_option_start, (size_t)(vfs_option_end - vfs_option_start));
-    mounts->mounts[i].optional.shared = shared;
-    mounts->mounts[i].optional.master = master;
-    mounts->mounts[i].optional.propagate_from = propagate_from;
-    mounts->mounts[i].type = strndup(line + type_start, (size_t)(type_end - type_start));
-    mounts->mounts[i].source = strndup(line + source_start, (size_t)(source_end - source_start));
-    mounts->mounts[i].fs_option = strndup(line + fs_option_start, (size_t)(fs_option_end - fs_option_start));
-
-    i++;
+    line = next_line;
   }
 
-  fclose(mountinfo);
+  return true;
+}
 
-  mounts->length = i;
+/* INFO: The targets to unmount for a clean namespace, NUL separated, in the
+           order they must be unmounted. Built once per root implementation
+           and mount table generation, after which new clean namespaces only
+           cost the umount2 calls. */
+struct umount_plan {
+  char *targets;
+  size_t len;
+  enum root_impls impl;
+  uint32_t generation;
+  bool valid;
+};
 
-  return true;
+static struct umount_plan umount_plan = { NULL, 0, None, 0, false };
+/* INFO: Bumped by the mounts watcher whenever the root mounts of init change */
+static uint32_t mounts_generation = 0;
+/* INFO: Bumped by the mounts watcher on any change of the mount table of init */
+static uint32_t mount_changes = 0;
+/* INFO: Guards umount_plan, and is held during the whole build of a clean
+           namespace, so that the child sees a consistent plan. */
+static pthread_mutex_t umount_plan_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *_root_source_name(struct root_impl impl) {
+  if (impl.impl == KernelSU) return "KSU";
+  if (impl.impl == APatch) return "APatch";
+
+  return "magisk";
 }
 
-bool umount_root(struct root_impl impl) {
-  /* INFO: We are already in the target pid mount namespace, so actually,
-             when we use self here, we meant its pid.
+/* INFO: Must be called with umount_plan_lock held */
+static bool _umount_plan_current(struct root_impl impl) {
+  return umount_plan.valid && umount_plan.impl == impl.impl &&
+         umount_plan.generation == __atomic_load_n(&mounts_generation, __ATOMIC_RELAXED);
+}
+
+static bool _should_unmount(const struct mountinfo *mount, const char *source_name) {
+  /* INFO: The root implementations have their own /system mounts, so we
+              only skip the mount if they are from a module, not Magisk itself.
   */
+  if (strncmp(mount->target, "/system/", strlen("/system/")) == 0 &&
+      strncmp(mount->root, "/adb/modules/", strlen("/adb/modules/")) == 0 &&
+      strncmp(mount->target, "/system/etc/", strlen("/system/etc/")) != 0) return false;
+
+  if (strcmp(mount->source, source_name) == 0) return true;
+  if (strncmp(mount->target, "/data/adb/modules", strlen("/data/adb/modules")) == 0) return true;
+  if (strncmp(mount->root, "/adb/modules/", strlen("/adb/modules/")) == 0) return true;
+
+  return false;
+}
+
+/* INFO: Writes the plan for the mounts of pid to msg, in the format of
+           struct umount_plan targets. */
+static bool _make_umount_plan(const char *restrict pid, struct root_impl impl, struct message *restrict msg) {
   struct mountinfos mounts;
-  if (!parse_mountinfo("self", &mounts)) {
+  if (!parse_mountinfo(pid, &mounts)) {
     LOGE("Failed to parse mountinfo\n");
 
     return false;
   }
 
-  /* INFO: "Magisk" is the longest word that will ever be put in source_name */
-  char source_name[sizeof("magisk")];
-  if (impl.impl == KernelSU) strcpy(source_name, "KSU");
-  else if (impl.impl == APatch) strcpy(source_name, "APatch");
-  else strcpy(source_name, "magisk");
+  const char *source_name = _root_source_name(impl);
 
-  LOGI("[%s] Unmounting root", source_name);
+  /* INFO: Children are mounted after their parents, so they are unmounted
+             first by walking the mounts backwards. */
+  bool res = true;
+  for (size_t i = mounts.length; i > 0 && res; i--) {
+    const struct mountinfo *mount = &mounts.mounts[i - 1];
+    if (!_should_unmount(mount, source_name)) continue;
 
-  const char **targets_to_unmount = NULL;
-  size_t num_targets = 0;
+    res = message_put(msg, mount->target, strlen(mount->target) + 1);
+  }
 
-  for (size_t i = 0; i < mounts.length; i++) {
-    struct mountinfo mount = mounts.mounts[i];
+  free_mounts(&mounts);
 
-    bool should_unmount = false;
-    /* INFO: The root implementations have their own /system mounts, so we
-                only skip the mount if they are from a module, not Magisk itself.
-    */
-    if (strncmp(mount.target, "/system/", strlen("/system/")) == 0 &&
-        strncmp(mount.root, "/adb/modules/", strlen("/adb/modules/")) == 0 &&
-        strncmp(mount.target, "/system/etc/", strlen("/system/etc/")) != 0) continue;
+  if (!res) {
+    LOGE("[%s] Failed to store unmount plan\n", source_name);
+  }
 
-    if (strcmp(mount.source, source_name) == 0) should_unmount = true;
-    if (strncmp(mount.target, "/data/adb/modules", strlen("/data/adb/modules")) == 0) should_unmount = true;
-    if (strncmp(mount.root, "/adb/modules/", strlen("/adb/modules/")) == 0) should_unmount = true;
+  return res;
+}
 
-    if (!should_unmount) continue;
+/* INFO: Only async-signal-safe calls, as it runs in the child of a
+           multithreaded fork. */
+static bool _read_all(int fd, void *buf, size_t len) {
+  size_t received = 0;
+  while (received < len) {
+    ssize_t ret = read(fd, (uint8_t *)buf + received, len - received);
+    if (ret == -1 && errno == EINTR) continue;
+    if (ret <= 0) return false;
 
-    num_targets++;
-    targets_to_unmount = realloc(targets_to_unmount, num_targets * sizeof(char*));
-    if (targets_to_unmount == NULL) {
-      LOGE("[%s] Failed to allocate memory for targets_to_unmount\n", source_name);
+    received += (size_t)ret;
+  }
 
-      free(targets_to_unmount);
-      free_mounts(&mounts);
+  return true;
+}
 
-      return false;
+static bool _write_all(int fd, const void *buf, size_t len) {
+  size_t sent = 0;
+  while (sent < len) {
+    ssize_t ret = write(fd, (const uint8_t *)buf + sent, len - sent);
+    if (ret == -1 && errno == EINTR) continue;
+    if (ret <= 0) return false;
+
+    sent += (size_t)ret;
+  }
+
+  return true;
+}
+
+/* INFO: Sends the targets one by one, each with its length, NUL included,
+           and a zero length at the end, so that the child can unmount them
+           from a stack buffer. */
+static bool _send_umount_plan(int fd, const char *source_name, const char *targets, size_t len) {
+  for (const char *target = targets; target < targets + len; target += strlen(target) + 1) {
+    size_t target_len = strlen(target) + 1;
+    if (target_len > PATH_MAX) {
+      LOGE("[%s] Skipping unmount of too long path %s\n", source_name, target);
+
+      continue;
     }
 
-    targets_to_unmount[num_targets - 1] = mount.target;
+    if (!_write_all(fd, &target_len, sizeof(target_len)) || !_write_all(fd, target, target_len)) return false;
   }
 
-  for (size_t i = num_targets; i > 0; i--) {
-    const char *target = targets_to_unmount[i - 1];
-    if (umount2(target, MNT_DETACH) == -1) {
-      LOGE("[%s] Failed to unmount %s: %s\n", source_name, target, strerror(errno));
-    } else {
-      LOGI("[%s] Unmounted %s\n", source_name, target);
+  size_t end = 0;
+
+  return _write_all(fd, &end, sizeof(end));
+}
+
+/* INFO: Runs in the child of a multithreaded fork, which may have been done
+           while another thread held the malloc or log locks, hence only
+           async-signal-safe calls. Returns the number of failed unmounts. */
+static uint32_t _replay_umount_plan(int fd) {
+  uint32_t failed = 0;
+  char target[PATH_MAX];
+
+  size_t target_len = 0;
+  while (_read_all(fd, &target_len, sizeof(target_len)) && target_len != 0 && target_len <= PATH_MAX) {
+    if (!_read_all(fd, target, target_len)) break;
+
+    target[target_len - 1] = '\0';
+    if (umount2(target, MNT_DETACH) == -1) failed++;
+  }
+
+  return failed;
+}
+
+static bool _umount_plan_has(const char *targets, size_t len, const char *target) {
+  for (const char *ptr = targets; ptr < targets + len; ptr += strlen(ptr) + 1) {
+    if (strcmp(ptr, target) == 0) return true;
+  }
+
+  return false;
+}
+
+/* INFO: Must be called with umount_plan_lock held. Takes the plan received
+           from the child which made it, logging how it differs from the
+           previous one. */
+static void _install_umount_plan(struct root_impl impl, uint32_t generation, struct message *restrict msg) {
+  const char *source_name = _root_source_name(impl);
+
+  char *targets = (char *)msg->data;
+  size_t len = msg->len;
+
+  size_t count = 0;
+  for (const char *ptr = targets; ptr < targets + len; ptr += strlen(ptr) + 1) {
+    count++;
+
+    if (umount_plan.valid && !_umount_plan_has(umount_plan.targets, umount_plan.len, ptr)) {
+      LOGI("[%s] Unmount plan: + %s\n", source_name, ptr);
     }
   }
-  free(targets_to_unmount);
 
-  free_mounts(&mounts);
+  if (umount_plan.valid) {
+    for (const char *ptr = umount_plan.targets; ptr < umount_plan.targets + umount_plan.len; ptr += strlen(ptr) + 1) {
+      if (!_umount_plan_has(targets, len, ptr)) {
+        LOGI("[%s] Unmount plan: - %s\n", source_name, ptr);
+      }
+    }
+  }
 
-  return true;
+  LOGI("[%s] Unmount plan of generation %u has %zu targets\n", source_name, generation, count);
+
+  free(umount_plan.targets);
+
+  /* INFO: The plan takes over the buffer of the message */
+  umount_plan.targets = targets;
+  umount_plan.len = len;
+  umount_plan.impl = impl.impl;
+  umount_plan.generation = generation;
+  umount_plan.valid = true;
+
+  msg->data = NULL;
+  msg->len = 0;
+  msg->capacity = 0;
 }
 
-int save_mns_fd(int pid, enum MountNamespaceState mns_state, struct root_impl impl) {
-  if (mns_state == Clean && clean_namespace_fd != 0) return clean_namespace_fd;
-  if (mns_state == Mounted && mounted_namespace_fd != 0) return mounted_namespace_fd;
+/* INFO: Builds a namespace from the reference one, in a child process which
+           stays in it until its fd is opened. As the daemon is multithreaded,
+           the child only switches namespace and unmounts what it is sent:
+           unless replaying the current unmount plan, a clean namespace has
+           the parent make a new one from the mountinfo of the child. */
+static int _fork_mns_fd(int reference_fd, enum MountNamespaceState mns_state, struct root_impl impl, bool replay) {
+  uint32_t generation = __atomic_load_n(&mounts_generation, __ATOMIC_RELAXED);
+  const char *source_name = _root_source_name(impl);
 
   int sockets[2];
-  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == -1) {
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) == -1) {
     LOGE("socketpair: %s\n", strerror(errno));
 
     return -1;
@@ -689,64 +927,63 @@ int save_mns_fd(int pid, enum MountNamespaceState mns_state, struct root_impl im
   if (fork_pid == 0) {
     close(socket_parent);
 
-    if (switch_mount_namespace(pid) == false) {
-      LOGE("Failed to switch mount namespace\n");
-
-      if (write_uint8_t(socket_child, 0) == -1)
-        LOGE("Failed to write to socket_child: %s\n", strerror(errno));
-
-      goto finalize_mns_fork;
-    }
+    bool switched = setns(reference_fd, CLONE_NEWNS) != -1 && (mns_state != Clean || unshare(CLONE_NEWNS) != -1);
+    if (write_uint8_t(socket_child, (uint8_t)switched) == -1 || !switched) _exit(1);
 
     if (mns_state == Clean) {
-      unshare(CLONE_NEWNS);
-
-      if (!umount_root(impl)) {
-        LOGE("Failed to umount root\n");
-
-        if (write_uint8_t(socket_child, 0) == -1)
-          LOGE("Failed to write to socket_child: %s\n", strerror(errno));
-
-        goto finalize_mns_fork;
-      }
-    }
-
-    if (write_uint8_t(socket_child, 1) == -1) {
-      LOGE("Failed to write to socket_child: %s\n", strerror(errno));
-
-      close(socket_child);
-
-      _exit(1);
+      uint32_t failed = _replay_umount_plan(socket_child);
+      if (!_write_all(socket_child, &failed, sizeof(failed))) _exit(1);
     }
 
     uint8_t has_opened = 0;
-    if (read_uint8_t(socket_child, &has_opened) == -1)
-      LOGE("Failed to read from socket_child: %s\n", strerror(errno));
+    read_uint8_t(socket_child, &has_opened);
 
-    finalize_mns_fork:
-      if (close(socket_child) == -1)
-        LOGE("Failed to close socket_child: %s\n", strerror(errno));
-
-      _exit(0);
+    _exit(0);
   }
 
   close(socket_child);
 
   uint8_t has_succeeded = 0;
-  if (read_uint8_t(socket_parent, &has_succeeded) == -1) {
-    LOGE("Failed to read from socket_parent: %s\n", strerror(errno));
-
-    close(socket_parent);
+  if (read_uint8_t(socket_parent, &has_succeeded) != 1 || !has_succeeded) {
+    LOGE("Failed to switch mount namespace\n");
 
-    return -1;
+    goto fail;
   }
 
-  if (!has_succeeded) {
-    LOGE("Failed to umount root\n");
+  if (mns_state == Clean) {
+    struct message plan;
+    message_init(&plan);
 
-    close(socket_parent);
+    /* INFO: The child already unshared its namespace, so its mountinfo
+               is the one of the namespace to clean. */
+    char child_pid[16];
+    snprintf(child_pid, sizeof(child_pid), "%d", fork_pid);
 
-    return -1;
+    bool sent = false;
+    if (replay) {
+      sent = _send_umount_plan(socket_parent, source_name, umount_plan.targets, umount_plan.len);
+    } else if (_make_umount_plan(child_pid, impl, &plan)) {
+      sent = _send_umount_plan(socket_parent, source_name, (const char *)plan.data, plan.len);
+    }
+
+    uint32_t failed = 0;
+    if (!sent || !_read_all(socket_parent, &failed, sizeof(failed))) {
+      LOGE("[%s] Failed to umount root\n", source_name);
+
+      message_free(&plan);
+
+      goto fail;
+    }
+
+    if (failed != 0) {
+      LOGE("[%s] Failed to unmount %u targets\n", source_name, failed);
+    } else {
+      LOGI("[%s] Unmounted root\n", source_name);
+    }
+
+    if (!replay) _install_umount_plan(impl, generation, &plan);
+
+    message_free(&plan);
   }
 
   char ns_path[PATH_MAX];
@@ -756,9 +993,7 @@ int save_mns_fd(int pid, enum MountNamespaceState mns_state, struct root_impl im
   if (ns_fd == -1) {
     LOGE("open: %s\n", strerror(errno));
 
-    close(socket_parent);
-
-    return -1;
+    goto fail;
   }
 
   uint8_t opened_signal = 1;
@@ -766,63 +1001,311 @@ int save_mns_fd(int pid, enum MountNamespaceState mns_state, struct root_impl im
     LOGE("Failed to write to socket_parent: %s\n", strerror(errno));
 
     close(ns_fd);
-    close(socket_parent);
 
-    return -1;
+    goto fail;
   }
 
   if (close(socket_parent) == -1) {
     LOGE("Failed to close socket_parent: %s\n", strerror(errno));
+  }
+
+  if (waitpid(fork_pid, NULL, 0) == -1) {
+    LOGE("waitpid: %s\n", strerror(errno));
 
     close(ns_fd);
 
     return -1;
   }
 
-  if (waitpid(fork_pid, NULL, 0) == -1) {
-    LOGE("waitpid: %s\n", strerror(errno));
+  return ns_fd;
+
+  fail:
+    /* INFO: Closing it has the child exit wherever it is waiting */
+    close(socket_parent);
+    waitpid(fork_pid, NULL, 0);
 
     return -1;
-  }
+}
 
-  if (impl.impl == Magisk && impl.variant == MKitsune && mns_state == Clean) {
-    LOGI("[Magisk] Magisk Kitsune detected, will skip cache first.");
+static int _build_mns_fd(int reference_fd, enum MountNamespaceState mns_state, struct root_impl impl) {
+  if (mns_state != Clean) return _fork_mns_fd(reference_fd, mns_state, impl, false);
 
-    /* INFO: MagiskSU of Kitsune has a special behavior: It is only mounted
-               once system boots, because of that, we can only cache once
-               that happens, or else it will clean the mounts, then later
-               get MagiskSU mounted, resulting in a mount leak.
+  pthread_mutex_lock(&umount_plan_lock);
+  int ns_fd = _fork_mns_fd(reference_fd, Clean, impl, _umount_plan_current(impl));
+  pthread_mutex_unlock(&umount_plan_lock);
 
-       SOURCES:
-        - https://github.com/1q23lyc45/KitsuneMagisk/blob/8562a0b2ad142d21566c1ea41690ad64108ca14c/native/src/core/bootstages.cpp#L359
-    */
-    char boot_completed[2];
-    get_property("sys.boot_completed", boot_completed);
+  return ns_fd;
+}
 
-    if (boot_completed[0] == '1') {
-      LOGI("[Magisk] Appropriate mns found, caching clean namespace fd.");
+static pid_t _get_parent_pid(int pid) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
 
-      clean_namespace_fd = ns_fd;
-    }
+  FILE *stat_file = fopen(path, "re");
+  if (stat_file == NULL) return -1;
 
-    /* BUG: For the case where it hasn't booted yet, we will need to
-              keep creating mns that will be left behind, the issue is:
-              they are not close'd. This is a problem, because we will
-              have a leak of fds, although only from the period of booting.
+  char stat_line[512];
+  size_t len = fread(stat_line, 1, sizeof(stat_line) - 1, stat_file);
+  fclose(stat_file);
 
-            When trying to close the ns_fd from the libzygisk.so, fdsan
-              will complain as it is owned by RandomAccessFile, and if
-              we close from ReZygiskd, system will refuse to boot for
-              some reason, even if we wait for setns in libzygisk.so,
-              and that issue is related to setns, as it only happens
-              with it.
-    */
+  stat_line[len] = '\0';
 
-    return ns_fd;
+  /* INFO: The process name may itself contain spaces and parenthesis, so
+             the fields are only parsed after its last closing parenthesis. */
+  char *fields = strrchr(stat_line, ')');
+  if (fields == NULL) return -1;
+
+  char state;
+  int ppid;
+  if (sscanf(fields + 1, " %c %d", &state, &ppid) != 2) return -1;
+
+  return (pid_t)ppid;
+}
+
+/* INFO: The reference is the mount namespace of the zygote that forked pid,
+           and not the one of pid itself: apps unshare their own namespace
+           and mount their storage and data in it while specializing, which
+           would otherwise leak into the clean namespace. Zygote never
+           specializes, so its namespace holds exactly the mounts apps start
+           with. Must be called with mns_lock held. */
+static bool _open_reference_mns(int pid) {
+  if (reference_namespace_fd != -1) return true;
+
+  pid_t zygote_pid = _get_parent_pid(pid);
+  if (zygote_pid <= 1) {
+    LOGE("Failed to get zygote of %d for reference mount namespace\n", pid);
+
+    return false;
   }
 
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "/proc/%d/ns/mnt", zygote_pid);
+
+  reference_namespace_fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (reference_namespace_fd == -1) {
+    LOGE("Failed to open reference mount namespace of zygote %d: %s\n", zygote_pid, strerror(errno));
+
+    return false;
+  }
+
+  return true;
+}
+
+/* INFO: Must be called with mns_lock held */
+static int _save_mns_fd(int pid, enum MountNamespaceState mns_state, struct root_impl impl) {
+  if (mns_state == Clean && clean_namespace_fd != 0) return clean_namespace_fd;
+  if (mns_state == Mounted && mounted_namespace_fd != 0) return mounted_namespace_fd;
+
+  if (!_open_reference_mns(pid)) return -1;
+
+  int ns_fd = _build_mns_fd(reference_namespace_fd, mns_state, impl);
+  if (ns_fd == -1) return -1;
+
   if (mns_state == Clean) clean_namespace_fd = ns_fd;
   else if (mns_state == Mounted) mounted_namespace_fd = ns_fd;
 
   return ns_fd;
 }
+
+/* INFO: Waits for the mount table to stop changing, as mounts are usually
+           made in bursts, such as when modules are mounted. */
+static void _wait_mounts_settle(int mountinfo_fd) {
+  struct pollfd pfd = {
+    .fd = mountinfo_fd,
+    .events = POLLPRI,
+    .revents = 0
+  };
+
+  for (int i = 0; i < 8; i++) {
+    if (poll(&pfd, 1, 250) <= 0) return;
+  }
+}
+
+/* INFO: The clean namespace is a copy of the reference one, made once, so
+           whatever is mounted afterwards is missing from it, or leaks into
+           it. It is built again whenever the mount table of init changes,
+           and swapped in place, so that the cached fd stays valid at all
+           times. The unmount plan is only made again when the root mounts
+           themselves changed, which init shares with the reference.
+
+         The mounted namespace is left out: its child never unshares, so its
+           fd refers to the reference namespace itself, not to a copy, and
+           already sees every later mount.
+
+         That also covers Magisk Kitsune, whose MagiskSU is only mounted once
+           the system has booted.
+
+           SOURCES:
+            - https://github.com/1q23lyc45/KitsuneMagisk/blob/8562a0b2ad142d21566c1ea41690ad64108ca14c/native/src/core/bootstages.cpp#L359
+*/
+static bool _root_mounts_changed(struct root_impl impl, struct message *restrict root_mounts) {
+  struct message current;
+  message_init(&current);
+
+  /* INFO: Assumed changed when unknown, which only costs a new plan */
+  bool changed = true;
+  if (_make_umount_plan("1", impl, &current)) {
+    changed = current.len != root_mounts->len ||
+              (current.len != 0 && memcmp(current.data, root_mounts->data, current.len) != 0);
+  }
+
+  message_free(root_mounts);
+  *root_mounts = current;
+
+  return changed;
+}
+
+static void *_watch_mounts(void *arg) {
+  struct root_impl impl = *(struct root_impl *)arg;
+  free(arg);
+
+  struct message root_mounts;
+  message_init(&root_mounts);
+  _root_mounts_changed(impl, &root_mounts);
+
+  int mountinfo_fd = open("/proc/1/mountinfo", O_RDONLY | O_CLOEXEC);
+  if (mountinfo_fd == -1) {
+    LOGE("Failed to open init mountinfo, clean namespace won't be refreshed: %s\n", strerror(errno));
+
+    return NULL;
+  }
+
+  struct pollfd pfd = {
+    .fd = mountinfo_fd,
+    .events = POLLPRI,
+    .revents = 0
+  };
+
+  /* INFO: From now on, no change goes unnoticed, so zygote may start caching
+             which of its fds can be reopened. */
+  policy_table_set_mount_changes(++mount_changes);
+
+  while (1) {
+    if (poll(&pfd, 1, -1) == -1) {
+      if (errno == EINTR) continue;
+
+      LOGE("Failed to poll init mountinfo: %s\n", strerror(errno));
+
+      break;
+    }
+
+    /* INFO: Bumped both as soon as the mount table changes, and once it
+               settled, so that no fork reuses what it cached in between. */
+    policy_table_set_mount_changes(++mount_changes);
+    _wait_mounts_settle(mountinfo_fd);
+    policy_table_set_mount_changes(++mount_changes);
+
+    /* INFO: Makes the next clean namespace come with a new unmount plan */
+    if (_root_mounts_changed(impl, &root_mounts))
+      policy_table_set_mounts_generation(__atomic_add_fetch(&mounts_generation, 1, __ATOMIC_RELAXED));
+
+    /* INFO: Never changes once set, so it can be used without the lock */
+    int ns_fd = _build_mns_fd(reference_namespace_fd, Clean, impl);
+    if (ns_fd == -1) {
+      LOGE("Failed to rebuild clean mount namespace\n");
+
+      continue;
+    }
+
+    pthread_mutex_lock(&mns_lock);
+
+    if (dup3(ns_fd, clean_namespace_fd, O_CLOEXEC) == -1) {
+      LOGE("Failed to replace clean mount namespace: %s\n", strerror(errno));
+    } else {
+      LOGI("Mount table changed, clean mount namespace rebuilt\n");
+    }
+
+    pthread_mutex_unlock(&mns_lock);
+
+    close(ns_fd);
+  }
+
+  /* INFO: Changes won't be noticed anymore */
+  policy_table_set_mount_changes(0);
+
+  message_free(&root_mounts);
+  close(mountinfo_fd);
+
+  return NULL;
+}
+
+/* INFO: Must be called with mns_lock held */
+static void _start_watching_mounts(struct root_impl impl) {
+  if (mns_watching || clean_namespace_fd == 0) return;
+
+  struct root_impl *arg = malloc(sizeof(struct root_impl));
+  if (arg == NULL) return;
+
+  *arg = impl;
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+  pthread_t thread;
+  if (pthread_create(&thread, &attr, _watch_mounts, arg) == 0) mns_watching = true;
+  else {
+    LOGE("Failed to start watching mounts, clean namespace won't be refreshed\n");
+
+    free(arg);
+  }
+
+  pthread_attr_destroy(&attr);
+}
+
+int save_mns_fd(int pid, enum MountNamespaceState mns_state, struct root_impl impl) {
+  pthread_mutex_lock(&mns_lock);
+  int ns_fd = _save_mns_fd(pid, mns_state, impl);
+  if (mns_state == Clean) _start_watching_mounts(impl);
+  pthread_mutex_unlock(&mns_lock);
+
+  return ns_fd;
+}
+
+struct prewarm_args {
+  int pid;
+  struct root_impl impl;
+};
+
+static void *_prewarm_mns_fds(void *arg) {
+  struct prewarm_args args = *(struct prewarm_args *)arg;
+  free(arg);
+
+  save_mns_fd(args.pid, Mounted, args.impl);
+  save_mns_fd(args.pid, Clean, args.impl);
+
+  return NULL;
+}
+
+/* INFO: Builds both namespaces in the background, from the mount namespace of
+           the zygote that forked pid, so that no process has to wait for
+           them later. As zygote does not specialize, pid may go on without
+           waiting for them. */
+void prewarm_mns_fds(int pid, struct root_impl impl) {
+  /* INFO: Taken right away, as zygote is only found from pid while pid
+             is still alive */
+  pthread_mutex_lock(&mns_lock);
+  bool opened = _open_reference_mns(pid);
+  pthread_mutex_unlock(&mns_lock);
+
+  if (!opened) return;
+
+  struct prewarm_args *args = malloc(sizeof(struct prewarm_args));
+  if (args == NULL) return;
+
+  args->pid = pid;
+  args->impl = impl;
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+  pthread_t thread;
+  if (pthread_create(&thread, &attr, _prewarm_mns_fds, args) != 0) {
+    LOGE("Failed to start building mount namespaces in background\n");
+
+    free(args);
+  }
+
+  pthread_attr_destroy(&attr);
+}
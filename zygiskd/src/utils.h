@@ -1,6 +1,7 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <stdint.h>
 #include <sys/types.h>
 
 #include "constants.h"
@@ -68,12 +69,6 @@
 #define IS_ISOLATED_SERVICE(uid)      \
   ((uid) >= 90000 && (uid) < 1000000)
 
-#define write_func_def(type)              \
-  ssize_t write_## type(int fd, type val)
-
-#define read_func_def(type)               \
-  ssize_t read_## type(int fd, type *val)
-
 bool switch_mount_namespace(pid_t pid);
 
 void get_property(const char *name, char *restrict output);
@@ -86,30 +81,75 @@ int chcon(const char *path, const char *restrict context);
 
 int unix_listener_from_path(char *path);
 
-ssize_t write_fd(int fd, int sendfd);
-int read_fd(int fd);
+/* INFO: Every message is its payload length, as an uint32_t, followed by
+           the payload itself. Fds, if any, go along with the length. */
+#define MESSAGE_MAX_LEN (1024 * 1024)
+/* INFO: SCM_MAX_FD, the most fds the kernel accepts in a single message */
+#define MESSAGE_MAX_FDS 253
 
-write_func_def(size_t);
-read_func_def(size_t);
+struct message {
+  uint8_t *data;
+  size_t len;
+  size_t capacity;
+  /* INFO: Read position of message_get */
+  size_t pos;
 
-write_func_def(uint32_t);
-read_func_def(uint32_t);
+  int fds[MESSAGE_MAX_FDS];
+  size_t fds_len;
+  size_t fds_pos;
+};
 
-write_func_def(uint8_t);
-read_func_def(uint8_t);
+enum MessageSendStatus {
+  MessageSendDone,
+  MessageSendPending,
+  MessageSendFailed
+};
 
-ssize_t write_string(int fd, const char *restrict str);
+#define message_put_func_def(type) \
+  bool message_put_## type(struct message *msg, type val)
 
-ssize_t read_string(int fd, char *restrict buf, size_t buf_size);
+#define message_get_func_def(type) \
+  bool message_get_## type(struct message *msg, type *val)
 
-bool exec_command(char *restrict buf, size_t len, const char *restrict file, char *const argv[]);
+void message_init(struct message *msg);
 
-bool check_unix_socket(int fd, bool block);
+void message_free(struct message *msg);
+
+bool message_put(struct message *msg, const void *data, size_t len);
+
+message_put_func_def(size_t);
+message_get_func_def(size_t);
+
+message_put_func_def(uint32_t);
+message_get_func_def(uint32_t);
+
+message_put_func_def(uint8_t);
+message_get_func_def(uint8_t);
+
+bool message_put_string(struct message *msg, const char *restrict str);
+
+bool message_get(struct message *msg, void *restrict out, size_t len);
 
-int non_blocking_execv(const char *restrict file, char *const argv[]);
+bool message_get_string(struct message *msg, char *restrict buf, size_t buf_size);
+
+int message_take_fd(struct message *msg);
+
+enum MessageSendStatus message_send_partial(int fd, const struct message *msg, const int *fds, size_t fds_len, size_t *restrict sent);
+
+bool message_send(int fd, const struct message *msg, const int *fds, size_t fds_len);
+
+bool message_recv(int fd, struct message *msg);
+
+ssize_t write_uint8_t(int fd, uint8_t val);
+
+ssize_t read_uint8_t(int fd, uint8_t *val);
+
+bool check_unix_socket(int fd, bool block);
 
 void stringify_root_impl_name(struct root_impl impl, char *restrict output);
 
 int save_mns_fd(int pid, enum MountNamespaceState mns_state, struct root_impl impl);
 
+void prewarm_mns_fds(int pid, struct root_impl impl);
+
 #endif /* UTILS_H */
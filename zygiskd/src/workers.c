@@ -0,0 +1,183 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sys/eventfd.h>
+
+#include <unistd.h>
+#include <pthread.h>
+
+#include "utils.h"
+#include "workers.h"
+
+struct worker_job {
+  void (*run)(void *data);
+  void *data;
+  size_t queue;
+};
+
+struct worker_queue {
+  struct worker_job jobs[WORKER_QUEUE_CAPACITY];
+  size_t head;
+  size_t len;
+  /* INFO: Jobs queued, running or done but not yet collected */
+  size_t in_flight;
+};
+
+static struct worker_queue queues[WORKER_QUEUES_MAX];
+static size_t queues_len = 0;
+/* INFO: Queue to be looked first, rotated so that one busy queue cannot
+           starve the others. */
+static size_t next_queue = 0;
+
+static struct worker_job done_jobs[WORKER_QUEUES_MAX * WORKER_QUEUE_CAPACITY];
+static size_t done_len = 0;
+
+static pthread_mutex_t workers_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t workers_cond = PTHREAD_COND_INITIALIZER;
+
+static int event_fd = -1;
+
+static bool pop_job(struct worker_job *restrict job) {
+  for (size_t i = 0; i < queues_len; i++) {
+    size_t queue_index = (next_queue + i) % queues_len;
+    struct worker_queue *queue = &queues[queue_index];
+
+    if (queue->len == 0) continue;
+
+    *job = queue->jobs[queue->head];
+    queue->head = (queue->head + 1) % WORKER_QUEUE_CAPACITY;
+    queue->len--;
+
+    next_queue = (queue_index + 1) % queues_len;
+
+    return true;
+  }
+
+  return false;
+}
+
+static void *worker_thread(void *arg) {
+  (void)arg;
+
+  while (1) {
+    struct worker_job job;
+
+    pthread_mutex_lock(&workers_lock);
+    while (!pop_job(&job)) {
+      pthread_cond_wait(&workers_cond, &workers_lock);
+    }
+    pthread_mutex_unlock(&workers_lock);
+
+    job.run(job.data);
+
+    pthread_mutex_lock(&workers_lock);
+    done_jobs[done_len++] = job;
+    pthread_mutex_unlock(&workers_lock);
+
+    uint64_t signal = 1;
+    if (write(event_fd, &signal, sizeof(signal)) == -1) {
+      LOGE("Failed to signal finished job: %s\n", strerror(errno));
+    }
+  }
+
+  return NULL;
+}
+
+bool workers_start(size_t queues_count) {
+  if (queues_count == 0 || queues_count > WORKER_QUEUES_MAX) {
+    LOGE("Invalid amount of worker queues: %zu\n", queues_count);
+
+    return false;
+  }
+
+  event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (event_fd == -1) {
+    LOGE("eventfd: %s\n", strerror(errno));
+
+    return false;
+  }
+
+  queues_len = queues_count;
+
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t threads = cpus < 1 ? 1 : (size_t)cpus;
+  if (threads > WORKER_THREADS_MAX) threads = WORKER_THREADS_MAX;
+
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+  size_t started = 0;
+  for (size_t i = 0; i < threads; i++) {
+    pthread_t thread;
+    int ret = pthread_create(&thread, &attr, worker_thread, NULL);
+    if (ret != 0) {
+      LOGE("Failed to create worker thread: %s\n", strerror(ret));
+
+      continue;
+    }
+
+    started++;
+  }
+
+  pthread_attr_destroy(&attr);
+
+  if (started == 0) {
+    close(event_fd);
+    event_fd = -1;
+
+    return false;
+  }
+
+  LOGI("Started %zu worker threads\n", started);
+
+  return true;
+}
+
+int workers_get_event_fd(void) {
+  return event_fd;
+}
+
+/* INFO: Returns false if the queue is full, leaving the caller to retry
+           once previous jobs of the queue are collected. */
+bool workers_submit(size_t queue_index, void (*run)(void *data), void *data) {
+  pthread_mutex_lock(&workers_lock);
+
+  struct worker_queue *queue = &queues[queue_index];
+  if (queue->in_flight == WORKER_QUEUE_CAPACITY) {
+    pthread_mutex_unlock(&workers_lock);
+
+    return false;
+  }
+
+  size_t tail = (queue->head + queue->len) % WORKER_QUEUE_CAPACITY;
+  queue->jobs[tail].run = run;
+  queue->jobs[tail].data = data;
+  queue->jobs[tail].queue = queue_index;
+  queue->len++;
+  queue->in_flight++;
+
+  pthread_cond_signal(&workers_cond);
+  pthread_mutex_unlock(&workers_lock);
+
+  return true;
+}
+
+/* INFO: Collects one finished job, returning its data, or NULL if none */
+void *workers_take_done(void) {
+  pthread_mutex_lock(&workers_lock);
+
+  if (done_len == 0) {
+    pthread_mutex_unlock(&workers_lock);
+
+    return NULL;
+  }
+
+  struct worker_job job = done_jobs[--done_len];
+  queues[job.queue].in_flight--;
+
+  pthread_mutex_unlock(&workers_lock);
+
+  return job.data;
+}
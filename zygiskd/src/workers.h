@@ -0,0 +1,24 @@
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <stddef.h>
+
+#include "constants.h"
+
+#define WORKER_QUEUES_MAX 4
+#define WORKER_THREADS_MAX 8
+
+/* INFO: Maximum of jobs of a single queue that may be queued, running or
+           awaiting to be collected at the same time. Once reached, the
+           queue refuses new jobs until the previous ones are collected. */
+#define WORKER_QUEUE_CAPACITY 16
+
+bool workers_start(size_t queues);
+
+int workers_get_event_fd(void);
+
+bool workers_submit(size_t queue, void (*run)(void *data), void *data);
+
+void *workers_take_done(void);
+
+#endif /* WORKERS_H */
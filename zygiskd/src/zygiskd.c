@@ -6,6 +6,7 @@
 #include <sys/un.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/epoll.h>
 #include <sys/sendfile.h>
 #include <fcntl.h>
 #include <errno.h>
@@ -21,16 +22,87 @@
 #include "root_impl/common.h"
 #include "constants.h"
 #include "utils.h"
+#include "spawn.h"
+#include "workers.h"
+
+enum EventSourceType {
+  SourceListener,
+  SourceClient,
+  SourceCompanion,
+  SourceWorkers,
+  SourcePolicies
+};
+
+/* INFO: Everything watched by the event loop has one of those as its
+           epoll data, so that the loop knows what became ready. */
+struct EventSource {
+  enum EventSourceType type;
+  void *data;
+};
+
+struct Connection;
+
+/* INFO: Requests that may take a while, like policy lookups or building a
+           mount namespace, are run by the workers, one queue per action. */
+enum WorkerQueues {
+  ProcessFlagsQueue,
+  MountNamespaceQueue,
+  SpecializeBundleQueue,
+  WorkerQueuesCount
+};
 
 struct Module {
   char *name;
   int lib_fd;
+  /* INFO: O_PATH, only used to reopen the directory without a path walk */
+  int dir_fd;
+  /* INFO: Modules with a "zygisk/preload" file are loaded once in zygote,
+             instead of in every process it forks. As they can't be
+             dlclosed anymore, forks that don't run them, or where they ask
+             to be closed, unmap them instead: they must not leave anything
+             pointing into themselves from their constructors. */
+  bool preload;
   int companion;
+  /* INFO: While a companion is being spawned, its socket is watched by the
+             event loop and the clients requesting it wait in a list, so that
+             loading the module in the companion doesn't block the daemon. */
+  int companion_pending;
+  struct Connection *companion_waiters;
+  struct EventSource companion_source;
 };
 
 struct Context {
   struct Module *modules;
   size_t len;
+  /* INFO: The lib_fd of every module, in order, so that they can be sent
+             all at once to zygote. */
+  int *lib_fds;
+  /* INFO: Responses which only depend on the modules and root
+             implementation, encoded once at startup. Those never change
+             while zygiskd runs. */
+  struct message modules_manifest;
+  struct message info_manifest;
+  struct root_impl impl;
+  char *restrict *argv;
+  int epoll_fd;
+  bool first_process;
+  /* INFO: Read-only fd of the policy table, -1 when it is not shared */
+  int policy_table_fd;
+  /* INFO: The linker offsets last stored by zygote, empty if none. Opaque
+             to ReZygiskd, zygote checks whether they still apply. */
+  struct message linker_cache;
+
+  int socket_fd;
+  struct EventSource listener_source;
+  bool accepting;
+
+  /* INFO: Requests refused by a full worker queue, submitted again as soon
+             as the queue has room. While too many are waiting, new clients
+             are left in the listen backlog. */
+  bool has_workers;
+  struct Connection *backlog[WorkerQueuesCount];
+  struct Connection *backlog_tail[WorkerQueuesCount];
+  size_t backlog_len;
 };
 
 enum Architecture {
@@ -44,6 +116,7 @@ enum Architecture {
 #define TMP_PATH "/data/adb/rezygisk"
 #define CONTROLLER_SOCKET TMP_PATH "/init_monitor"
 #define PATH_CP_NAME TMP_PATH "/" lp_select("cp32.sock", "cp64.sock")
+#define PATH_LINKER_CACHE TMP_PATH "/" lp_select("linker32.cache", "linker64.cache")
 #define ZYGISKD_FILE PATH_MODULES_DIR "/rezygisk/bin/zygiskd" lp_select("32", "64")
 #define ZYGISKD_PATH "/data/adb/modules/rezygisk/bin/zygiskd" lp_select("32", "64")
 
@@ -64,10 +137,22 @@ static enum Architecture get_arch(void) {
   exit(1);
 }
 
+static const char *get_arch_name(enum Architecture arch) {
+  switch (arch) {
+    case ARM64: { return "arm64-v8a"; }
+    case X86_64: { return "x86_64"; }
+    case ARM32: { return "armeabi-v7a"; }
+    case X86: { return "x86"; }
+  }
+
+  return "";
+}
+
 /* WARNING: Dynamic memory based */
 static void load_modules(enum Architecture arch, struct Context *restrict context) {
   context->len = 0;
   context->modules = NULL;
+  context->lib_fds = NULL;
 
   DIR *dir = opendir(PATH_MODULES_DIR);
   if (dir == NULL) {
@@ -76,13 +161,7 @@ static void load_modules(enum Architecture arch, struct Context *restrict contex
     return;
   }
 
-  char arch_str[32];
-  switch (arch) {
-    case ARM64: { strcpy(arch_str, "arm64-v8a"); break; }
-    case X86_64: { strcpy(arch_str, "x86_64"); break; }
-    case ARM32: { strcpy(arch_str, "armeabi-v7a"); break; }
-    case X86: { strcpy(arch_str, "x86"); break; }
-  }
+  const char *arch_str = get_arch_name(arch);
 
   LOGI("Loading modules for architecture: %s\n", arch_str);
 
@@ -116,6 +195,13 @@ static void load_modules(enum Architecture arch, struct Context *restrict contex
       errno = 0;
     } else continue;
 
+    /* INFO: One fd is left for the mount namespace in specialize bundles */
+    if (context->len == MESSAGE_MAX_FDS - 1) {
+      LOGW("Too many modules, skipping module `%s`\n", name);
+
+      continue;
+    }
+
     int lib_fd = open(so_path, O_RDONLY | O_CLOEXEC);
     if (lib_fd == -1) {
       LOGE("Failed loading module `%s`\n", name);
@@ -123,6 +209,14 @@ static void load_modules(enum Architecture arch, struct Context *restrict contex
       continue;
     }
 
+    int dir_fd = openat(dirfd(dir), name, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd == -1) {
+      LOGE("Failed opening directory of module `%s`: %s\n", name, strerror(errno));
+
+      close(lib_fd);
+
+      continue;
+    }
 
     context->modules = realloc(context->modules, (size_t)((context->len + 1) * sizeof(struct Module)));
     if (context->modules == NULL) {
@@ -131,9 +225,22 @@ static void load_modules(enum Architecture arch, struct Context *restrict contex
       return;
     }
 
+    context->lib_fds = realloc(context->lib_fds, (size_t)((context->len + 1) * sizeof(int)));
+    if (context->lib_fds == NULL) {
+      LOGE("Failed reallocating memory for module fds.\n");
+
+      return;
+    }
+
+    context->lib_fds[context->len] = lib_fd;
+
     context->modules[context->len].name = strdup(name);
     context->modules[context->len].lib_fd = lib_fd;
+    context->modules[context->len].dir_fd = dir_fd;
+    context->modules[context->len].preload = faccessat(dir_fd, "zygisk/preload", F_OK, 0) == 0;
     context->modules[context->len].companion = -1;
+    context->modules[context->len].companion_pending = -1;
+    context->modules[context->len].companion_waiters = NULL;
     context->len++;
   }
 
@@ -143,7 +250,10 @@ static void load_modules(enum Architecture arch, struct Context *restrict contex
 static void free_modules(struct Context *restrict context) {
   for (size_t i = 0; i < context->len; i++) {
     free(context->modules[i].name);
+    close(context->modules[i].lib_fd);
+    close(context->modules[i].dir_fd);
     if (context->modules[i].companion != -1) close(context->modules[i].companion);
+    if (context->modules[i].companion_pending != -1) close(context->modules[i].companion_pending);
   }
 }
 
@@ -153,9 +263,12 @@ static int create_daemon_socket(void) {
   return unix_listener_from_path(PATH_CP_NAME);
 }
 
+/* INFO: Only starts the companion and hands it the module. Its response is
+           read by the event loop once available, as the companion may take a
+           while to load the module library. */
 static int spawn_companion(char *restrict argv[], char *restrict name, int lib_fd) {
   int sockets[2];
-  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) == -1) {
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sockets) == -1) {
     LOGE("Failed creating socket pair.\n");
 
     return -1;
@@ -164,75 +277,6 @@ static int spawn_companion(char *restrict argv[], char *restrict name, int lib_f
   int daemon_fd = sockets[0];
   int companion_fd = sockets[1];
 
-  pid_t pid = fork();
-  if (pid < 0) {
-    LOGE("Failed forking companion: %s\n", strerror(errno));
-
-    close(companion_fd);
-    close(daemon_fd);
-
-    exit(1);
-  } else if (pid > 0) {
-    close(companion_fd);
-
-    int status = 0;
-    waitpid(pid, &status, 0);
-
-    if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
-      if (write_string(daemon_fd, name) == -1) {
-        LOGE("Failed writing module name.\n");
-
-        close(daemon_fd);
-
-        return -1;
-      }
-      if (write_fd(daemon_fd, lib_fd) == -1) {
-        LOGE("Failed sending library fd.\n");
-
-        close(daemon_fd);
-
-        return -1;
-      }
-      
-      uint8_t response = 0;
-      ssize_t ret = read_uint8_t(daemon_fd, &response);
-      if (ret <= 0) {
-        LOGE("Failed reading companion response.\n");
-
-        close(daemon_fd);
-
-        return -1;
-      }
-
-      switch (response) {
-        /* INFO: Even without any entry, we should still just deal with it */
-        case 0: { return -2; }
-        case 1: { return daemon_fd; }
-        /* TODO: Should we be closing daemon socket here? (in non-0-and-1 case) */
-        default: {
-          return -1;
-        }
-      }
-      /* TODO: Should we be closing daemon socket here? */
-    } else {
-      LOGE("Exited with status %d\n", status);
-
-      return -1;
-    }
-  /* INFO: if pid == 0: */
-  } else {
-    /* INFO: There is no case where this will fail with a valid fd. */
-    /* INFO: Remove FD_CLOEXEC flag to avoid closing upon exec */
-    if (fcntl(companion_fd, F_SETFD, 0) == -1) {
-      LOGE("Failed removing FD_CLOEXEC flag: %s\n", strerror(errno));
-
-      close(companion_fd);
-      close(daemon_fd);
-
-      exit(1);
-    }
-  }
-
   char *process = argv[0];
   char nice_name[256];
   char *last = strrchr(process, '/');
@@ -249,15 +293,45 @@ static int spawn_companion(char *restrict argv[], char *restrict name, int lib_f
   snprintf(companion_fd_str, sizeof(companion_fd_str), "%d", companion_fd);
 
   char *eargv[] = { process_name, "companion", companion_fd_str, NULL };
-  if (non_blocking_execv(ZYGISKD_PATH, eargv) == -1) {
-    LOGE("Failed executing companion: %s\n", strerror(errno));
+  pid_t pid = spawn_process(ZYGISKD_PATH, eargv, -1, companion_fd);
+  close(companion_fd);
+
+  if (pid == -1) {
+    LOGE("Failed spawning companion: %s\n", strerror(errno));
+
+    close(daemon_fd);
+
+    return -1;
+  }
+
+  /* INFO: The companion detaches itself right away, so only that first
+             process is waited for, and it is never left as a zombie. */
+  int status = 0;
+  while (waitpid(pid, &status, 0) == -1 && errno == EINTR);
+
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    LOGE("Exited with status %d\n", status);
+
+    close(daemon_fd);
 
-    close(companion_fd);
+    return -1;
+  }
+
+  struct message msg;
+  message_init(&msg);
+
+  bool sent = message_put_string(&msg, name) && message_send(daemon_fd, &msg, &lib_fd, 1);
+  message_free(&msg);
 
-    exit(1);
+  if (!sent) {
+    LOGE("Failed sending module to companion.\n");
+
+    close(daemon_fd);
+
+    return -1;
   }
 
-  exit(0);
+  return daemon_fd;
 }
 
 struct __attribute__((__packed__)) MsgHead {
@@ -265,437 +339,1175 @@ struct __attribute__((__packed__)) MsgHead {
   int length;
 };
 
-/* WARNING: Dynamic memory based */
-void zygiskd_start(char *restrict argv[]) {
-  /* INFO: When implementation is None or Multiple, it won't set the values 
-            for the context, causing it to have garbage values. In response
-            to that, "= { 0 }" is used to ensure that the values are clean. */
-  struct Context context = { 0 };
+/* INFO: The biggest request is GetSpecializeBundle, with the message
+           length, the action, the uid, the process name length,
+           PROCESS_NAME_MAX_LEN bytes of process name, the pid and whether
+           it is the system server. */
+#define CONNECTION_BUFFER_SIZE 512
+#define MAX_EVENTS 32
+#define MAX_BACKLOG_LEN 64
+#define LINKER_CACHE_MAX_LEN 256
+
+struct Request {
+  enum DaemonSocketAction action;
+  uint32_t uid;
+  char process[PROCESS_NAME_MAX_LEN];
+  size_t index;
+  uint32_t pid;
+  uint8_t mns_state;
+  bool system_server;
+  /* INFO: Decided in the order requests arrive, before reaching the workers */
+  bool first_process;
+  uint8_t linker_cache[LINKER_CACHE_MAX_LEN];
+  size_t linker_cache_len;
+};
 
-  struct root_impl impl;
-  get_impl(&impl);
-  if (impl.impl == None || impl.impl == Multiple) {
-    char *msg_data = NULL;
+/* INFO: Each client connection carries exactly one request. Its bytes are
+           accumulated until the request is complete, and the response is
+           queued so that it can be written whenever the client is ready,
+           without ever blocking the event loop. */
+struct Connection {
+  struct EventSource source;
+  /* INFO: Only the modules, which never change after startup, may be read
+             from it by the workers. */
+  const struct Context *context;
+  int fd;
+  bool watched;
+
+  uint8_t in[CONNECTION_BUFFER_SIZE];
+  size_t in_len;
+
+  struct message out;
+  /* INFO: Either out, or a response shared by all connections */
+  const struct message *response;
+  size_t out_sent;
+  /* INFO: Sent along with the response. They belong to the context, except
+             for out_fd, which is closed with the connection. */
+  const int *out_fds;
+  size_t out_fds_len;
+  int out_fd;
+  /* INFO: The module fds followed by out_fd, when both are sent */
+  int *out_fds_buf;
+  /* INFO: Only waiting for the client to be writable */
+  bool responding;
+
+  struct Request req;
+
+  struct Connection *next;
+};
 
-    if (impl.impl == None) msg_data = "Unsupported environment: Unknown root implementation";
-    else msg_data = "Unsupported environment: Multiple root implementations found";
+enum RequestStatus {
+  RequestIncomplete,
+  RequestComplete,
+  RequestInvalid
+};
 
-    struct MsgHead msg = {
-      .cmd = DAEMON_SET_ERROR_INFO,
-      .length = (int)strlen(msg_data) + 1
-    };
+enum FlushStatus {
+  FlushDone,
+  FlushPending,
+  FlushFailed
+};
 
-    unix_datagram_sendto(CONTROLLER_SOCKET, &msg, sizeof(struct MsgHead));
-    unix_datagram_sendto(CONTROLLER_SOCKET, msg_data, (size_t)msg.length);
+static struct Connection *connection_create(const struct Context *context, int fd) {
+  struct Connection *conn = malloc(sizeof(struct Connection));
+  if (conn == NULL) {
+    LOGE("Failed allocating memory for connection.\n");
 
-    free(msg_data);
-  } else {
-    enum Architecture arch = get_arch();
-    load_modules(arch, &context);
+    return NULL;
+  }
 
-    char *module_list = NULL;
-    size_t module_list_len = 0;
-    if (context.len == 0) {
-      module_list = strdup("None");
-      module_list_len = strlen("None");
-    } else {
-      for (size_t i = 0; i < context.len; i++) {
-        if (i != context.len - 1) {
-          module_list = realloc(module_list, module_list_len + strlen(context.modules[i].name) + strlen(", ") + 1);
-          if (module_list == NULL) {
-            LOGE("Failed reallocating memory for module list.\n");
+  conn->source.type = SourceClient;
+  conn->source.data = conn;
+  conn->context = context;
+  conn->fd = fd;
+  conn->watched = false;
+  conn->in_len = 0;
+  message_init(&conn->out);
+  conn->response = &conn->out;
+  conn->out_sent = 0;
+  conn->out_fds = NULL;
+  conn->out_fds_len = 0;
+  conn->out_fd = -1;
+  conn->out_fds_buf = NULL;
+  conn->responding = false;
+  conn->next = NULL;
+
+  return conn;
+}
 
-            return;
-          }
+static void connection_destroy(struct Context *context, struct Connection *conn) {
+  if (conn->watched) epoll_ctl(context->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
 
-          strcpy(module_list + module_list_len, context.modules[i].name);
+  close(conn->fd);
+  if (conn->out_fd != -1) close(conn->out_fd);
+  free(conn->out_fds_buf);
 
-          module_list_len += strlen(context.modules[i].name);
+  message_free(&conn->out);
+  free(conn);
+}
 
-          strcpy(module_list + module_list_len, ", ");
+static bool connection_watch(struct Context *context, struct Connection *conn, uint32_t events) {
+  struct epoll_event ev = {
+    .events = events,
+    .data.ptr = &conn->source
+  };
 
-          module_list_len += strlen(", ");
-        } else {
-          module_list = realloc(module_list, module_list_len + strlen(context.modules[i].name) + 1);
-          if (module_list == NULL) {
-            LOGE("Failed reallocating memory for module list.\n");
+  if (epoll_ctl(context->epoll_fd, conn->watched ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, conn->fd, &ev) == -1) {
+    LOGE("epoll_ctl: %s\n", strerror(errno));
 
-            return;
-          }
+    return false;
+  }
 
-          strcpy(module_list + module_list_len, context.modules[i].name);
+  conn->watched = true;
 
-          module_list_len += strlen(context.modules[i].name);
-        }
-      }
-    }
+  return true;
+}
 
-    char impl_name[LONGEST_ROOT_IMPL_NAME];
-    stringify_root_impl_name(impl, impl_name);
+static void connection_unwatch(struct Context *context, struct Connection *conn) {
+  if (!conn->watched) return;
 
-    size_t msg_length = strlen("Root: , Modules: ") + strlen(impl_name) + module_list_len + 1;
+  epoll_ctl(context->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+  conn->watched = false;
+}
 
-    struct MsgHead msg = {
-      .cmd = DAEMON_SET_INFO,
-      .length = (int)msg_length
-    };
+/* INFO: Reads whatever is available. Returns false if reading failed. */
+static bool connection_fill(struct Connection *conn, bool *restrict eof) {
+  while (conn->in_len < sizeof(conn->in)) {
+    ssize_t ret = read(conn->fd, conn->in + conn->in_len, sizeof(conn->in) - conn->in_len);
+    if (ret > 0) {
+      conn->in_len += (size_t)ret;
 
-    char *msg_data = malloc(msg_length);
-    if (msg_data == NULL) {
-      LOGE("Failed allocating memory for message data.\n");
+      continue;
+    }
 
-      return;
+    if (ret == 0) {
+      *eof = true;
+
+      return true;
     }
 
-    snprintf(msg_data, msg_length, "Root: %s, Modules: %s", impl_name, module_list);
+    if (errno == EINTR) continue;
+    if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
 
-    unix_datagram_sendto(CONTROLLER_SOCKET, &msg, sizeof(struct MsgHead));
-    unix_datagram_sendto(CONTROLLER_SOCKET, msg_data, msg_length);
+    LOGE("read: %s\n", strerror(errno));
 
-    free(msg_data);
-    free(module_list);
+    return false;
   }
 
-  int socket_fd = create_daemon_socket();
-  if (socket_fd == -1) {
-    LOGE("Failed creating daemon socket\n");
+  return true;
+}
 
-    return;
+/* INFO: Requests like PingHeartbeat have no response at all, the client
+           closing the connection right after sending them. */
+static bool request_has_response(enum DaemonSocketAction action) {
+  switch (action) {
+    case PingHeartbeat:
+    case ZygoteRestart:
+    case SystemServerStarted:
+    case PutLinkerCache: {
+      return false;
+    }
+    default: {
+      return true;
+    }
   }
+}
 
-  struct sigaction sa = { .sa_handler = SIG_IGN };
-  sigaction(SIGPIPE, &sa, NULL);
+static enum FlushStatus connection_flush(struct Connection *conn) {
+  if (!request_has_response(conn->req.action)) return FlushDone;
 
-  bool first_process = true;
-  while (1) {
-    int client_fd = accept(socket_fd, NULL, NULL);
-    if (client_fd == -1) {
-      LOGE("accept: %s\n", strerror(errno));
+  /* INFO: An empty response is still sent as a zero-length frame, so that
+             the client tells "nothing" apart from a broken connection. */
 
-      return;
-    }
+  switch (message_send_partial(conn->fd, conn->response, conn->out_fds, conn->out_fds_len, &conn->out_sent)) {
+    case MessageSendDone: { return FlushDone; }
+    case MessageSendPending: { return FlushPending; }
+    case MessageSendFailed: { return FlushFailed; }
+  }
 
-    uint8_t action8 = 0;
-    ssize_t len = read_uint8_t(client_fd, &action8);
-    if (len == -1) {
-      LOGE("read: %s\n", strerror(errno));
+  return FlushFailed;
+}
 
-      return;
-    } else if (len == 0) {
-      LOGI("Client disconnected\n");
+/* INFO: Sends the queued response and closes the connection, waiting for
+           the client to be writable if needed. */
+static void connection_finish(struct Context *context, struct Connection *conn) {
+  switch (connection_flush(conn)) {
+    case FlushPending: {
+      conn->responding = true;
+      if (connection_watch(context, conn, EPOLLOUT)) return;
 
-      return;
+      break;
+    }
+    case FlushDone:
+    case FlushFailed: {
+      break;
     }
+  }
 
-    enum DaemonSocketAction action = (enum DaemonSocketAction)action8;
+  connection_destroy(context, conn);
+}
 
-    switch (action) {
-      case PingHeartbeat: {
-        struct MsgHead msg = {
-          .cmd = ZYGOTE_INJECTED,
-          .length = 0
-        };
+static enum RequestStatus message_get_process(struct message *msg, struct Request *restrict req) {
+  if (!message_get_uint32_t(msg, &req->uid)) return RequestInvalid;
+  if (!message_get_string(msg, req->process, sizeof(req->process))) return RequestInvalid;
 
-        unix_datagram_sendto(CONTROLLER_SOCKET, &msg, sizeof(struct MsgHead));
+  return RequestComplete;
+}
 
-        break;
-      }
-      case ZygoteRestart: {
-        for (size_t i = 0; i < context.len; i++) {
-          if (context.modules[i].companion != -1) {
-            close(context.modules[i].companion);
-            context.modules[i].companion = -1;
-          }
-        }
+/* INFO: Waits until the whole message is in, and then parses it at once */
+static enum RequestStatus parse_request(const struct Connection *conn, struct Request *restrict req) {
+  uint32_t msg_len = 0;
+  if (conn->in_len < sizeof(msg_len)) return RequestIncomplete;
 
-        break;
-      }
-      case SystemServerStarted: {
-        struct MsgHead msg = {
-          .cmd = SYSTEM_SERVER_STARTED,
-          .length = 0
-        };
+  memcpy(&msg_len, conn->in, sizeof(msg_len));
+  if (msg_len > sizeof(conn->in) - sizeof(msg_len)) {
+    LOGE("Request is too big: %u bytes\n", msg_len);
 
-        unix_datagram_sendto(CONTROLLER_SOCKET, &msg, sizeof(struct MsgHead));
+    return RequestInvalid;
+  }
 
-        if (impl.impl == None || impl.impl == Multiple) {
-          LOGI("Unsupported environment detected. Exiting.\n");
+  if (conn->in_len - sizeof(msg_len) < msg_len) return RequestIncomplete;
 
-          close(client_fd);
-          close(socket_fd);
-          free_modules(&context);
+  /* INFO: Only a view of the connection buffer, hence never freed */
+  struct message msg;
+  message_init(&msg);
+  msg.data = (uint8_t *)conn->in + sizeof(msg_len);
+  msg.len = msg_len;
 
-          exit(1);
-        }
+  uint8_t action8 = 0;
+  if (!message_get_uint8_t(&msg, &action8)) return RequestInvalid;
 
-        break;
-      }
-      case GetProcessFlags: {
-        uint32_t uid = 0;
-        ssize_t ret = read_uint32_t(client_fd, &uid);
-        ASSURE_SIZE_READ_BREAK("GetProcessFlags", "uid", ret, sizeof(uid));
+  req->action = (enum DaemonSocketAction)action8;
 
-        /* INFO: Only used for Magisk, as it saves process names and not UIDs. */
-        char process[PROCESS_NAME_MAX_LEN];
-        ret = read_string(client_fd, process, sizeof(process));
-        if (ret == -1) {
-          LOGE("Failed reading process name.\n");
+  switch (req->action) {
+    case PingHeartbeat:
+    case GetInfo:
+    case ReadModules:
+    case GetPolicyTable:
+    case GetLinkerCache:
+    case ZygoteRestart:
+    case SystemServerStarted: {
+      return RequestComplete;
+    }
+    case PutLinkerCache: {
+      /* INFO: The rest of the request is the cache itself */
+      req->linker_cache_len = msg.len - msg.pos;
+      if (req->linker_cache_len == 0 || req->linker_cache_len > sizeof(req->linker_cache)) return RequestInvalid;
+      if (!message_get(&msg, req->linker_cache, req->linker_cache_len)) return RequestInvalid;
 
-          break;
-        }
+      return RequestComplete;
+    }
+    case GetProcessFlags: {
+      return message_get_process(&msg, req);
+    }
+    case RequestCompanionSocket:
+    case GetModuleDir: {
+      if (!message_get_size_t(&msg, &req->index)) return RequestInvalid;
 
-        uint32_t flags = 0;
-        if (first_process) {
-          flags |= PROCESS_IS_FIRST_STARTED;
+      return RequestComplete;
+    }
+    case UpdateMountNamespace: {
+      if (!message_get_uint32_t(&msg, &req->pid)) return RequestInvalid;
+      if (!message_get_uint8_t(&msg, &req->mns_state)) return RequestInvalid;
 
-          first_process = false;
-        } else {
-          if (uid_is_manager(uid)) {
-            flags |= PROCESS_IS_MANAGER;
-          } else {
-            if (uid_granted_root(uid)) {
-              flags |= PROCESS_GRANTED_ROOT;
-            }
-            if (uid_should_umount(uid, (const char *const)process)) {
-              flags |= PROCESS_ON_DENYLIST;
-            }
-          }
-        }
+      return RequestComplete;
+    }
+    case GetSpecializeBundle: {
+      if (message_get_process(&msg, req) != RequestComplete) return RequestInvalid;
+      if (!message_get_uint32_t(&msg, &req->pid)) return RequestInvalid;
 
-        switch (impl.impl) {
-          case None: { break; }
-          case Multiple: { break; }
-          case KernelSU: {
-            flags |= PROCESS_ROOT_IS_KSU;
+      uint8_t system_server = 0;
+      if (!message_get_uint8_t(&msg, &system_server)) return RequestInvalid;
 
-            break;
-          }
-          case APatch: {
-            flags |= PROCESS_ROOT_IS_APATCH;
+      req->system_server = system_server != 0;
 
-            break;
-          }
-          case Magisk: {
-            flags |= PROCESS_ROOT_IS_MAGISK;
+      return RequestComplete;
+    }
+  }
 
-            break;
-          }
-        }
+  LOGE("Unknown action: %u\n", action8);
 
-        ret = write_uint32_t(client_fd, flags);
-        ASSURE_SIZE_WRITE_BREAK("GetProcessFlags", "flags", ret, sizeof(flags));
+  return RequestInvalid;
+}
 
-        break;
-      }
-      case GetInfo: {
-        uint32_t flags = 0;
+static uint32_t get_root_impl_flags(struct root_impl impl) {
+  switch (impl.impl) {
+    case None: { return 0; }
+    case Multiple: { return 0; }
+    case KernelSU: { return PROCESS_ROOT_IS_KSU; }
+    case APatch: { return PROCESS_ROOT_IS_APATCH; }
+    case Magisk: { return PROCESS_ROOT_IS_MAGISK; }
+  }
 
-        switch (impl.impl) {
-          case None: { break; }
-          case Multiple: { break; }
-          case KernelSU: {
-            flags |= PROCESS_ROOT_IS_KSU;
+  return 0;
+}
 
-            break;
-          }
-          case APatch: {
-            flags |= PROCESS_ROOT_IS_APATCH;
+static uint32_t get_process_flags(const struct Request *req, struct root_impl impl) {
+  uint32_t flags = 0;
+  if (req->first_process) {
+    flags |= PROCESS_IS_FIRST_STARTED;
+  } else {
+    flags |= uid_get_policy_flags(req->uid, (const char *const)req->process);
+  }
 
-            break;
-          }
-          case Magisk: {
-            flags |= PROCESS_ROOT_IS_MAGISK;
+  return flags | get_root_impl_flags(impl);
+}
 
-            break;
-          }
-        }
+static void connection_out_modules(struct Connection *conn, const struct Context *context) {
+  message_put(&conn->out, context->modules_manifest.data, context->modules_manifest.len);
 
-        ssize_t ret = write_uint32_t(client_fd, flags);
-        ASSURE_SIZE_WRITE_BREAK("GetInfo", "flags", ret, sizeof(flags));
+  conn->out_fds = context->lib_fds;
+  conn->out_fds_len = context->len;
+}
 
-        /* TODO: Use pid_t */
-        uint32_t pid = (uint32_t)getpid();    
-        ret = write_uint32_t(client_fd, pid);
-        ASSURE_SIZE_WRITE_BREAK("GetInfo", "pid", ret, sizeof(pid));
+/* INFO: Sends a duplicate of the namespace fd along with the response, after
+           the module fds if any. The client owns its copy, so the daemon
+           may replace the cached namespace while it is still in flight. */
+static bool connection_out_mns_fd(struct Connection *conn, int ns_fd) {
+  conn->out_fd = fcntl(ns_fd, F_DUPFD_CLOEXEC, 0);
+  if (conn->out_fd == -1) {
+    LOGE("Failed duplicating mount namespace fd: %s\n", strerror(errno));
 
-        size_t modules_len = context.len;
-        ret = write_size_t(client_fd, modules_len);
-        ASSURE_SIZE_WRITE_BREAK("GetInfo", "modules_len", ret, sizeof(modules_len));
+    return false;
+  }
 
-        for (size_t i = 0; i < modules_len; i++) {
-          ret = write_string(client_fd, context.modules[i].name);
-          if (ret == -1) {
-            LOGE("Failed writing module name.\n");
+  if (conn->out_fds_len == 0) {
+    conn->out_fds = &conn->out_fd;
+    conn->out_fds_len = 1;
 
-            break;
-          }
-        }
+    return true;
+  }
 
-        break;
-      }
-      case ReadModules: {
-        size_t clen = context.len;
-        ssize_t ret = write_size_t(client_fd, clen);
-        ASSURE_SIZE_WRITE_BREAK("ReadModules", "len", ret, sizeof(clen));
-
-        enum Architecture arch = get_arch();
-
-        char arch_str[32];
-        switch (arch) {
-          case ARM64: { strcpy(arch_str, "arm64-v8a"); break; }
-          case X86_64: { strcpy(arch_str, "x86_64"); break; }
-          case ARM32: { strcpy(arch_str, "armeabi-v7a"); break; }
-          case X86: { strcpy(arch_str, "x86"); break; }
-        }
+  conn->out_fds_buf = malloc((conn->out_fds_len + 1) * sizeof(int));
+  if (conn->out_fds_buf == NULL) {
+    LOGE("Failed allocating memory for mount namespace fd.\n");
 
-        for (size_t i = 0; i < clen; i++) {
-          char lib_path[PATH_MAX];
-          snprintf(lib_path, PATH_MAX, "/data/adb/modules/%s/zygisk/%s.so", context.modules[i].name, arch_str);
+    close(conn->out_fd);
+    conn->out_fd = -1;
 
-          if (write_string(client_fd, lib_path) == -1) {
-            LOGE("Failed writing module path.\n");
+    return false;
+  }
 
-            break;
-          }
-        }
+  memcpy(conn->out_fds_buf, conn->out_fds, conn->out_fds_len * sizeof(int));
+  conn->out_fds_buf[conn->out_fds_len] = conn->out_fd;
 
-        break;
-      }
-      case RequestCompanionSocket: {
-        size_t index = 0;
-        ssize_t ret = read_size_t(client_fd, &index);
-        ASSURE_SIZE_READ_BREAK("RequestCompanionSocket", "index", ret, sizeof(index));
+  conn->out_fds = conn->out_fds_buf;
+  conn->out_fds_len++;
 
-        struct Module *module = &context.modules[index];
+  return true;
+}
 
-        if (module->companion != -1) {
-          if (!check_unix_socket(module->companion, false)) {
-            LOGE(" - Companion for module \"%s\" crashed\n", module->name);
+/* INFO: Saves the mounted namespace too, as the clean one is made from it.
+           Returns the fd of the clean namespace, or -1 on failure. */
+static int save_clean_mns_fd(pid_t pid, struct root_impl impl) {
+  save_mns_fd(pid, Mounted, impl);
 
-            close(module->companion);
-            module->companion = -1;
-          }
-        }
+  int ns_fd = save_mns_fd(pid, Clean, impl);
+  if (ns_fd == -1) {
+    LOGE("Failed to save mount namespace fd for pid %d: %s\n", pid, strerror(errno));
+  }
 
-        if (module->companion == -1) {
-          module->companion = spawn_companion(argv, module->name, module->lib_fd);
-
-          if (module->companion > 0) {
-            LOGI(" - Spawned companion for \"%s\": %d\n", module->name, module->companion);
-          } else {
-            if (module->companion == -2) {
-              LOGE(" - No companion spawned for \"%s\" because it has no entry.\n", module->name);
-            } else {
-              LOGE(" - Failed to spawn companion for \"%s\": %s\n", module->name, strerror(errno));
-            }
-          }
-        }
+  return ns_fd;
+}
 
-        /* 
-          INFO: Companion already exists or was created. In any way,
-                 it should be in the while loop to receive fds now,
-                 so just sending the file descriptor of the client is
-                 safe.
-        */
-        if (module->companion != -1) {
-          LOGI(" - Sending companion fd socket of module \"%s\"\n", module->name);
+/* INFO: Either answers the request now, or hands the connection to the
+           companion spawn it waits for. The connection is owned by the
+           callee in both cases. */
+static void companion_handoff(struct Context *context, struct Module *module, struct Connection *conn) {
+  if (module->companion != -1) {
+    LOGI(" - Sending companion fd socket of module \"%s\"\n", module->name);
 
-          if (write_fd(module->companion, client_fd) == -1) {
-            LOGE(" - Failed to send companion fd socket of module \"%s\"\n", module->name);
+    struct message msg;
+    message_init(&msg);
 
-            ret = write_uint8_t(client_fd, 0);
-            ASSURE_SIZE_WRITE_BREAK("RequestCompanionSocket", "response", ret, sizeof(int));
+    /* INFO: The companion answers the client itself, and owns its socket from now on */
+    bool sent = message_send(module->companion, &msg, &conn->fd, 1);
+    message_free(&msg);
 
-            close(module->companion);
-            module->companion = -1;
+    if (sent) {
+      connection_destroy(context, conn);
 
-            /* INFO: RequestCompanionSocket by default doesn't close the client_fd */
-            close(client_fd);
-          }
-        } else {
-          LOGE(" - Failed to spawn companion for module \"%s\"\n", module->name);
+      return;
+    }
 
-          ret = write_uint8_t(client_fd, 0);
-          ASSURE_SIZE_WRITE_BREAK("RequestCompanionSocket", "response", ret, sizeof(int));
+    LOGE(" - Failed to send companion fd socket of module \"%s\"\n", module->name);
 
-          /* INFO: RequestCompanionSocket by default doesn't close the client_fd */
-          close(client_fd);
-        }
+    close(module->companion);
+    module->companion = -1;
+  }
 
-        break;
-      }
-      case GetModuleDir: {
-        size_t index = 0;
-        ssize_t ret = read_size_t(client_fd, &index);
-        ASSURE_SIZE_READ_BREAK("GetModuleDir", "index", ret, sizeof(index));
+  message_put_uint8_t(&conn->out, 0);
+  connection_finish(context, conn);
+}
 
-        char module_dir[PATH_MAX];
-        snprintf(module_dir, PATH_MAX, "%s/%s", PATH_MODULES_DIR, context.modules[index].name);
+static void companion_on_event(struct Context *context, struct Module *module) {
+  int fd = module->companion_pending;
+  module->companion_pending = -1;
 
-        int fd = open(module_dir, O_RDONLY);
-        if (fd == -1) {
-          LOGE("Failed opening module directory \"%s\": %s\n", module_dir, strerror(errno));
+  epoll_ctl(context->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
 
-          break;
-        }
+  struct message msg;
+  bool received = message_recv(fd, &msg);
 
-        struct stat st;
-        if (fstat(fd, &st) == -1) {
-          LOGE("Failed getting module directory \"%s\" stats: %s\n", module_dir, strerror(errno));
+  uint8_t response = 0;
+  received = received && message_get_uint8_t(&msg, &response);
+  message_free(&msg);
 
-          close(fd);
+  if (received && response == 1) {
+    module->companion = fd;
 
-          break;
-        }
+    LOGI(" - Spawned companion for \"%s\": %d\n", module->name, fd);
+  } else {
+    if (received && response == 0) {
+      LOGE(" - No companion spawned for \"%s\" because it has no entry.\n", module->name);
+    } else {
+      LOGE(" - Failed to spawn companion for \"%s\"\n", module->name);
+    }
 
-        if (write_fd(client_fd, fd) == -1) {
-          LOGE("Failed sending module directory \"%s\" fd: %s\n", module_dir, strerror(errno));
+    close(fd);
+  }
 
-          close(fd);
+  struct Connection *waiter = module->companion_waiters;
+  module->companion_waiters = NULL;
 
-          break;
-        }
+  while (waiter != NULL) {
+    struct Connection *next = waiter->next;
+    companion_handoff(context, module, waiter);
 
-        break;
-      }
-      case UpdateMountNamespace: {
-        pid_t pid = 0;
-        ssize_t ret = read_uint32_t(client_fd, (uint32_t *)&pid);
-        ASSURE_SIZE_READ_BREAK("UpdateMountNamespace", "pid", ret, sizeof(pid));
+    waiter = next;
+  }
+}
 
-        uint8_t mns_state = 0;
-        ret = read_uint8_t(client_fd, &mns_state);
-        ASSURE_SIZE_READ_BREAK("UpdateMountNamespace", "mns_state", ret, sizeof(mns_state));
+static void handle_companion_request(struct Context *context, struct Connection *conn, size_t index) {
+  if (index >= context->len) {
+    LOGE("Invalid module index for RequestCompanionSocket: %zu\n", index);
 
-        uint32_t our_pid = (uint32_t)getpid();
-        ret = write_uint32_t(client_fd, our_pid);
-        ASSURE_SIZE_WRITE_BREAK("UpdateMountNamespace", "our_pid", ret, sizeof(our_pid));
+    message_put_uint8_t(&conn->out, 0);
+    connection_finish(context, conn);
 
-        if ((enum MountNamespaceState)mns_state == Clean)
-          save_mns_fd(pid, Mounted, impl);
+    return;
+  }
 
-        int ns_fd = save_mns_fd(pid, (enum MountNamespaceState)mns_state, impl);
+  struct Module *module = &context->modules[index];
+
+  if (module->companion != -1) {
+    if (!check_unix_socket(module->companion, false)) {
+      LOGE(" - Companion for module \"%s\" crashed\n", module->name);
+
+      close(module->companion);
+      module->companion = -1;
+    }
+  }
+
+  if (module->companion == -1 && module->companion_pending == -1) {
+    int companion_fd = spawn_companion(context->argv, module->name, module->lib_fd);
+    if (companion_fd == -1) {
+      LOGE(" - Failed to spawn companion for \"%s\": %s\n", module->name, strerror(errno));
+
+      message_put_uint8_t(&conn->out, 0);
+      connection_finish(context, conn);
+
+      return;
+    }
+
+    module->companion_source.type = SourceCompanion;
+    module->companion_source.data = module;
+
+    struct epoll_event ev = {
+      .events = EPOLLIN,
+      .data.ptr = &module->companion_source
+    };
+
+    if (epoll_ctl(context->epoll_fd, EPOLL_CTL_ADD, companion_fd, &ev) == -1) {
+      LOGE("epoll_ctl: %s\n", strerror(errno));
+
+      close(companion_fd);
+
+      message_put_uint8_t(&conn->out, 0);
+      connection_finish(context, conn);
+
+      return;
+    }
+
+    module->companion_pending = companion_fd;
+  }
+
+  if (module->companion_pending != -1) {
+    connection_unwatch(context, conn);
+
+    conn->next = module->companion_waiters;
+    module->companion_waiters = conn;
+
+    return;
+  }
+
+  companion_handoff(context, module, conn);
+}
+
+/* INFO: Runs in a worker thread. It must only touch the connection, which
+           is not watched by the event loop until the job is collected. */
+static void run_worker_request(void *data) {
+  struct Connection *conn = (struct Connection *)data;
+  struct Request *req = &conn->req;
+
+  struct root_impl impl;
+  get_impl(&impl);
+
+  switch (req->action) {
+    case GetProcessFlags: {
+      message_put_uint32_t(&conn->out, get_process_flags(req, impl));
+
+      break;
+    }
+    case GetSpecializeBundle: {
+      /* INFO: The system server is not subject to any policy, and must not
+                 take the place of the first app as the clean reference. */
+      uint32_t flags = req->system_server ? get_root_impl_flags(impl) : get_process_flags(req, impl);
+      message_put_uint32_t(&conn->out, flags);
+
+      if (flags & PROCESS_IS_MANAGER) message_put_size_t(&conn->out, 0);
+      else connection_out_modules(conn, conn->context);
+
+      /* INFO: The first process only leads to the zygote which is used as
+                 reference for the clean namespace, it must not switch to it,
+                 hence no fd for it. As the namespaces are built from zygote's,
+                 which never specializes, its reply does not wait for them. */
+      int ns_fd = -1;
+      if (flags & PROCESS_IS_FIRST_STARTED) prewarm_mns_fds((int)req->pid, impl);
+      else if (flags & PROCESS_ON_DENYLIST) ns_fd = save_clean_mns_fd((pid_t)req->pid, impl);
+
+      bool has_mns_fd = ns_fd != -1 && connection_out_mns_fd(conn, ns_fd);
+      message_put_uint8_t(&conn->out, (uint8_t)has_mns_fd);
+
+      break;
+    }
+    case UpdateMountNamespace: {
+      pid_t pid = (pid_t)req->pid;
+      enum MountNamespaceState mns_state = (enum MountNamespaceState)req->mns_state;
+
+      /* INFO: The fd goes along with an empty message, which is sent alone
+                 on failure. */
+      int ns_fd = -1;
+      if (mns_state == Clean) {
+        ns_fd = save_clean_mns_fd(pid, impl);
+      } else {
+        ns_fd = save_mns_fd(pid, mns_state, impl);
         if (ns_fd == -1) {
           LOGE("Failed to save mount namespace fd for pid %d: %s\n", pid, strerror(errno));
+        }
+      }
 
-          ret = write_uint32_t(client_fd, (uint32_t)0);
-          ASSURE_SIZE_WRITE_BREAK("UpdateMountNamespace", "ns_fd", ret, sizeof(ns_fd));
+      if (ns_fd != -1) connection_out_mns_fd(conn, ns_fd);
 
-          break;
+      break;
+    }
+    default: {
+      LOGE("Action %d should not be run by workers\n", req->action);
+
+      break;
+    }
+  }
+}
+
+static void backlog_push(struct Context *context, size_t queue, struct Connection *conn) {
+  conn->next = NULL;
+
+  if (context->backlog_tail[queue] == NULL) context->backlog[queue] = conn;
+  else context->backlog_tail[queue]->next = conn;
+
+  context->backlog_tail[queue] = conn;
+  context->backlog_len++;
+}
+
+static void listener_set_accepting(struct Context *context, bool accepting) {
+  if (context->accepting == accepting) return;
+
+  if (accepting) {
+    struct epoll_event ev = {
+      .events = EPOLLIN,
+      .data.ptr = &context->listener_source
+    };
+
+    if (epoll_ctl(context->epoll_fd, EPOLL_CTL_ADD, context->socket_fd, &ev) == -1) {
+      LOGE("epoll_ctl: %s\n", strerror(errno));
+
+      return;
+    }
+  } else {
+    epoll_ctl(context->epoll_fd, EPOLL_CTL_DEL, context->socket_fd, NULL);
+  }
+
+  context->accepting = accepting;
+}
+
+static void dispatch_to_workers(struct Context *context, struct Connection *conn, size_t queue) {
+  if (!context->has_workers) {
+    run_worker_request(conn);
+    connection_finish(context, conn);
+
+    return;
+  }
+
+  /* INFO: Keeps the order of arrival if others are already waiting */
+  if (context->backlog[queue] == NULL && workers_submit(queue, run_worker_request, conn)) return;
+
+  backlog_push(context, queue, conn);
+
+  if (context->backlog_len >= MAX_BACKLOG_LEN) {
+    LOGW("Too many requests waiting for workers, pausing new connections\n");
+
+    listener_set_accepting(context, false);
+  }
+}
+
+static void workers_on_event(struct Context *context) {
+  uint64_t finished = 0;
+  if (read(workers_get_event_fd(), &finished, sizeof(finished)) == -1 && errno != EAGAIN) {
+    LOGE("Failed to read finished jobs: %s\n", strerror(errno));
+  }
+
+  struct Connection *conn = NULL;
+  while ((conn = (struct Connection *)workers_take_done()) != NULL) {
+    connection_finish(context, conn);
+  }
+
+  for (size_t queue = 0; queue < WorkerQueuesCount; queue++) {
+    while (context->backlog[queue] != NULL) {
+      struct Connection *waiting = context->backlog[queue];
+      if (!workers_submit(queue, run_worker_request, waiting)) break;
+
+      context->backlog[queue] = waiting->next;
+      if (context->backlog[queue] == NULL) context->backlog_tail[queue] = NULL;
+
+      context->backlog_len--;
+    }
+  }
+
+  if (!context->accepting && context->backlog_len < MAX_BACKLOG_LEN / 2)
+    listener_set_accepting(context, true);
+}
+
+static void load_linker_cache(struct Context *context) {
+  message_init(&context->linker_cache);
+
+  int fd = open(PATH_LINKER_CACHE, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    if (errno != ENOENT) {
+      LOGE("Failed opening linker cache: %s\n", strerror(errno));
+    }
+
+    return;
+  }
+
+  uint8_t buf[LINKER_CACHE_MAX_LEN];
+  ssize_t len = read(fd, buf, sizeof(buf));
+  close(fd);
+
+  if (len <= 0) return;
+
+  if (!message_put(&context->linker_cache, buf, (size_t)len)) {
+    LOGE("Failed loading linker cache\n");
+  }
+}
+
+/* INFO: Kept on disk, so that it survives ReZygiskd restarts too */
+static void store_linker_cache(struct Context *context, const uint8_t *data, size_t len) {
+  context->linker_cache.len = 0;
+  if (!message_put(&context->linker_cache, data, len)) {
+    LOGE("Failed storing linker cache\n");
+
+    return;
+  }
+
+  /* INFO: Written aside and then renamed, so it is never read half written */
+  int fd = open(PATH_LINKER_CACHE ".tmp", O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd == -1) {
+    LOGE("Failed creating linker cache: %s\n", strerror(errno));
+
+    return;
+  }
+
+  ssize_t written = write(fd, data, len);
+  close(fd);
+
+  if (written != (ssize_t)len || rename(PATH_LINKER_CACHE ".tmp", PATH_LINKER_CACHE) == -1) {
+    LOGE("Failed writing linker cache: %s\n", strerror(errno));
+
+    unlink(PATH_LINKER_CACHE ".tmp");
+  }
+}
+
+/* INFO: Consumes the connection, either answering it or handing it off */
+static void handle_request(struct Context *context, struct Connection *conn) {
+  struct Request *req = &conn->req;
+
+  switch (req->action) {
+    case PingHeartbeat: {
+      struct MsgHead msg = {
+        .cmd = ZYGOTE_INJECTED,
+        .length = 0
+      };
+
+      unix_datagram_sendto(CONTROLLER_SOCKET, &msg, sizeof(struct MsgHead));
+
+      break;
+    }
+    case ZygoteRestart: {
+      policy_table_log_stats("zygote restart");
+
+      for (size_t i = 0; i < context->len; i++) {
+        if (context->modules[i].companion != -1) {
+          close(context->modules[i].companion);
+          context->modules[i].companion = -1;
         }
+      }
+
+      break;
+    }
+    case SystemServerStarted: {
+      policy_table_log_stats("system server started");
+
+      struct MsgHead msg = {
+        .cmd = SYSTEM_SERVER_STARTED,
+        .length = 0
+      };
+
+      unix_datagram_sendto(CONTROLLER_SOCKET, &msg, sizeof(struct MsgHead));
+
+      if (context->impl.impl == None || context->impl.impl == Multiple) {
+        LOGI("Unsupported environment detected. Exiting.\n");
+
+        connection_destroy(context, conn);
+        free_modules(context);
+
+        exit(1);
+      }
+
+      break;
+    }
+    case GetProcessFlags: {
+      dispatch_to_workers(context, conn, ProcessFlagsQueue);
+
+      return;
+    }
+    case GetInfo: {
+      conn->response = &context->info_manifest;
+
+      break;
+    }
+    case ReadModules: {
+      conn->response = &context->modules_manifest;
+      conn->out_fds = context->lib_fds;
+      conn->out_fds_len = context->len;
+
+      break;
+    }
+    case GetPolicyTable: {
+      /* INFO: The fd goes along with an empty message, which is sent alone
+                 when the table is not shared. */
+      if (context->policy_table_fd != -1) {
+        conn->out_fds = &context->policy_table_fd;
+        conn->out_fds_len = 1;
+      }
+
+      break;
+    }
+    case GetLinkerCache: {
+      /* INFO: Copied, as PutLinkerCache may replace it while this is sent.
+                 The message is empty when there is no cache. */
+      if (context->linker_cache.len != 0 && !message_put(&conn->out, context->linker_cache.data, context->linker_cache.len)) {
+        LOGE("Failed to put linker cache in response\n");
+      }
+
+      break;
+    }
+    case PutLinkerCache: {
+      store_linker_cache(context, req->linker_cache, req->linker_cache_len);
+
+      break;
+    }
+    case RequestCompanionSocket: {
+      handle_companion_request(context, conn, req->index);
+
+      return;
+    }
+    case GetModuleDir: {
+      if (req->index >= context->len) {
+        LOGE("Invalid module index for GetModuleDir: %zu\n", req->index);
+
+        break;
+      }
 
-        ret = write_uint32_t(client_fd, (uint32_t)ns_fd);
-        ASSURE_SIZE_WRITE_BREAK("UpdateMountNamespace", "ns_fd", ret, sizeof(ns_fd));
+      /* INFO: Reopened, so that each process has its own directory offset */
+      int fd = openat(context->modules[req->index].dir_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+      if (fd == -1) {
+        LOGE("Failed opening directory of module \"%s\": %s\n", context->modules[req->index].name, strerror(errno));
 
         break;
       }
+
+      /* INFO: The fd goes along with an empty message */
+      conn->out_fd = fd;
+      conn->out_fds = &conn->out_fd;
+      conn->out_fds_len = 1;
+
+      break;
+    }
+    case UpdateMountNamespace: {
+      dispatch_to_workers(context, conn, MountNamespaceQueue);
+
+      return;
+    }
+    case GetSpecializeBundle: {
+      dispatch_to_workers(context, conn, SpecializeBundleQueue);
+
+      return;
+    }
+  }
+
+  connection_finish(context, conn);
+}
+
+static void connection_on_event(struct Context *context, struct Connection *conn, uint32_t events) {
+  /* INFO: Already has a request, only waiting to send the response */
+  if (conn->responding) {
+    if (events & (EPOLLERR | EPOLLHUP)) {
+      connection_destroy(context, conn);
+
+      return;
+    }
+
+    connection_finish(context, conn);
+
+    return;
+  }
+
+  bool eof = false;
+  if (!connection_fill(conn, &eof)) {
+    connection_destroy(context, conn);
+
+    return;
+  }
+
+  switch (parse_request(conn, &conn->req)) {
+    case RequestComplete: {
+      bool app_specialize = conn->req.action == GetProcessFlags ||
+                            (conn->req.action == GetSpecializeBundle && !conn->req.system_server);
+
+      if (app_specialize) {
+        conn->req.first_process = context->first_process;
+        context->first_process = false;
+      }
+
+      connection_unwatch(context, conn);
+      handle_request(context, conn);
+
+      return;
+    }
+    case RequestIncomplete: {
+      if (!eof && conn->in_len < sizeof(conn->in) && !(events & EPOLLERR)) return;
+
+      if (conn->in_len != 0) {
+        LOGE("Client disconnected before completing its request\n");
+      }
+
+      break;
+    }
+    case RequestInvalid: {
+      break;
+    }
+  }
+
+  connection_destroy(context, conn);
+}
+
+static void accept_clients(struct Context *context, int socket_fd) {
+  while (1) {
+    int client_fd = accept4(socket_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (client_fd == -1) {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        LOGE("accept: %s\n", strerror(errno));
+      }
+
+      return;
+    }
+
+    struct Connection *conn = connection_create(context, client_fd);
+    if (conn == NULL) {
+      close(client_fd);
+
+      continue;
+    }
+
+    if (!connection_watch(context, conn, EPOLLIN | EPOLLRDHUP)) {
+      connection_destroy(context, conn);
+
+      continue;
+    }
+  }
+}
+
+/* INFO: The paths are only used as names, the libraries are loaded from
+           their fds, which go along with the response. */
+static bool build_manifest(struct Context *context) {
+  message_init(&context->modules_manifest);
+  message_init(&context->info_manifest);
+
+  bool built = message_put_size_t(&context->modules_manifest, context->len);
+
+  const char *arch_str = context->len != 0 ? get_arch_name(get_arch()) : "";
+  for (size_t i = 0; i < context->len && built; i++) {
+    char lib_path[PATH_MAX];
+    snprintf(lib_path, PATH_MAX, "/data/adb/modules/%s/zygisk/%s.so", context->modules[i].name, arch_str);
+
+    built = message_put_string(&context->modules_manifest, lib_path) &&
+            message_put_uint8_t(&context->modules_manifest, (uint8_t)context->modules[i].preload);
+  }
+
+  built = built && message_put_uint32_t(&context->info_manifest, get_root_impl_flags(context->impl));
+
+  /* TODO: Use pid_t */
+  built = built && message_put_uint32_t(&context->info_manifest, (uint32_t)getpid());
+  built = built && message_put_size_t(&context->info_manifest, context->len);
+
+  for (size_t i = 0; i < context->len && built; i++) {
+    built = message_put_string(&context->info_manifest, context->modules[i].name);
+  }
+
+  return built;
+}
+
+/* WARNING: Dynamic memory based */
+void zygiskd_start(char *restrict argv[]) {
+  /* INFO: When implementation is None or Multiple, it won't set the values 
+            for the context, causing it to have garbage values. In response
+            to that, "= { 0 }" is used to ensure that the values are clean. */
+  struct Context context = { 0 };
+
+  struct root_impl impl;
+  get_impl(&impl);
+  if (impl.impl == None || impl.impl == Multiple) {
+    char *msg_data = NULL;
+
+    if (impl.impl == None) msg_data = "Unsupported environment: Unknown root implementation";
+    else msg_data = "Unsupported environment: Multiple root implementations found";
+
+    struct MsgHead msg = {
+      .cmd = DAEMON_SET_ERROR_INFO,
+      .length = (int)strlen(msg_data) + 1
+    };
+
+    unix_datagram_sendto(CONTROLLER_SOCKET, &msg, sizeof(struct MsgHead));
+    unix_datagram_sendto(CONTROLLER_SOCKET, msg_data, (size_t)msg.length);
+
+    free(msg_data);
+  } else {
+    enum Architecture arch = get_arch();
+    load_modules(arch, &context);
+
+    char *module_list = NULL;
+    size_t module_list_len = 0;
+    if (context.len == 0) {
+      module_list = strdup("None");
+      module_list_len = strlen("None");
+    } else {
+      for (size_t i = 0; i < context.len; i++) {
+        if (i != context.len - 1) {
+          module_list = realloc(module_list, module_list_len + strlen(context.modules[i].name) + strlen(", ") + 1);
+          if (module_list == NULL) {
+            LOGE("Failed reallocating memory for module list.\n");
+
+            return;
+          }
+
+          strcpy(module_list + module_list_len, context.modules[i].name);
+
+          module_list_len += strlen(context.modules[i].name);
+
+          strcpy(module_list + module_list_len, ", ");
+
+          module_list_len += strlen(", ");
+        } else {
+          module_list = realloc(module_list, module_list_len + strlen(context.modules[i].name) + 1);
+          if (module_list == NULL) {
+            LOGE("Failed reallocating memory for module list.\n");
+
+            return;
+          }
+
+          strcpy(module_list + module_list_len, context.modules[i].name);
+
+          module_list_len += strlen(context.modules[i].name);
+        }
+      }
+    }
+
+    char impl_name[LONGEST_ROOT_IMPL_NAME];
+    stringify_root_impl_name(impl, impl_name);
+
+    size_t msg_length = strlen("Root: , Modules: ") + strlen(impl_name) + module_list_len + 1;
+
+    struct MsgHead msg = {
+      .cmd = DAEMON_SET_INFO,
+      .length = (int)msg_length
+    };
+
+    char *msg_data = malloc(msg_length);
+    if (msg_data == NULL) {
+      LOGE("Failed allocating memory for message data.\n");
+
+      return;
+    }
+
+    snprintf(msg_data, msg_length, "Root: %s, Modules: %s", impl_name, module_list);
+
+    unix_datagram_sendto(CONTROLLER_SOCKET, &msg, sizeof(struct MsgHead));
+    unix_datagram_sendto(CONTROLLER_SOCKET, msg_data, msg_length);
+
+    free(msg_data);
+    free(module_list);
+  }
+
+  int socket_fd = create_daemon_socket();
+  if (socket_fd == -1) {
+    LOGE("Failed creating daemon socket\n");
+
+    return;
+  }
+
+  if (fcntl(socket_fd, F_SETFL, O_NONBLOCK) == -1) {
+    LOGE("Failed setting daemon socket as non-blocking: %s\n", strerror(errno));
+
+    close(socket_fd);
+
+    return;
+  }
+
+  struct sigaction sa = { .sa_handler = SIG_IGN };
+  sigaction(SIGPIPE, &sa, NULL);
+
+  context.impl = impl;
+  context.argv = argv;
+  context.first_process = true;
+  context.policy_table_fd = policy_table_setup(get_root_impl_flags(impl));
+  load_linker_cache(&context);
+
+  if (!build_manifest(&context)) {
+    LOGE("Failed building modules manifest\n");
+
+    close(socket_fd);
+
+    return;
+  }
+
+  context.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (context.epoll_fd == -1) {
+    LOGE("epoll_create1: %s\n", strerror(errno));
+
+    close(socket_fd);
+
+    return;
+  }
+
+  context.socket_fd = socket_fd;
+  context.listener_source.type = SourceListener;
+  context.listener_source.data = NULL;
+
+  listener_set_accepting(&context, true);
+  if (!context.accepting) {
+    close(context.epoll_fd);
+    close(socket_fd);
+
+    return;
+  }
+
+  struct EventSource workers_source = {
+    .type = SourceWorkers,
+    .data = NULL
+  };
+
+  context.has_workers = workers_start(WorkerQueuesCount);
+  if (context.has_workers) {
+    struct epoll_event ev = {
+      .events = EPOLLIN,
+      .data.ptr = &workers_source
+    };
+
+    if (epoll_ctl(context.epoll_fd, EPOLL_CTL_ADD, workers_get_event_fd(), &ev) == -1) {
+      LOGE("epoll_ctl: %s\n", strerror(errno));
+
+      close(context.epoll_fd);
+      close(socket_fd);
+
+      return;
+    }
+  } else {
+    LOGW("Failed to start workers, requests will be handled in the event loop\n");
+  }
+
+  struct EventSource policies_source = {
+    .type = SourcePolicies,
+    .data = NULL
+  };
+
+  int policies_watch = policy_table_get_watch();
+  if (policies_watch != -1) {
+    struct epoll_event ev = {
+      .events = EPOLLIN,
+      .data.ptr = &policies_source
+    };
+
+    if (epoll_ctl(context.epoll_fd, EPOLL_CTL_ADD, policies_watch, &ev) == -1) {
+      LOGE("epoll_ctl: %s\n", strerror(errno));
+    }
+  }
+
+  struct epoll_event events[MAX_EVENTS];
+  while (1) {
+    int nfds = epoll_wait(context.epoll_fd, events, MAX_EVENTS, -1);
+    if (nfds == -1) {
+      if (errno == EINTR) continue;
+
+      LOGE("epoll_wait: %s\n", strerror(errno));
+
+      break;
     }
 
-    if (action != RequestCompanionSocket) close(client_fd);
+    for (int i = 0; i < nfds; i++) {
+      struct EventSource *source = (struct EventSource *)events[i].data.ptr;
 
-    continue;
+      switch (source->type) {
+        case SourceListener: {
+          accept_clients(&context, socket_fd);
+
+          break;
+        }
+        case SourceClient: {
+          connection_on_event(&context, (struct Connection *)source->data, events[i].events);
+
+          break;
+        }
+        case SourceCompanion: {
+          companion_on_event(&context, (struct Module *)source->data);
+
+          break;
+        }
+        case SourceWorkers: {
+          workers_on_event(&context);
+
+          break;
+        }
+        case SourcePolicies: {
+          policy_table_on_watch();
+
+          break;
+        }
+      }
+    }
   }
 
+  close(context.epoll_fd);
   close(socket_fd);
   free_modules(&context);
 }
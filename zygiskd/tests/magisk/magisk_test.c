@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdarg.h>
+
+/* INFO: Built once reading the database in-process, with EXPECT_SPAWNS=0, and
+           once with SQLite missing, falling back to spawning magisk. Both
+           must give the same answers. */
+#include "../../src/root_impl/magisk.c"
+
+static int failures = 0;
+
+#define CHECK(cond)                                               \
+  if (!(cond)) {                                                  \
+    fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);    \
+                                                                  \
+    failures++;                                                   \
+  }
+
+int __android_log_print(int prio, const char *tag, const char *fmt, ...) {
+  (void)prio;
+
+  va_list args;
+  va_start(args, fmt);
+  fprintf(stderr, "[%s] ", tag);
+  vfprintf(stderr, fmt, args);
+  va_end(args);
+
+  return 0;
+}
+
+static int _count_calls(void) {
+  FILE *calls = fopen(MAGISK_DB_DIR "/calls", "r");
+  if (calls == NULL) return 0;
+
+  int count = 0;
+  for (int c = fgetc(calls); c != EOF; c = fgetc(calls)) {
+    if (c == '\n') count++;
+  }
+
+  fclose(calls);
+
+  return count;
+}
+
+/* INFO: Changes the database the way Magisk would, from another process */
+static void _write_db(const char *sql) {
+  char command[PATH_MAX + 128];
+  snprintf(command, sizeof(command), "%s --sqlite \"%s\" > /dev/null", path_to_magisk, sql);
+
+  if (system(command) != 0) {
+    fprintf(stderr, "Failed to run: %s\n", command);
+
+    exit(1);
+  }
+}
+
+int main(void) {
+  snprintf(path_to_magisk, sizeof(path_to_magisk), "%s/magisk", MAGISK_DB_DIR);
+  _magisk_watch_db();
+  CHECK(magisk_get_policies_watch() != -1);
+
+  int calls = _count_calls();
+
+  CHECK(magisk_uid_granted_root(10100));
+  CHECK(!magisk_uid_granted_root(10200));
+  CHECK(!magisk_uid_granted_root(10300));
+  CHECK(magisk_uid_should_umount("com.example.bank"));
+  CHECK(magisk_uid_should_umount("com.example.bank:remote"));
+  CHECK(!magisk_uid_should_umount("com.example.game"));
+  CHECK(strcmp(policies.requester, "com.example.manager") == 0);
+
+  uint32_t generation = 0;
+  CHECK(magisk_get_policies_generation(&generation));
+
+  /* INFO: Loaded once, then answered from the cache */
+  CHECK(_count_calls() - calls == (EXPECT_SPAWNS ? 1 : 0));
+  CHECK(!magisk_policies_changed());
+
+  _write_db("UPDATE policies SET policy = 2 WHERE uid = 10200");
+  calls = _count_calls();
+
+  CHECK(magisk_policies_changed());
+  CHECK(magisk_uid_granted_root(10200));
+
+  uint32_t new_generation = 0;
+  CHECK(magisk_get_policies_generation(&new_generation));
+  CHECK(new_generation != generation);
+
+  /* INFO: Toggling the SuList has the list read once more */
+  _write_db("INSERT OR REPLACE INTO settings VALUES ('sulist', 1)");
+  calls = _count_calls();
+
+  CHECK(magisk_policies_changed());
+  CHECK(!magisk_uid_should_umount("com.example.game"));
+  CHECK(magisk_uid_should_umount("com.example.bank"));
+  CHECK(is_using_sulist);
+
+  CHECK(_count_calls() - calls == (EXPECT_SPAWNS ? 2 : 0));
+
+  if (failures != 0) {
+    fprintf(stderr, "%d check(s) failed\n", failures);
+
+    return 1;
+  }
+
+  return 0;
+}
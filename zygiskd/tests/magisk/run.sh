@@ -0,0 +1,53 @@
+#!/bin/sh
+# Host test of the Magisk policy reader, against a stand-in database and a
+#   fake magisk binary. Needs a C compiler, python3 and the SQLite of the
+#   host. Run by the hostTest task of zygiskd.
+
+set -e
+
+cd "$(dirname "$0")"
+
+CC=${CC:-cc}
+SQLITE_LIB=${SQLITE_LIB:-libsqlite3.so.0}
+
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+run() {
+  rm -f "$work"/*
+  cp magisk "$work/magisk"
+
+  python3 - "$work/magisk.db" <<'PY'
+import sqlite3, sys
+
+db = sqlite3.connect(sys.argv[1])
+db.executescript("""
+CREATE TABLE policies (uid INT, policy INT, until INT, logging INT, notification INT, PRIMARY KEY(uid));
+CREATE TABLE settings (key TEXT, value INT, PRIMARY KEY(key));
+CREATE TABLE strings (key TEXT, value TEXT, PRIMARY KEY(key));
+CREATE TABLE denylist (package_name TEXT, process TEXT, PRIMARY KEY(package_name, process));
+CREATE TABLE sulist (package_name TEXT, process TEXT, PRIMARY KEY(package_name, process));
+
+INSERT INTO policies VALUES (10100, 2, 0, 1, 1), (10200, 1, 0, 1, 1);
+INSERT INTO strings VALUES ('requester', 'com.example.manager');
+INSERT INTO denylist VALUES ('com.example.bank', 'com.example.bank'), ('com.example.bank', 'com.example.bank:remote');
+INSERT INTO sulist VALUES ('com.example.game', 'com.example.game');
+""")
+db.commit()
+PY
+
+  # INFO: The NDK stand-ins are shared with the benchmarks
+  $CC -D_GNU_SOURCE -std=c99 -Wall -Wextra -I../../../bench/include \
+    -DMIN_MAGISK_VERSION=1 -DMAGISK_DB_DIR="\"$work\"" -DSQLITE_LIB="\"$1\"" -DEXPECT_SPAWNS=$2 \
+    magisk_test.c ../../src/spawn.c -o "$work/magisk_test" -ldl -lpthread
+
+  "$work/magisk_test"
+}
+
+echo "In-process, through $SQLITE_LIB"
+run "$SQLITE_LIB" 0
+
+echo "Through the magisk binary"
+run "libmissing.so" 1
+
+echo "OK"